@@ -0,0 +1,140 @@
+#include <chrono>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "delta.hpp"
+#include "graph-formats.hpp"
+#include "graph.hpp"
+#include "snapshot.hpp"
+#include "sparse-ids.hpp"
+
+/* `k-delta' brings a graph up to date with a series of delta files (see
+ * delta.hpp), applied in the order given, and writes the result out as a
+ * compacted snapshot. The base is usually the snapshot the last run wrote,
+ * but may be a text graph, which with `--sparse-ids' may name its vertices by
+ * sparse 64-bit ids (see sparse-ids.hpp), or with `--format' a DIMACS or
+ * METIS graph (see graph-formats.hpp); the snapshot keeps the ids, and any
+ * coordinates read with `--coordinates'. With no delta files this converts
+ * the base to a snapshot.
+ */
+
+int
+main(int argc, char *argv[])
+{
+	std::string output_filename;
+	bool bad_usage = false;
+	bool sparse_ids = false;
+	std::string format = "text";
+	std::string coordinates_filename;
+
+	static option const long_options[] = {
+		{"output", required_argument, nullptr, 'o'},
+		{"sparse-ids", no_argument, nullptr, 'i'},
+		{"format", required_argument, nullptr, 'f'},
+		{"coordinates", required_argument, nullptr, 'C'},
+		{nullptr, 0, nullptr, 0},
+	};
+	int option;
+	while ((option = getopt_long(argc, argv, "o:if:C:", long_options,
+	                             nullptr)) != -1) {
+		switch (option) {
+		case 'o':
+			output_filename = optarg;
+			break;
+		case 'i':
+			sparse_ids = true;
+			break;
+		case 'f':
+			format = optarg;
+			break;
+		case 'C':
+			coordinates_filename = optarg;
+			break;
+		default:
+			bad_usage = true;
+			break;
+		}
+	}
+	if (bad_usage or output_filename.empty() or optind + 1 > argc or
+	    (!coordinates_filename.empty() and format != "dimacs")) {
+		std::cerr << "Usage: " << argv[0] << " [--sparse-ids]";
+		std::cerr << " [--format text|dimacs|metis]";
+		std::cerr << " [--coordinates COFILE]";
+		std::cerr << " --output SNAPSHOTFILE";
+		std::cerr << " BASEFILE [DELTAFILE]..." << std::endl;
+		return 2;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	std::ifstream base_file(argv[optind], std::ios::binary);
+	Graph graph;
+	bool graph_ok;
+	std::string error;
+	if (format != "text") {
+		graph_ok = read_graph_in_format(format, argv[optind],
+			coordinates_filename, graph,
+			std::thread::hardware_concurrency(), error);
+	} else if (sparse_ids and base_file.peek() != snapshot_magic[0]) {
+		graph = read_graph_with_sparse_ids(base_file,
+			std::thread::hardware_concurrency());
+		graph_ok = bool(base_file);
+	} else {
+		graph_ok = read_graph(base_file, graph);
+	}
+	if (!graph_ok) {
+		if (error.empty()) {
+			error = argv[optind] + std::string(": could not read"
+				" graph");
+		}
+		std::cerr << error << std::endl;
+		return 2;
+	}
+	auto loaded = std::chrono::steady_clock::now();
+
+	std::vector<DeltaChange> changes;
+	for (int i = optind + 1; i < argc; ++i) {
+		std::ifstream delta_file(argv[i]);
+		if (!delta_file) {
+			std::cerr << argv[i] << ": could not open" << std::endl;
+			return 2;
+		}
+		if (!read_delta(delta_file, argv[i], changes, error)) {
+			std::cerr << error << std::endl;
+			return 1;
+		}
+	}
+	DeltaSummary summary;
+	if (!apply_delta(graph, changes, summary, error)) {
+		std::cerr << error << std::endl;
+		return 1;
+	}
+	auto applied = std::chrono::steady_clock::now();
+	if (!write_snapshot(output_filename, graph)) {
+		std::cerr << output_filename << ": could not write snapshot";
+		std::cerr << std::endl;
+		return 2;
+	}
+	auto written = std::chrono::steady_clock::now();
+
+	std::chrono::duration<double, std::milli> load_time = loaded - start;
+	std::chrono::duration<double, std::milli> apply_time = applied - loaded;
+	std::chrono::duration<double, std::milli> write_time =
+		written - applied;
+	std::cout << "Applied " << argc - optind - 1 << " delta files: ";
+	std::cout << summary.added << " edges added, " << summary.removed;
+	std::cout << " removed, " << summary.reweighted << " reweighted, ";
+	std::cout << summary.new_vertices << " new vertices." << std::endl;
+	std::cout << "Now " << graph.vertices.size() << " vertices and ";
+	std::cout << graph.edges.size() << " edges." << std::endl;
+	std::cout << "Loading time: " << load_time.count();
+	std::cout << " milliseconds." << std::endl;
+	std::cout << "Applying time: " << apply_time.count();
+	std::cout << " milliseconds." << std::endl;
+	std::cout << "Writing time: " << write_time.count();
+	std::cout << " milliseconds." << std::endl;
+	return 0;
+}
@@ -0,0 +1,555 @@
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "chains.hpp"
+#include "engines.hpp"
+#include "generate.hpp"
+#include "graph.hpp"
+#include "search.hpp"
+
+/* `k-bench' is the performance regression gate, run by `meson test
+ * --benchmark'. It answers a fixed set of queries on a fixed set of graphs
+ * (the assignment's final input, with and without contracting it, and a
+ * few generated ones) and compares what it measures against a
+ * checked-in baseline:
+ *
+ * - the time spent loading, in the heuristic and in the search, which must
+ *   not be more than `--time-tolerance' slower than the baseline; and
+ * - the counts of queue pushes and pops, edge relaxations and allocations,
+ *   which must not grow by more than `--count-tolerance'.
+ *
+ * The counts are the same on every run, so they catch a regression like a
+ * std::set creeping back into a hot loop even on a machine far too noisy to
+ * trust the timings; `--counters-only' checks nothing else, and is what
+ * `meson test --benchmark' runs, so that the gate doesn't fail on a busy or
+ * slow machine. Something which got better is reported too, as a reminder
+ * to update the baseline with `--write-baseline'.
+ *
+ * Every metric checked has to be in the baseline, and everything in the
+ * baseline has to be measured, so that a new or renamed metric can't slip
+ * past the gate unchecked; either fails, unless the baseline is being
+ * rewritten.
+ */
+
+/* Every allocation made through operator new is counted, in whichever
+ * form, so the whole family is replaced to keep each allocation and its
+ * deallocation matched.
+ */
+static std::atomic<uint64_t> allocations{0};
+
+static void *
+counted_allocation(size_t size) noexcept
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	return std::malloc(size ? size : 1);
+}
+
+static void *
+counted_allocation(size_t size, std::align_val_t alignment) noexcept
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	size_t align = std::max(size_t(alignment), sizeof(void *));
+	void *pointer = nullptr;
+	return posix_memalign(&pointer, align, size ? size : 1) == 0 ?
+		pointer : nullptr;
+}
+
+void *
+operator new(size_t size)
+{
+	if (void *pointer = counted_allocation(size)) {
+		return pointer;
+	}
+	throw std::bad_alloc();
+}
+
+void *
+operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void *
+operator new(size_t size, std::nothrow_t const &) noexcept
+{
+	return counted_allocation(size);
+}
+
+void *
+operator new[](size_t size, std::nothrow_t const &) noexcept
+{
+	return counted_allocation(size);
+}
+
+void *
+operator new(size_t size, std::align_val_t alignment)
+{
+	if (void *pointer = counted_allocation(size, alignment)) {
+		return pointer;
+	}
+	throw std::bad_alloc();
+}
+
+void *
+operator new[](size_t size, std::align_val_t alignment)
+{
+	return operator new(size, alignment);
+}
+
+void *
+operator new(size_t size, std::align_val_t alignment,
+	std::nothrow_t const &) noexcept
+{
+	return counted_allocation(size, alignment);
+}
+
+void *
+operator new[](size_t size, std::align_val_t alignment,
+	std::nothrow_t const &) noexcept
+{
+	return counted_allocation(size, alignment);
+}
+
+/* Kept out of line: were GCC to inline the free() into a delete
+ * expression it would see operator new's pointer passed to free(), and
+ * warn that they don't match (-Wmismatched-new-delete).
+ */
+[[gnu::noinline]] static void
+counted_deallocation(void *pointer) noexcept
+{
+	std::free(pointer);
+}
+
+void
+operator delete(void *pointer) noexcept
+{
+	counted_deallocation(pointer);
+}
+
+void
+operator delete[](void *pointer) noexcept
+{
+	counted_deallocation(pointer);
+}
+
+void
+operator delete(void *pointer, size_t) noexcept
+{
+	counted_deallocation(pointer);
+}
+
+void
+operator delete[](void *pointer, size_t) noexcept
+{
+	counted_deallocation(pointer);
+}
+
+void
+operator delete(void *pointer, std::nothrow_t const &) noexcept
+{
+	counted_deallocation(pointer);
+}
+
+void
+operator delete[](void *pointer, std::nothrow_t const &) noexcept
+{
+	counted_deallocation(pointer);
+}
+
+void
+operator delete(void *pointer, std::align_val_t) noexcept
+{
+	counted_deallocation(pointer);
+}
+
+void
+operator delete[](void *pointer, std::align_val_t) noexcept
+{
+	counted_deallocation(pointer);
+}
+
+void
+operator delete(void *pointer, size_t, std::align_val_t) noexcept
+{
+	counted_deallocation(pointer);
+}
+
+void
+operator delete[](void *pointer, size_t, std::align_val_t) noexcept
+{
+	counted_deallocation(pointer);
+}
+
+void
+operator delete(void *pointer, std::align_val_t,
+	std::nothrow_t const &) noexcept
+{
+	counted_deallocation(pointer);
+}
+
+void
+operator delete[](void *pointer, std::align_val_t,
+	std::nothrow_t const &) noexcept
+{
+	counted_deallocation(pointer);
+}
+
+struct Workload {
+	std::string name;
+	Graph graph;
+	std::vector<Query> queries;
+	/* Negative if the graph was generated rather than loaded. */
+	double load_ms;
+};
+
+/* The queries come in groups with the same destination, so the heuristic is
+ * reused within each group as it would be by `k-short'.
+ */
+std::vector<Query>
+generate_queries(std::mt19937_64 &rng, size_t num_vertices)
+{
+	size_t const destinations = 10;
+	size_t const sources_per_destination = 3;
+	size_t const k = 20;
+	std::vector<Query> queries;
+	for (size_t i = 0; i < destinations; ++i) {
+		size_t destination = random_below(rng, num_vertices);
+		for (size_t j = 0; j < sources_per_destination; ++j) {
+			queries.push_back({random_below(rng, num_vertices),
+				destination, k});
+		}
+	}
+	return queries;
+}
+
+bool
+load_workloads(std::string const &input_filename,
+	std::vector<Workload> &workloads)
+{
+	std::mt19937_64 rng(84);
+	if (!input_filename.empty()) {
+		std::ifstream input(input_filename);
+		if (!input) {
+			std::cerr << input_filename << ": could not open";
+			std::cerr << std::endl;
+			return false;
+		}
+		auto start = std::chrono::steady_clock::now();
+		Graph graph = read_graph_from_file(input);
+		auto end = std::chrono::steady_clock::now();
+		std::vector<Query> queries;
+		Query query;
+		while (input >> query.source >> query.destination >> query.k) {
+			queries.push_back(query);
+		}
+		for (auto const &query : generate_queries(rng,
+		                                          graph.vertices.size())) {
+			queries.push_back(query);
+		}
+		double load_ms = std::chrono::duration<double, std::milli>(
+			end - start).count();
+		/* The same again contracted (see chains.hpp), which is how
+		 * `k-short' loads it.
+		 */
+		Graph contracted = graph;
+		contracted.chains = contract_chains(graph);
+		workloads.push_back({"final-input", std::move(graph),
+			queries, load_ms});
+		workloads.push_back({"final-input-contracted",
+			std::move(contracted), std::move(queries), -1.0});
+	}
+	auto add = [&](char const *name, Graph graph) {
+		auto queries = generate_queries(rng, graph.vertices.size());
+		workloads.push_back({name, std::move(graph),
+			std::move(queries), -1.0});
+	};
+	add("random", generate_random_graph(rng, 20000, 80000, false));
+	add("grid", generate_grid_graph(rng, 150, 150, false));
+	add("grid-ties", generate_grid_graph(rng, 40, 40, true));
+	add("dag", generate_dag(rng, 20000, 80000, false));
+	return true;
+}
+
+/* Measurements are kept by workload and then by metric name. Metrics whose
+ * names end in "-ms" are timings; all the rest are counts.
+ */
+using Measurements = std::map<std::string, std::map<std::string, double>>;
+
+void
+run_workload(Workload const &workload, size_t repeat,
+	std::map<std::string, double> &metrics)
+{
+	double best_heuristic = INFINITY;
+	double best_search = INFINITY;
+	for (size_t run = 0; run < repeat; ++run) {
+		Workspace workspace;
+		std::chrono::steady_clock::duration heuristic{};
+		std::chrono::steady_clock::duration searching{};
+		uint64_t allocations_before = allocations;
+		for (auto const &query : workload.queries) {
+			if (!query_is_valid(workload.graph, query)) {
+				continue;
+			}
+			auto start = std::chrono::steady_clock::now();
+			prepare_astar<BinaryQueue>(workload.graph, workspace,
+				query);
+			auto middle = std::chrono::steady_clock::now();
+			search(workload.graph, workspace, query.source,
+				query.destination, query.k);
+			auto end = std::chrono::steady_clock::now();
+			heuristic += middle - start;
+			searching += end - middle;
+		}
+		uint64_t allocated = allocations - allocations_before;
+		best_heuristic = std::min(best_heuristic,
+			std::chrono::duration<double, std::milli>(
+				heuristic).count());
+		best_search = std::min(best_search,
+			std::chrono::duration<double, std::milli>(
+				searching).count());
+		if (run == 0) {
+			auto const &work = workspace.work;
+			metrics["heuristic-pushes"] = work.heuristic_pushes;
+			metrics["heuristic-pops"] = work.heuristic_pops;
+			metrics["search-pushes"] = work.search_pushes;
+			metrics["search-pops"] = work.search_pops;
+			metrics["relaxations"] = work.relaxations;
+			metrics["allocations"] = allocated;
+		}
+	}
+	if (workload.load_ms >= 0.0) {
+		metrics["load-ms"] = workload.load_ms;
+	}
+	metrics["heuristic-ms"] = best_heuristic;
+	metrics["search-ms"] = best_search;
+}
+
+bool
+is_timing(std::string const &metric)
+{
+	return metric.size() > 3 and
+		metric.compare(metric.size() - 3, 3, "-ms") == 0;
+}
+
+/* The baseline is a text file of "WORKLOAD METRIC VALUE" lines; lines
+ * starting with `#' are comments.
+ */
+bool
+read_baseline(std::string const &filename, Measurements &baseline)
+{
+	std::ifstream file(filename);
+	if (!file) {
+		return false;
+	}
+	std::string line;
+	while (std::getline(file, line)) {
+		if (line.empty() or line[0] == '#') {
+			continue;
+		}
+		std::istringstream fields(line);
+		std::string workload, metric;
+		double value;
+		if (fields >> workload >> metric >> value) {
+			baseline[workload][metric] = value;
+		}
+	}
+	return true;
+}
+
+bool
+write_baseline(std::string const &filename, Measurements const &measured)
+{
+	std::ofstream file(filename);
+	file << "# The baseline for `k-bench', written by";
+	file << " `k-bench --write-baseline'.\n";
+	file << "# WORKLOAD METRIC VALUE\n";
+	file << std::fixed;
+	for (auto const &[workload, metrics] : measured) {
+		for (auto const &[metric, value] : metrics) {
+			file << workload << " " << metric << " ";
+			file << std::setprecision(is_timing(metric) ? 3 : 0);
+			file << value << "\n";
+		}
+	}
+	return bool(file);
+}
+
+int
+main(int argc, char *argv[])
+{
+	std::string input_filename;
+	std::string baseline_filename;
+	std::string write_filename;
+	size_t repeat = 3;
+	double time_tolerance = 0.5;
+	double count_tolerance = 0.02;
+	/* Timings this close to the baseline pass whatever the tolerance, as
+	 * the shortest phases are mostly noise.
+	 */
+	double const time_slack_ms = 1.0;
+	bool counters_only = false;
+	bool bad_usage = false;
+
+	static option const long_options[] = {
+		{"input", required_argument, nullptr, 'i'},
+		{"baseline", required_argument, nullptr, 'b'},
+		{"write-baseline", required_argument, nullptr, 'w'},
+		{"repeat", required_argument, nullptr, 'n'},
+		{"time-tolerance", required_argument, nullptr, 't'},
+		{"count-tolerance", required_argument, nullptr, 'c'},
+		{"counters-only", no_argument, nullptr, 'C'},
+		{nullptr, 0, nullptr, 0},
+	};
+	int option;
+	while ((option = getopt_long(argc, argv, "i:b:w:n:t:c:C", long_options,
+	                             nullptr)) != -1) {
+		switch (option) {
+		case 'i':
+			input_filename = optarg;
+			break;
+		case 'b':
+			baseline_filename = optarg;
+			break;
+		case 'w':
+			write_filename = optarg;
+			break;
+		case 'n':
+			repeat = std::max<size_t>(1,
+				std::strtoull(optarg, nullptr, 10));
+			break;
+		case 't':
+			time_tolerance = std::atof(optarg);
+			break;
+		case 'c':
+			count_tolerance = std::atof(optarg);
+			break;
+		case 'C':
+			counters_only = true;
+			break;
+		default:
+			bad_usage = true;
+			break;
+		}
+	}
+	if (bad_usage or optind != argc) {
+		std::cerr << "Usage: " << argv[0] << " [--input GRAPHFILE]";
+		std::cerr << " [--baseline BASELINEFILE]";
+		std::cerr << " [--write-baseline BASELINEFILE] [--repeat N]";
+		std::cerr << " [--time-tolerance FRACTION]";
+		std::cerr << " [--count-tolerance FRACTION] [--counters-only]";
+		std::cerr << std::endl;
+		return 2;
+	}
+
+	Measurements baseline;
+	if (!baseline_filename.empty() and
+	    !read_baseline(baseline_filename, baseline)) {
+		std::cerr << baseline_filename << ": could not open";
+		std::cerr << std::endl;
+		return 2;
+	}
+	std::vector<Workload> workloads;
+	if (!load_workloads(input_filename, workloads)) {
+		return 2;
+	}
+
+	Measurements measured;
+	size_t regressions = 0;
+	size_t missing = 0;
+	std::cout << std::left << std::setw(24) << "workload";
+	std::cout << std::setw(18) << "metric" << std::right;
+	std::cout << std::setw(14) << "baseline" << std::setw(14);
+	std::cout << "measured" << std::setw(10) << "change" << std::endl;
+	for (auto const &workload : workloads) {
+		auto &metrics = measured[workload.name];
+		run_workload(workload, repeat, metrics);
+		for (auto const &[metric, value] : metrics) {
+			bool timing = is_timing(metric);
+			std::cout << std::left << std::setw(24);
+			std::cout << workload.name << std::setw(18) << metric;
+			std::cout << std::right << std::fixed;
+			std::cout << std::setprecision(timing ? 3 : 0);
+			auto found = baseline[workload.name].find(metric);
+			if (found == baseline[workload.name].end()) {
+				std::cout << std::setw(14) << "-";
+				std::cout << std::setw(14) << value;
+				std::cout << "  (no baseline)" << std::endl;
+				if (!(timing and counters_only)) {
+					missing += 1;
+				}
+				continue;
+			}
+			double expected = found->second;
+			std::cout << std::setw(14) << expected;
+			std::cout << std::setw(14) << value;
+			double change = expected > 0.0
+				? (value - expected) / expected
+				: (value > 0.0 ? INFINITY : 0.0);
+			std::cout << std::setprecision(1) << std::setw(9);
+			std::cout << std::showpos << change * 100 << "%";
+			std::cout << std::noshowpos;
+			bool regressed;
+			if (timing) {
+				regressed = !counters_only and
+					value > expected * (1 + time_tolerance)
+						+ time_slack_ms;
+			} else {
+				regressed = value > expected *
+					(1 + count_tolerance);
+			}
+			if (regressed) {
+				std::cout << "  REGRESSION";
+				regressions += 1;
+			} else if (!timing and
+			           value < expected * (1 - count_tolerance)) {
+				std::cout << "  (better: update the baseline)";
+			}
+			std::cout << std::endl;
+		}
+	}
+
+	for (auto const &[workload, metrics] : baseline) {
+		for (auto const &[metric, value] : metrics) {
+			if (measured[workload].count(metric) == 0) {
+				std::cout << workload << " " << metric;
+				std::cout << ": in the baseline but not";
+				std::cout << " measured" << std::endl;
+				missing += 1;
+			}
+		}
+	}
+
+	if (!write_filename.empty() and
+	    !write_baseline(write_filename, measured)) {
+		std::cerr << write_filename << ": could not write";
+		std::cerr << std::endl;
+		return 2;
+	}
+	if (missing > 0 and !baseline_filename.empty() and
+	    write_filename.empty()) {
+		std::cout << missing << " metric";
+		std::cout << (missing == 1 ? "" : "s") << " missing from ";
+		std::cout << "the baseline or the measurements." << std::endl;
+		regressions += missing;
+	}
+	if (regressions > 0) {
+		std::cout << regressions << " regression";
+		std::cout << (regressions == 1 ? "" : "s") << " against ";
+		std::cout << baseline_filename << "." << std::endl;
+		return 1;
+	}
+	std::cout << "No regressions." << std::endl;
+	return 0;
+}
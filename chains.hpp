@@ -0,0 +1,417 @@
+#ifndef CHAINS_HPP
+#define CHAINS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "graph.hpp"
+#include "search.hpp"
+#include "trace.hpp"
+
+/* Road networks are full of vertices which only join up the two road
+ * segments either side of them, along a bend say. Working out the heuristic
+ * (a backward Dijkstra over the whole graph) costs queue operations for
+ * every one of them, but the shortest way from one of them to anywhere is
+ * always along the chain they are in to one end or the other. So the
+ * heuristic is worked out on the contracted graph of just the junctions (see
+ * `ChainContraction' in graph.hpp) and then filled in along each chain,
+ * which takes one step per vertex rather than a push and a pop.
+ *
+ * Dead ends are simpler still. A tree hanging off the rest of the graph can
+ * only be left the way it was entered, so the way from any vertex in it to
+ * anywhere outside is straight up to where it is attached. The trees are
+ * peeled off first (which can leave more vertices in chains), and filled in
+ * from the top down once the rest of the heuristic is known.
+ *
+ * A destination in the middle of a chain splits it: the junctions at either
+ * end start out as far from the destination as they are along the chain,
+ * and the vertices in that chain can also reach it directly. A destination
+ * in a tree is reached by way of the vertex the tree is attached to, which
+ * starts out as far from it as it is down the tree, and the vertices on the
+ * way down can also reach it directly.
+ *
+ * The A*-search itself still runs on the whole graph. The paths it finds are
+ * walks, which may turn back part way along a chain (to go round a block),
+ * or go down a dead end and back out of it, and there are infinitely many
+ * ways of doing either; a detour down a short cul-de-sac is often one of the
+ * next few shortest paths. So neither a chain nor a tree can be left out of
+ * the search. It only needs the heuristic to be exact, which it is.
+ */
+
+/* Peel off the trees: repeatedly take away a vertex with only one neighbour
+ * left, until there are none. A tree which is the whole of its part of the
+ * graph is peeled down to one vertex, which is left as its root.
+ */
+inline void
+peel_trees(Graph const &graph, ChainContraction &contraction)
+{
+	size_t const num_vertices = graph.vertices.size();
+	std::vector<size_t> first_neighbour(num_vertices + 1, 0);
+	std::vector<size_t> neighbours;
+	for (size_t i = 0; i < num_vertices; ++i) {
+		size_t start = neighbours.size();
+		for (auto edge_index : graph.vertices[i].outgoing) {
+			neighbours.push_back(graph.edges[edge_index].to);
+		}
+		for (auto edge_index : graph.vertices[i].incoming) {
+			neighbours.push_back(graph.edges[edge_index].from);
+		}
+		std::sort(neighbours.begin() + start, neighbours.end());
+		neighbours.erase(std::unique(neighbours.begin() + start,
+			neighbours.end()), neighbours.end());
+		neighbours.erase(std::remove(neighbours.begin() + start,
+			neighbours.end(), i), neighbours.end());
+		first_neighbour[i + 1] = neighbours.size();
+	}
+
+	auto &tree_parent = contraction.tree_parent;
+	auto &tree_order = contraction.tree_order;
+	tree_parent.assign(num_vertices, SIZE_MAX);
+	std::vector<size_t> remaining(num_vertices);
+	std::vector<size_t> ready;
+	for (size_t i = 0; i < num_vertices; ++i) {
+		remaining[i] = first_neighbour[i + 1] - first_neighbour[i];
+		if (remaining[i] == 1) {
+			ready.push_back(i);
+		}
+	}
+	while (!ready.empty()) {
+		size_t vertex = ready.back();
+		ready.pop_back();
+		if (remaining[vertex] != 1) {
+			continue;
+		}
+		size_t parent = SIZE_MAX;
+		for (size_t j = first_neighbour[vertex];
+		     j < first_neighbour[vertex + 1]; ++j) {
+			if (tree_parent[neighbours[j]] == SIZE_MAX) {
+				parent = neighbours[j];
+				break;
+			}
+		}
+		tree_parent[vertex] = parent;
+		tree_order.push_back(vertex);
+		remaining[vertex] = 0;
+		if (--remaining[parent] == 1) {
+			ready.push_back(parent);
+		}
+	}
+	std::reverse(tree_order.begin(), tree_order.end());
+
+	auto &tree_up = contraction.tree_up;
+	auto &tree_down = contraction.tree_down;
+	tree_up.assign(num_vertices, INFINITY);
+	tree_down.assign(num_vertices, INFINITY);
+	for (auto vertex : tree_order) {
+		size_t parent = tree_parent[vertex];
+		for (auto edge_index : graph.vertices[vertex].outgoing) {
+			auto const &edge = graph.edges[edge_index];
+			if (edge.to == parent) {
+				tree_up[vertex] = std::min(tree_up[vertex],
+					edge.weight);
+			}
+		}
+		for (auto edge_index : graph.vertices[vertex].incoming) {
+			auto const &edge = graph.edges[edge_index];
+			if (edge.from == parent) {
+				tree_down[vertex] = std::min(tree_down[vertex],
+					edge.weight);
+			}
+		}
+	}
+}
+
+/* A vertex is in a chain if it has edges, either way, to and from exactly
+ * two other vertices, not counting any in trees. These are its two
+ * neighbours. An edge to itself never shortens a path, so doesn't count.
+ */
+inline bool
+chain_neighbours(Graph const &graph, std::vector<size_t> const &tree_parent,
+	size_t vertex, size_t neighbours[2])
+{
+	size_t found = 0;
+	auto add = [&](size_t neighbour) {
+		if (neighbour == vertex or
+		    tree_parent[neighbour] != SIZE_MAX) {
+			return true;
+		}
+		if (found > 0 and neighbours[0] == neighbour) {
+			return true;
+		}
+		if (found > 1 and neighbours[1] == neighbour) {
+			return true;
+		}
+		if (found == 2) {
+			return false;
+		}
+		neighbours[found++] = neighbour;
+		return true;
+	};
+	auto const &edges = graph.edges;
+	for (auto edge_index : graph.vertices[vertex].outgoing) {
+		if (!add(edges[edge_index].to)) {
+			return false;
+		}
+	}
+	for (auto edge_index : graph.vertices[vertex].incoming) {
+		if (!add(edges[edge_index].from)) {
+			return false;
+		}
+	}
+	return found == 2;
+}
+
+/* Peel off the trees, then find the maximal chains in what is left and
+ * build the graph of the junctions between them. A ring of vertices which
+ * are all in chains has one of them made a junction, so that every chain
+ * has ends.
+ */
+inline std::shared_ptr<ChainContraction const>
+contract_chains(Graph const &graph)
+{
+	TraceScope trace("contract");
+	size_t const num_vertices = graph.vertices.size();
+	auto contraction = std::make_shared<ChainContraction>();
+	peel_trees(graph, *contraction);
+	auto const &tree_parent = contraction->tree_parent;
+	std::vector<size_t> neighbours(2 * num_vertices);
+	std::vector<bool> in_chain(num_vertices);
+	for (size_t i = 0; i < num_vertices; ++i) {
+		in_chain[i] = tree_parent[i] == SIZE_MAX and
+			chain_neighbours(graph, tree_parent, i,
+				&neighbours[2 * i]);
+	}
+	auto &vertex_chain = contraction->vertex_chain;
+	auto &vertex_position = contraction->vertex_position;
+	vertex_chain.assign(num_vertices, SIZE_MAX);
+	vertex_position.assign(num_vertices, 0);
+
+	/* Follow the chain from `vertex' away from `previous', collecting
+	 * the vertices in it, and return the junction it ends at (which is
+	 * `vertex' itself if the chain goes all the way round).
+	 */
+	auto follow = [&](size_t vertex, size_t previous,
+	                  std::vector<size_t> &interior) {
+		size_t start = previous;
+		while (in_chain[vertex] and vertex != start) {
+			interior.push_back(vertex);
+			size_t const *next = &neighbours[2 * vertex];
+			size_t following = next[0] == previous ? next[1]
+				: next[0];
+			previous = vertex;
+			vertex = following;
+		}
+		return vertex;
+	};
+	auto &chains = contraction->chains;
+	for (size_t i = 0; i < num_vertices; ++i) {
+		if (!in_chain[i] or vertex_chain[i] != SIZE_MAX) {
+			continue;
+		}
+		Chain chain;
+		std::vector<size_t> after;
+		chain.last = follow(neighbours[2 * i + 1], i, after);
+		if (chain.last == i) {
+			in_chain[i] = false;
+			chain.first = i;
+			chain.interior = std::move(after);
+		} else {
+			chain.first = follow(neighbours[2 * i], i,
+				chain.interior);
+			std::reverse(chain.interior.begin(),
+				chain.interior.end());
+			chain.interior.push_back(i);
+			chain.interior.insert(chain.interior.end(),
+				after.begin(), after.end());
+		}
+		for (size_t j = 0; j < chain.interior.size(); ++j) {
+			vertex_chain[chain.interior[j]] = chains.size();
+			vertex_position[chain.interior[j]] = j + 1;
+		}
+		chains.push_back(std::move(chain));
+	}
+
+	auto &junction_vertex = contraction->junction_vertex;
+	auto &vertex_junction = contraction->vertex_junction;
+	vertex_junction.assign(num_vertices, SIZE_MAX);
+	for (size_t i = 0; i < num_vertices; ++i) {
+		if (!in_chain[i] and tree_parent[i] == SIZE_MAX) {
+			vertex_junction[i] = junction_vertex.size();
+			junction_vertex.push_back(i);
+		}
+	}
+
+	/* The edges between junctions are kept as they are; each chain
+	 * becomes an edge each way, if it can be followed all the way.
+	 */
+	std::vector<Edge> junction_edges;
+	for (auto const &edge : graph.edges) {
+		if (vertex_junction[edge.from] != SIZE_MAX and
+		    vertex_junction[edge.to] != SIZE_MAX) {
+			junction_edges.push_back({edge.weight,
+				vertex_junction[edge.from],
+				vertex_junction[edge.to]});
+		}
+	}
+	for (auto &chain : chains) {
+		size_t length = chain.interior.size();
+		chain.forwards.assign(length + 1, INFINITY);
+		chain.backwards.assign(length + 1, INFINITY);
+		auto at = [&](size_t position) {
+			return position == 0 ? chain.first
+				: position > length ? chain.last
+				: chain.interior[position - 1];
+		};
+		/* Every edge along the chain has an interior vertex at one
+		 * end or the other. Both neighbours are the same junction in
+		 * a chain of one vertex with both ends at it, and then its
+		 * edges go both ways along the chain.
+		 */
+		for (size_t j = 1; j <= length; ++j) {
+			auto const &vertex = graph.vertices[at(j)];
+			for (auto edge_index : vertex.outgoing) {
+				auto const &edge = graph.edges[edge_index];
+				if (edge.to == at(j + 1)) {
+					chain.forwards[j] = std::min(
+						chain.forwards[j], edge.weight);
+				}
+				if (edge.to == at(j - 1)) {
+					chain.backwards[j - 1] = std::min(
+						chain.backwards[j - 1],
+						edge.weight);
+				}
+			}
+			for (auto edge_index : vertex.incoming) {
+				auto const &edge = graph.edges[edge_index];
+				if (edge.from == at(j - 1)) {
+					chain.forwards[j - 1] = std::min(
+						chain.forwards[j - 1],
+						edge.weight);
+				}
+				if (edge.from == at(j + 1)) {
+					chain.backwards[j] = std::min(
+						chain.backwards[j],
+						edge.weight);
+				}
+			}
+		}
+		double forwards = 0.0;
+		double backwards = 0.0;
+		for (size_t j = length + 1; j-- > 0; ) {
+			forwards = chain.forwards[j] + forwards;
+			backwards = chain.backwards[j] + backwards;
+		}
+		if (forwards != INFINITY) {
+			junction_edges.push_back({forwards,
+				vertex_junction[chain.first],
+				vertex_junction[chain.last]});
+		}
+		if (backwards != INFINITY) {
+			junction_edges.push_back({backwards,
+				vertex_junction[chain.last],
+				vertex_junction[chain.first]});
+		}
+	}
+	contraction->junctions = build_graph(junction_vertex.size(),
+		std::move(junction_edges));
+	return contraction;
+}
+
+/* Work out the heuristic for `destination' on the contracted graph, and then
+ * fill it in along every chain from the two ends, going whichever way is
+ * shorter, and then down every tree. The queue counts and traces are those
+ * of the contracted graph.
+ */
+template <typename Queue = std::priority_queue<QueueElement>>
+void
+calculate_contracted_heuristic(Graph const &graph, Workspace &workspace,
+	size_t destination)
+{
+	auto const &contraction = *graph.chains;
+	auto const &vertex_junction = contraction.vertex_junction;
+	auto const &tree_parent = contraction.tree_parent;
+	/* Outside the trees the destination is `target', or `offset' further
+	 * than it if the destination is in a tree.
+	 */
+	size_t target = destination;
+	double offset = 0.0;
+	while (tree_parent[target] != SIZE_MAX) {
+		offset = contraction.tree_down[target] + offset;
+		target = tree_parent[target];
+	}
+	HeuristicSeeds seeds;
+	size_t target_chain = contraction.vertex_chain[target];
+	if (target_chain == SIZE_MAX) {
+		seeds.push_back({vertex_junction[target], offset});
+	} else {
+		auto const &chain = contraction.chains[target_chain];
+		size_t position = contraction.vertex_position[target];
+		double to_first = offset;
+		for (size_t j = position; j-- > 0; ) {
+			to_first = chain.forwards[j] + to_first;
+		}
+		double to_last = offset;
+		for (size_t j = position; j < chain.backwards.size(); ++j) {
+			to_last = chain.backwards[j] + to_last;
+		}
+		seeds.push_back({vertex_junction[chain.first], to_first});
+		seeds.push_back({vertex_junction[chain.last], to_last});
+	}
+	calculate_heuristic<Queue>(contraction.junctions, workspace, seeds);
+
+	TraceScope trace("fill contraction");
+	std::vector<double> junction_path;
+	std::swap(junction_path, workspace.shortest_path);
+	auto &shortest_path = workspace.shortest_path;
+	shortest_path.assign(graph.vertices.size(), INFINITY);
+	for (size_t i = 0; i < junction_path.size(); ++i) {
+		size_t vertex = contraction.junction_vertex[i];
+		shortest_path[vertex] = junction_path[i];
+	}
+	for (auto const &chain : contraction.chains) {
+		size_t length = chain.interior.size();
+		double distance = shortest_path[chain.last];
+		for (size_t j = length; j > 0; --j) {
+			size_t vertex = chain.interior[j - 1];
+			distance = chain.forwards[j] + distance;
+			if (vertex == target) {
+				distance = std::min(distance, offset);
+			}
+			shortest_path[vertex] = distance;
+		}
+		distance = shortest_path[chain.first];
+		for (size_t j = 1; j <= length; ++j) {
+			size_t vertex = chain.interior[j - 1];
+			distance = chain.backwards[j - 1] + distance;
+			if (vertex == target) {
+				distance = std::min(distance, offset);
+			}
+			shortest_path[vertex] = std::min(shortest_path[vertex],
+				distance);
+		}
+		workspace.work.relaxations += 2 * length;
+	}
+	/* The vertices on the way down to a destination in a tree are as far
+	 * from it as that, or less if it is shorter to go up and round.
+	 */
+	offset = 0.0;
+	for (size_t vertex = destination; vertex != target;
+	     vertex = tree_parent[vertex]) {
+		shortest_path[vertex] = offset;
+		offset = contraction.tree_down[vertex] + offset;
+	}
+	for (auto vertex : contraction.tree_order) {
+		shortest_path[vertex] = std::min(shortest_path[vertex],
+			contraction.tree_up[vertex] +
+			shortest_path[tree_parent[vertex]]);
+	}
+	workspace.work.relaxations += contraction.tree_order.size();
+	workspace.destination = destination;
+}
+
+#endif
@@ -1,237 +1,379 @@
+#include <algorithm>
+#include <charconv>
 #include <chrono>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
-#include <iomanip>
+#include <getopt.h>
 #include <iostream>
-#include <queue>
-#include <set>
-#include <utility>
+#include <sstream>
+#include <string>
+#include <thread>
 #include <vector>
 
-struct Vertex;
+#include "graph-formats.hpp"
+#include "graph.hpp"
+#include "snapshot.hpp"
+#include "sparse-ids.hpp"
 
-struct Edge {
-	double weight;
-	size_t from;
-	size_t to;
-};
-
-struct Vertex {
-	std::vector<size_t> forwards;
-	std::vector<size_t> backwards;
-	double shortest_path;
-};
+/* `k-check' validates the paths written by `k-short --paths' (or by anything
+ * else writing the same format: a path length followed by the vertices along
+ * the path, one path per line) against the graph they were found in. Every
+ * path is checked, in parallel, and a summary is reported at the end rather
+ * than stopping at the first bad path.
+ *
+ * The graph is read the way `k-short' reads it, from a text graph (with
+ * `--sparse-ids' if its vertices have sparse ids), a snapshot, or with
+ * `--format' a DIMACS or METIS graph, and the paths name the vertices by
+ * the same original ids as the queries and answers do.
+ */
 
-struct Graph {
-	std::vector<Vertex> vertices;
-	std::vector<Edge> edges;
+/* To look up the weight of the edge between two vertices, the outgoing edges
+ * of every vertex are sorted by the vertex they go to and then by weight, and
+ * stored in flat arrays with `offsets' marking where each vertex's edges
+ * start. A lookup is then a binary search over one vertex's edges. Parallel
+ * edges end up next to each other, and give a range of possible weights.
+ */
+struct EdgeIndex {
+	std::vector<size_t> offsets;
+	std::vector<size_t> targets;
+	std::vector<double> weights;
 };
 
-struct QueueElement {
-	size_t vertex;
-	double priority;
-	double path_cost;
-	std::vector<size_t> path;
-	bool operator<(QueueElement const &other) const {
-		return priority > other.priority;
+EdgeIndex
+build_edge_index(Graph const &graph)
+{
+	EdgeIndex index;
+	auto const &vertices = graph.vertices;
+	auto const &edges = graph.edges;
+	index.offsets.reserve(vertices.size() + 1);
+	index.targets.reserve(edges.size());
+	index.weights.reserve(edges.size());
+	std::vector<std::pair<size_t, double>> outgoing;
+	for (auto const &vertex : vertices) {
+		index.offsets.push_back(index.targets.size());
+		outgoing.clear();
+		for (auto edge_index : vertex.outgoing) {
+			auto const &edge = edges[edge_index];
+			outgoing.push_back({edge.to, edge.weight});
+		}
+		std::sort(outgoing.begin(), outgoing.end());
+		for (auto const &edge : outgoing) {
+			index.targets.push_back(edge.first);
+			index.weights.push_back(edge.second);
+		}
 	}
-};
+	index.offsets.push_back(index.targets.size());
+	return index;
+}
 
-Graph
-read_graph_from_file(std::fstream &file)
+/* Find the lightest and heaviest of the edges from `from' to `to'. Returns
+ * false if there is no such edge.
+ */
+bool
+find_edge(EdgeIndex const &index, size_t from, size_t to, double &lightest,
+	double &heaviest)
 {
-	Graph graph;
-	size_t num_vertices;
-	size_t num_edges;
-	std::vector<Vertex> &vertices = graph.vertices;
-	std::vector<Edge> &edges = graph.edges;
-	file >> num_vertices;
-	file >> num_edges;
-	Vertex initial_vertex = {{}, {}, INFINITY};
-	graph.vertices = std::vector<Vertex>(num_vertices, initial_vertex);
-	graph.edges.reserve(num_edges);
-	for (size_t i = 0; i < num_edges; ++i) {
-		size_t from, to;
-		double weight;
-		file >> from;
-		file >> to;
-		file >> weight;
-		edges[i] = {weight, from, to};
-		vertices[from].forwards.push_back(i);
-		vertices[to].backwards.push_back(i);
-	}
-	return graph;
+	auto begin = index.targets.begin() + index.offsets[from];
+	auto end = index.targets.begin() + index.offsets[from + 1];
+	auto range = std::equal_range(begin, end, to);
+	if (range.first == range.second) {
+		return false;
+	}
+	lightest = index.weights[range.first - index.targets.begin()];
+	heaviest = index.weights[range.second - index.targets.begin() - 1];
+	return true;
 }
 
-void
-calculate_heuristic(Graph &graph, size_t destination)
-{
-	std::set<size_t> visited_vertices = {};
-	std::priority_queue<QueueElement> queue;
-	QueueElement initial_element = {destination, 0.0, 0.0, {}};
-	queue.push(initial_element);
-	graph.vertices[destination].shortest_path = 0.0;
-	auto &vertices = graph.vertices;
-	auto &edges = graph.edges;
-	while (!queue.empty()) {
-		auto element = queue.top();
-		auto &vertex = vertices[element.vertex];
-		queue.pop();
-		if (visited_vertices.count(element.vertex)) {
-			continue;
-		}
-		double distance = element.path_cost;
-		visited_vertices.insert(element.vertex);
-		for (auto edge_index : vertex.backwards) {
-			auto &edge = edges[edge_index];
-			if (!visited_vertices.count(edge.from)) {
-				auto &prev_vertex = vertices[edge.from];
-				double path_cost = distance + edge.weight;
-				if (path_cost < prev_vertex.shortest_path) {
-					prev_vertex.shortest_path = path_cost;
-					QueueElement element = {
-						edge.from,
-						path_cost,
-						path_cost,
-						{}};
-					queue.push(element);
-				}
-			}
+/* The tally of results, kept per thread and added together at the end. Only
+ * the first few failures are kept for the report.
+ */
+struct CheckSummary {
+	static size_t const max_failures = 10;
+	size_t paths = 0;
+	size_t valid = 0;
+	size_t ambiguous = 0;
+	size_t missing_edge = 0;
+	size_t wrong_length = 0;
+	size_t malformed = 0;
+	double largest_error = 0.0;
+	std::vector<std::pair<size_t, std::string>> failures;
+
+	void fail(size_t line, std::string message)
+	{
+		if (failures.size() < max_failures) {
+			failures.push_back({line, std::move(message)});
 		}
 	}
-}
 
+	void add(CheckSummary const &other)
+	{
+		paths += other.paths;
+		valid += other.valid;
+		ambiguous += other.ambiguous;
+		missing_edge += other.missing_edge;
+		wrong_length += other.wrong_length;
+		malformed += other.malformed;
+		largest_error = std::max(largest_error, other.largest_error);
+		failures.insert(failures.end(), other.failures.begin(),
+			other.failures.end());
+	}
+};
+
+/* Check a single path, given as the text of its line. The path's length has
+ * to match the sum of its edges' weights to within `epsilon', relative to
+ * the length. Where the path uses a pair of vertices joined by parallel
+ * edges of different weights we can't tell which edge was taken, so then the
+ * length only has to lie between the lightest and heaviest possibilities.
+ *
+ * A path ends the first time it reaches its destination, so the last vertex
+ * can't appear anywhere before it; a path of just one vertex, from a query
+ * whose source is its destination, has to have length 0.
+ */
 void
-check_path(Graph &graph, std::vector<size_t> path, double path_cost)
+check_path(Graph const &graph, EdgeIndex const &index, char const *begin,
+	char const *end, size_t line, double epsilon,
+	std::vector<size_t> &path, CheckSummary &summary)
 {
-	double path_length = 0.0;
-	for (size_t i = 0; i < (path.size() - 1); ++i) {
-		size_t cur_vertex = path[i];
-		size_t next_vertex = path[i+1];
-		auto edges = graph.vertices[cur_vertex].forwards;
-		bool found = false;
-		for (auto const &edge : edges) {
-			if (graph.edges[edge].to == next_vertex) {
-				path_length += graph.edges[edge].weight;
-				found = true;
-				break;
-			}
+	auto skip_spaces = [&]() {
+		while (begin != end and (*begin == ' ' or *begin == '\t' or
+		                         *begin == '\r')) {
+			++begin;
 		}
-		if (!found) {
-			std::cerr << "ERROR!!!\n";
-			std::cerr << cur_vertex << std::endl;
-			std::cerr << next_vertex << std::endl;
-			exit(0);
+	};
+	skip_spaces();
+	if (begin == end) {
+		return;
+	}
+	summary.paths += 1;
+	double path_length;
+	auto result = std::from_chars(begin, end, path_length);
+	if (result.ec != std::errc()) {
+		summary.malformed += 1;
+		summary.fail(line, "could not read the path length");
+		return;
+	}
+	begin = result.ptr;
+	path.clear();
+	while (skip_spaces(), begin != end) {
+		uint64_t id;
+		size_t vertex;
+		result = std::from_chars(begin, end, id);
+		if (result.ec != std::errc() or
+		    !find_vertex(graph, id, vertex)) {
+			summary.malformed += 1;
+			summary.fail(line, "could not read a vertex");
+			return;
 		}
+		begin = result.ptr;
+		path.push_back(vertex);
 	}
-	if (path_length != path_cost) {
-		std::cerr << "PATH LENGTH DOES NOT MATCH.\n";
-		std::cerr << path_length << std::endl;
-		std::cerr << path_cost << std::endl;
-	} else {
-		for (auto const &vert : path) {
-			std::cout << vert << std::endl;
+	if (path.empty()) {
+		summary.malformed += 1;
+		summary.fail(line, "the path has no vertices");
+		return;
+	}
+	if (path.size() == 1 and path_length != 0.0) {
+		summary.malformed += 1;
+		summary.fail(line, "a path of one vertex has a length");
+		return;
+	}
+	if (std::find(path.begin(), path.end() - 1, path.back()) !=
+	    path.end() - 1) {
+		summary.malformed += 1;
+		summary.fail(line, "the path goes through its destination");
+		return;
+	}
+	double lightest = 0.0;
+	double heaviest = 0.0;
+	bool exact = true;
+	for (size_t i = 1; i < path.size(); ++i) {
+		double light, heavy;
+		if (!find_edge(index, path[i - 1], path[i], light, heavy)) {
+			std::ostringstream message;
+			message << "no edge from ";
+			message << original_id(graph, path[i - 1]);
+			message << " to " << original_id(graph, path[i]);
+			summary.missing_edge += 1;
+			summary.fail(line, message.str());
+			return;
 		}
-		std::cout << "all good\n";
+		lightest += light;
+		heaviest += heavy;
+		exact = exact and light == heavy;
+	}
+	double tolerance = epsilon * std::max(1.0, std::fabs(path_length));
+	double error = 0.0;
+	if (path_length < lightest) {
+		error = lightest - path_length;
+	} else if (path_length > heaviest) {
+		error = path_length - heaviest;
+	}
+	summary.largest_error = std::max(summary.largest_error, error);
+	if (error > tolerance) {
+		std::ostringstream message;
+		message.precision(17);
+		message << "length " << path_length;
+		message << " but the edges add up to ";
+		if (exact) {
+			message << lightest;
+		} else {
+			message << "between " << lightest;
+			message << " and " << heaviest;
+		}
+		summary.wrong_length += 1;
+		summary.fail(line, message.str());
+	} else if (exact) {
+		summary.valid += 1;
+	} else {
+		summary.ambiguous += 1;
 	}
 }
 
 void
-search(Graph &graph, size_t source, size_t destination, size_t k)
+print_summary(std::ostream &out, CheckSummary const &summary)
 {
-	std::priority_queue<QueueElement> queue;
-	auto &vertices = graph.vertices;
-	auto &edges = graph.edges;
-	QueueElement initial_element = {
-		source,
-		vertices[source].shortest_path,
-		0.0,
-		{source}};
-	queue.push(initial_element);
-	while (!queue.empty()) {
-		auto element = queue.top();
-		auto &vertex = vertices[element.vertex];
-		auto path_cost = element.path_cost;
-		queue.pop();
-		if (element.vertex == destination) {
-			std::vector<size_t> path = element.path;
-			check_path(graph, path, path_cost);
-			std::cout << path_cost;
-			if (k > 1) {
-				std::cout << ", ";
-				k = k - 1;
-				continue;
-			} else {
-				std::cout << std::endl;
-				return;
-			}
-		}
-		for (auto edge_index : vertex.forwards) {
-			auto &edge = edges[edge_index];
-			double current_path_cost = path_cost + edge.weight;
-			double heuristic = vertices[edge.to].shortest_path;
-			std::vector<size_t> path = element.path;
-			path.push_back(edge.to);
-			QueueElement element = {
-				edge.to,
-				current_path_cost + heuristic,
-				current_path_cost,
-				path};
-			queue.push(element);
-		}
+	out << "Paths checked: " << summary.paths << "." << std::endl;
+	out << "Valid: " << summary.valid << "." << std::endl;
+	out << "Valid through parallel edges: " << summary.ambiguous;
+	out << "." << std::endl;
+	out << "Missing edges: " << summary.missing_edge << "." << std::endl;
+	out << "Wrong lengths: " << summary.wrong_length << "." << std::endl;
+	out << "Malformed: " << summary.malformed << "." << std::endl;
+	out << "Largest length error: " << summary.largest_error << ".";
+	out << std::endl;
+	for (auto const &failure : summary.failures) {
+		out << "line " << failure.first << ": " << failure.second;
+		out << std::endl;
 	}
 }
 
 int
 main(int argc, char *argv[])
 {
-	std::fstream input_file;
-	std::string filename;
-	size_t source, destination, k;
-	Graph graph;
-	if (argc != 2) {
-		std::cerr << "Usage: ";
-		std::cerr << argv[0] << " FILENAME" << std::endl;
-		return 0;
-	}
-	filename = argv[1];
-	input_file.open(filename);
-	if (!input_file) {
+	size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+	double epsilon = 1e-9;
+	bool sparse_ids = false;
+	std::string format = "text";
+	bool bad_usage = false;
+
+	static option const long_options[] = {
+		{"threads", required_argument, nullptr, 'j'},
+		{"epsilon", required_argument, nullptr, 'e'},
+		{"sparse-ids", no_argument, nullptr, 'i'},
+		{"format", required_argument, nullptr, 'f'},
+		{nullptr, 0, nullptr, 0},
+	};
+	int option;
+	while ((option = getopt_long(argc, argv, "j:e:if:", long_options,
+	                             nullptr)) != -1) {
+		switch (option) {
+		case 'j':
+			num_threads = std::max(1ull,
+				std::strtoull(optarg, nullptr, 10));
+			break;
+		case 'e':
+			epsilon = std::atof(optarg);
+			break;
+		case 'i':
+			sparse_ids = true;
+			break;
+		case 'f':
+			format = optarg;
+			break;
+		default:
+			bad_usage = true;
+			break;
+		}
+	}
+	if (bad_usage or optind != argc - 2) {
+		std::cerr << "Usage: " << argv[0];
+		std::cerr << " [--threads N] [--epsilon EPSILON]";
+		std::cerr << " [--sparse-ids] [--format text|dimacs|metis]";
+		std::cerr << " GRAPHFILE PATHFILE" << std::endl;
+		return 2;
+	}
+	std::ifstream graph_file(argv[optind], std::ios::binary);
+	std::ifstream paths_file(argv[optind + 1], std::ios::binary);
+	if (!graph_file or !paths_file) {
 		std::cerr << "could not open input file" << std::endl;
+		return 2;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	Graph graph;
+	bool graph_ok;
+	std::string error;
+	if (format != "text") {
+		graph_ok = read_graph_in_format(format, argv[optind], "",
+			graph, num_threads, error);
+	} else if (sparse_ids and graph_file.peek() != snapshot_magic[0]) {
+		graph = read_graph_with_sparse_ids(graph_file, num_threads);
+		graph_ok = bool(graph_file);
+	} else {
+		graph_ok = read_graph(graph_file, graph);
+	}
+	/* A graph cut short would otherwise make every path's edges look
+	 * missing.
+	 */
+	if (!graph_ok) {
+		if (error.empty()) {
+			error = argv[optind] + std::string(": could not read"
+				" graph");
+		}
+		std::cerr << error << std::endl;
+		return 2;
+	}
+	/* Only the vertices' ids are needed once the edges are indexed. */
+	EdgeIndex index = build_edge_index(graph);
+	graph.edges = std::vector<Edge>();
+	graph.vertices.assign(graph.vertices.size(), Vertex{});
+
+	/* The whole path file is read in at once and split into lines, which
+	 * are then shared out between the threads in contiguous blocks.
+	 */
+	std::string text((std::istreambuf_iterator<char>(paths_file)),
+		std::istreambuf_iterator<char>());
+	std::vector<size_t> line_starts = {0};
+	for (char const *p = text.data(), *end = p + text.size();
+	     (p = (char const *) std::memchr(p, '\n', end - p)); ++p) {
+		line_starts.push_back(p - text.data() + 1);
 	}
-	auto start_build = std::chrono::steady_clock::now();
-	graph = read_graph_from_file(input_file);
-	auto end_build = std::chrono::steady_clock::now();
-	input_file >> source;
-	input_file >> destination;
-	input_file >> k;
-	//std::cout << std::setprecision(17);
-	auto start_pre = std::chrono::steady_clock::now();
-	calculate_heuristic(graph, destination);
-	auto end_pre = std::chrono::steady_clock::now();
-
-	auto start_post = std::chrono::steady_clock::now();
-	search(graph, source, destination, k);
-	auto end_post = std::chrono::steady_clock::now();
-	std::chrono::duration<double> build_duration = end_build - start_build;
-	std::chrono::duration<double> pre_duration = end_pre - start_pre;
-	std::chrono::duration<double> post_duration = end_post - start_post;
-	std::cout << "Building time: ";
-	std::cout << 1000 * build_duration.count();
-	std::cout << " milliseconds."<< std::endl;
-
-	std::cout << "Preprocessing time: ";
-	std::cout << 1000 * pre_duration.count();
-	std::cout << " milliseconds."<< std::endl;
-
-	std::cout << "Searching time: ";
-	std::cout << 1000 * post_duration.count();
-	std::cout << " milliseconds."<< std::endl;
-
-	std::cout << "Total time: ";
-	std::cout << 1000 * (
-		pre_duration.count() + post_duration.count() +
-		build_duration.count());
-	std::cout << " milliseconds."<< std::endl;
-	return 0;
+	size_t num_lines = line_starts.size();
+	line_starts.push_back(text.size() + 1);
+
+	num_threads = std::min(num_threads, num_lines);
+	std::vector<CheckSummary> summaries(num_threads);
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < num_threads; ++t) {
+		threads.emplace_back([&, t]() {
+			size_t first = num_lines * t / num_threads;
+			size_t last = num_lines * (t + 1) / num_threads;
+			std::vector<size_t> path;
+			for (size_t i = first; i < last; ++i) {
+				char const *begin = text.data() + line_starts[i];
+				char const *end = text.data() +
+					line_starts[i + 1] - 1;
+				check_path(graph, index, begin, end, i + 1,
+					epsilon, path, summaries[t]);
+			}
+		});
+	}
+	CheckSummary summary;
+	for (size_t t = 0; t < num_threads; ++t) {
+		threads[t].join();
+		summary.add(summaries[t]);
+	}
+	summary.failures.resize(std::min(summary.failures.size(),
+		CheckSummary::max_failures));
+	auto end = std::chrono::steady_clock::now();
+
+	print_summary(std::cout, summary);
+	std::chrono::duration<double> duration = end - start;
+	std::cout << "Checking time: " << 1000 * duration.count();
+	std::cout << " milliseconds." << std::endl;
+
+	bool all_valid = summary.valid + summary.ambiguous == summary.paths;
+	return all_valid ? 0 : 1;
 }
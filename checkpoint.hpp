@@ -0,0 +1,289 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "queues.hpp"
+#include "search.hpp"
+
+/* With `--checkpoint' a batch of queries saves how far it has got every so
+ * often, so that a run which is killed part way through a search for
+ * millions of paths can be carried on with `--resume' from the last
+ * checkpoint rather than from the start.
+ *
+ * A checkpoint holds the number of the query being answered (those before
+ * it have been answered already) and the query itself, and the state of its
+ * search: the queue, the paths found so far, and the trail if the paths are
+ * being recorded. The heuristic isn't saved, as it takes seconds to work out
+ * again from the destination, against the hours the search may have taken;
+ * instead the checkpoint has the graph's checksum, and whether the heuristic
+ * was worked out on the contracted graph, so that it is only resumed on the
+ * graph that it came from, with the same heuristic. It also has whether the
+ * paths were being recorded, since a search saved without its trail can't
+ * be carried on with `--paths'.
+ *
+ * The file starts with the magic "KSCHKPT2" and is otherwise the fields of
+ * `Checkpoint' in order, each vector as its length as a 64-bit integer and
+ * then its elements as they are in memory, in native byte order. It is
+ * written to a new file, which is synced to the disk and then replaces the
+ * old one, so that a run killed while writing a checkpoint, or a machine
+ * which goes down, still leaves the one before; the new file such a run
+ * leaves behind is removed by `remove_stale_checkpoint'.
+ *
+ * The answers to the queries before the checkpoint's are flushed and synced
+ * before it is written, but the run may have written more answers before
+ * it was killed, and those queries are answered again by `--resume'. So the
+ * output of a resumed run follows the first `query_index' answers of the
+ * run it carries on from, and likewise its paths follow the paths of those
+ * queries; whatever else that run wrote is to be dropped.
+ */
+char const checkpoint_magic[8] = {'K', 'S', 'C', 'H', 'K', 'P', 'T', '2'};
+
+struct Checkpoint {
+	uint64_t graph_checksum = 0;
+	uint64_t contracted = 0;
+	uint64_t record_paths = 0;
+	uint64_t query_index = 0;
+	Query query = {0, 0, 0};
+	/* The engine whose search this is, as an index into `engines'. */
+	uint64_t engine = 0;
+	uint64_t k = 0;
+	uint64_t num_pushed = 0;
+	std::vector<QueueElement> queue;
+	std::vector<double> path_lengths;
+	std::vector<TrailEntry> trail;
+	std::vector<std::vector<size_t>> paths;
+};
+
+/* The queues' elements are saved in heap order, which is restored as it was
+ * without any sorting. std::priority_queue keeps its heap in a protected
+ * member, which a class derived from it can get at.
+ */
+template <typename T>
+struct PriorityQueueElements : std::priority_queue<T> {
+	static std::vector<T> &get(std::priority_queue<T> &queue)
+	{
+		return queue.*(&PriorityQueueElements::c);
+	}
+};
+
+template <typename T>
+std::vector<T> &
+queue_elements(std::priority_queue<T> &queue)
+{
+	return PriorityQueueElements<T>::get(queue);
+}
+
+template <typename T, size_t D>
+std::vector<T> &
+queue_elements(DaryHeap<T, D> &queue)
+{
+	return queue.elements();
+}
+
+/* Copy a paused search (see `resume_astar' in engines.hpp) into a
+ * checkpoint, or back.
+ */
+template <typename Queue>
+void
+save_search(SearchState<Queue> &state, Workspace const &workspace,
+	Checkpoint &checkpoint)
+{
+	checkpoint.k = state.k;
+	checkpoint.num_pushed = state.num_pushed;
+	checkpoint.queue = queue_elements(state.queue);
+	checkpoint.path_lengths = workspace.path_lengths;
+	checkpoint.trail = workspace.trail;
+	checkpoint.paths = workspace.paths;
+}
+
+template <typename Queue>
+void
+restore_search(Checkpoint const &checkpoint, SearchState<Queue> &state,
+	Workspace &workspace)
+{
+	state.queue = Queue();
+	queue_elements(state.queue) = checkpoint.queue;
+	state.destination = checkpoint.query.destination;
+	state.k = checkpoint.k;
+	state.num_pushed = checkpoint.num_pushed;
+	workspace.path_lengths = checkpoint.path_lengths;
+	workspace.trail = checkpoint.trail;
+	workspace.paths = checkpoint.paths;
+}
+
+template <typename T>
+void
+write_checkpoint_value(std::ostream &file, T const &value)
+{
+	file.write((char const *) &value, sizeof(value));
+}
+
+template <typename T>
+void
+write_checkpoint_vector(std::ostream &file, std::vector<T> const &values)
+{
+	write_checkpoint_value(file, uint64_t(values.size()));
+	file.write((char const *) values.data(), values.size() * sizeof(T));
+}
+
+template <typename T>
+bool
+read_checkpoint_value(std::istream &file, T &value)
+{
+	file.read((char *) &value, sizeof(value));
+	return bool(file);
+}
+
+/* The length is checked against what is left of the file before anything
+ * is allocated, so a corrupt length fails rather than taking all the memory.
+ */
+template <typename T>
+bool
+read_checkpoint_vector(std::istream &file, std::vector<T> &values,
+	uint64_t &left)
+{
+	uint64_t size;
+	if (!read_checkpoint_value(file, size) or left < sizeof(size) or
+	    (left - sizeof(size)) / sizeof(T) < size) {
+		return false;
+	}
+	values.resize(size);
+	file.read((char *) values.data(), size * sizeof(T));
+	left -= sizeof(size) + size * sizeof(T);
+	return bool(file);
+}
+
+inline std::string
+new_checkpoint_filename(std::string const &filename)
+{
+	return filename + ".new";
+}
+
+inline void
+remove_stale_checkpoint(std::string const &filename)
+{
+	std::remove(new_checkpoint_filename(filename).c_str());
+}
+
+/* Sync a file, or a directory's entries, to the disk. Something which can't
+ * be synced, like a pipe or a terminal, has nothing to lose, and counts as
+ * synced.
+ */
+inline bool
+sync_file(int fd)
+{
+	return fsync(fd) == 0 or errno == EINVAL or errno == EROFS;
+}
+
+inline bool
+sync_file(std::string const &filename)
+{
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	bool synced = sync_file(fd);
+	close(fd);
+	return synced;
+}
+
+inline std::string
+directory_of(std::string const &filename)
+{
+	size_t slash = filename.rfind('/');
+	if (slash == std::string::npos) {
+		return ".";
+	}
+	return slash == 0 ? "/" : filename.substr(0, slash);
+}
+
+inline bool
+write_checkpoint(std::string const &filename, Checkpoint const &checkpoint)
+{
+	std::string new_filename = new_checkpoint_filename(filename);
+	{
+		std::ofstream file(new_filename, std::ios::binary);
+		file.write(checkpoint_magic, sizeof(checkpoint_magic));
+		write_checkpoint_value(file, checkpoint.graph_checksum);
+		write_checkpoint_value(file, checkpoint.contracted);
+		write_checkpoint_value(file, checkpoint.record_paths);
+		write_checkpoint_value(file, checkpoint.query_index);
+		write_checkpoint_value(file, checkpoint.query);
+		write_checkpoint_value(file, checkpoint.engine);
+		write_checkpoint_value(file, checkpoint.k);
+		write_checkpoint_value(file, checkpoint.num_pushed);
+		write_checkpoint_vector(file, checkpoint.queue);
+		write_checkpoint_vector(file, checkpoint.path_lengths);
+		write_checkpoint_vector(file, checkpoint.trail);
+		write_checkpoint_value(file,
+			uint64_t(checkpoint.paths.size()));
+		for (auto const &path : checkpoint.paths) {
+			write_checkpoint_vector(file, path);
+		}
+		file.flush();
+		if (!file) {
+			return false;
+		}
+	}
+	/* The rename is only durable once the directory is synced too. */
+	return sync_file(new_filename) and
+		std::rename(new_filename.c_str(), filename.c_str()) == 0 and
+		sync_file(directory_of(filename));
+}
+
+inline bool
+read_checkpoint(std::string const &filename, Checkpoint &checkpoint)
+{
+	std::ifstream file(filename, std::ios::binary | std::ios::ate);
+	if (!file) {
+		return false;
+	}
+	uint64_t left = file.tellg();
+	file.seekg(0);
+	char magic[sizeof(checkpoint_magic)];
+	file.read(magic, sizeof(magic));
+	if (!file or std::memcmp(magic, checkpoint_magic,
+	                         sizeof(magic)) != 0) {
+		return false;
+	}
+	left -= sizeof(magic);
+	uint64_t num_paths;
+	bool ok = read_checkpoint_value(file, checkpoint.graph_checksum) and
+		read_checkpoint_value(file, checkpoint.contracted) and
+		read_checkpoint_value(file, checkpoint.record_paths) and
+		read_checkpoint_value(file, checkpoint.query_index) and
+		read_checkpoint_value(file, checkpoint.query) and
+		read_checkpoint_value(file, checkpoint.engine) and
+		read_checkpoint_value(file, checkpoint.k) and
+		read_checkpoint_value(file, checkpoint.num_pushed);
+	left -= 7 * sizeof(uint64_t) + sizeof(Query);
+	ok = ok and read_checkpoint_vector(file, checkpoint.queue, left) and
+		read_checkpoint_vector(file, checkpoint.path_lengths, left) and
+		read_checkpoint_vector(file, checkpoint.trail, left) and
+		read_checkpoint_value(file, num_paths) and
+		num_paths <= checkpoint.path_lengths.size();
+	if (!ok) {
+		return false;
+	}
+	left -= sizeof(num_paths);
+	checkpoint.paths.resize(num_paths);
+	for (auto &path : checkpoint.paths) {
+		if (!read_checkpoint_vector(file, path, left)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+#endif
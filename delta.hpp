@@ -0,0 +1,295 @@
+#ifndef DELTA_HPP
+#define DELTA_HPP
+
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <istream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "graph.hpp"
+#include "trace.hpp"
+
+/* Delta files describe changes to a graph, one per line, by the original ids
+ * of the vertices:
+ *
+ *     + FROM TO WEIGHT    add an edge
+ *     - FROM TO           remove every edge from FROM to TO
+ *     - FROM TO WEIGHT    remove one edge from FROM to TO with that weight
+ *     = FROM TO WEIGHT    set the weight of every edge from FROM to TO
+ *
+ * Blank lines and lines starting with `#' are skipped, and anything more on
+ * a line is an error. Adding an edge to a vertex the graph doesn't have adds
+ * the vertex; removing or reweighting an edge which doesn't exist is an
+ * error. On a graph numbered densely, adding an edge to a vertex more than
+ * twice the number of changes past the last one is an error too.
+ *
+ * Only a handful of vertex pairs are touched by a delta compared to the size
+ * of the graph, so the deltas are read first, and then a single pass over
+ * the graph's edges indexes just those pairs. The changes are made in order
+ * through that index, with removed edges only marked, and the edges left
+ * are compacted into a new graph at the end.
+ */
+struct DeltaChange {
+	char kind;
+	uint64_t from;
+	uint64_t to;
+	double weight;
+	bool has_weight;
+	/* The file and line, for error messages. */
+	std::string where;
+};
+
+inline bool
+read_delta(std::istream &in, std::string const &name,
+	std::vector<DeltaChange> &changes, std::string &error)
+{
+	std::string line;
+	size_t line_number = 0;
+	while (std::getline(in, line)) {
+		line_number += 1;
+		if (line.empty() or line[0] == '#') {
+			continue;
+		}
+		std::istringstream fields(line);
+		DeltaChange change;
+		change.where = name + ":" + std::to_string(line_number);
+		/* Ids are read as unsigned, which would take "-1" as the
+		 * largest id, so each must start with a digit.
+		 */
+		auto id = [&](uint64_t &value) {
+			fields >> std::ws;
+			return std::isdigit(fields.peek()) and
+				bool(fields >> value);
+		};
+		bool parsed = bool(fields >> change.kind) and
+			id(change.from) and id(change.to);
+		/* The weight is absent only if nothing follows TO; anything
+		 * else must be a weight and the end of the line.
+		 */
+		fields >> std::ws;
+		change.has_weight = parsed and !fields.eof();
+		if (change.has_weight) {
+			parsed = bool(fields >> change.weight);
+			fields >> std::ws;
+			parsed = parsed and fields.eof();
+		}
+		bool known = change.kind == '+' or change.kind == '-' or
+			change.kind == '=';
+		if (!parsed or !known or
+		    (!change.has_weight and change.kind != '-')) {
+			error = change.where + ": expected +, - or = FROM TO"
+				" WEIGHT";
+			return false;
+		}
+		if (change.has_weight and
+		    !(change.weight >= 0.0 and change.weight < INFINITY)) {
+			error = change.where + ": weights must be finite and"
+				" not negative";
+			return false;
+		}
+		changes.push_back(change);
+	}
+	return true;
+}
+
+struct DeltaSummary {
+	size_t added = 0;
+	size_t removed = 0;
+	size_t reweighted = 0;
+	size_t new_vertices = 0;
+};
+
+struct VertexPairHash {
+	size_t operator()(std::pair<size_t, size_t> const &pair) const
+	{
+		return std::hash<size_t>()(pair.first * 0x9e3779b97f4a7c15 ^
+			pair.second);
+	}
+};
+
+/* Apply the changes to the graph, in order, replacing it with the result.
+ * On an error the graph is left as it was.
+ */
+inline bool
+apply_delta(Graph &graph, std::vector<DeltaChange> const &changes,
+	DeltaSummary &summary, std::string &error)
+{
+	TraceScope trace("apply delta");
+	size_t num_vertices = graph.vertices.size();
+	uint64_t const offset = graph.id_offset;
+	std::vector<uint64_t> original_ids = graph.original_ids;
+	/* A graph numbered densely from its id offset stays so unless it
+	 * gains a vertex below the offset, when its ids are spelled out.
+	 */
+	bool dense = original_ids.empty();
+	for (auto const &change : changes) {
+		if (dense and change.kind == '+' and
+		    (change.from < offset or change.to < offset)) {
+			dense = false;
+			for (size_t i = 0; i < num_vertices; ++i) {
+				original_ids.push_back(i + offset);
+			}
+		}
+	}
+	std::unordered_map<uint64_t, size_t> new_ids;
+	/* Find the vertex with the given original id, adding it if asked. */
+	auto vertex = [&](uint64_t id, bool add, size_t &found) {
+		if (dense) {
+			if (id - offset < num_vertices) {
+				found = id - offset;
+				return true;
+			}
+			if (add) {
+				found = id - offset;
+				summary.new_vertices += found + 1 -
+					num_vertices;
+				num_vertices = found + 1;
+			}
+			return add;
+		}
+		if (find_vertex(graph, id, found)) {
+			return true;
+		}
+		auto added = new_ids.find(id);
+		if (added != new_ids.end()) {
+			found = added->second;
+			return true;
+		}
+		if (add) {
+			found = num_vertices++;
+			original_ids.push_back(id);
+			new_ids.emplace(id, found);
+			summary.new_vertices += 1;
+		}
+		return add;
+	};
+
+	/* A graph numbered densely gains every vertex up to the highest id
+	 * added, so one mistyped id could ask for billions of vertices, or
+	 * wrap around. Each change adds at most two vertices, so an id past
+	 * that many new ones is taken to be a mistake.
+	 */
+	if (dense) {
+		uint64_t limit = num_vertices + 2 * uint64_t(changes.size());
+		for (auto const &change : changes) {
+			if (change.kind == '+' and
+			    (change.from - offset >= limit or
+			     change.to - offset >= limit)) {
+				error = change.where + ": vertex id too large,"
+					" the graph has " +
+					std::to_string(num_vertices) +
+					" vertices";
+				return false;
+			}
+		}
+	}
+
+	using Pair = std::pair<size_t, size_t>;
+	std::unordered_map<Pair, std::vector<size_t>, VertexPairHash> index;
+	for (auto const &change : changes) {
+		size_t from, to;
+		if (find_vertex(graph, change.from, from) and
+		    find_vertex(graph, change.to, to)) {
+			index.emplace(Pair(from, to), std::vector<size_t>());
+		}
+	}
+	for (size_t i = 0; i < graph.edges.size(); ++i) {
+		auto const &edge = graph.edges[i];
+		auto found = index.find(Pair(edge.from, edge.to));
+		if (found != index.end()) {
+			found->second.push_back(i);
+		}
+	}
+
+	std::vector<Edge> added;
+	std::vector<bool> removed(graph.edges.size(), false);
+	/* Edges are numbered with the added ones after the graph's own. */
+	auto edge_at = [&](size_t i) -> Edge & {
+		return i < graph.edges.size() ? graph.edges[i]
+			: added[i - graph.edges.size()];
+	};
+	/* The old weight of every edge reweighted, so that an error can
+	 * put them back.
+	 */
+	std::vector<std::pair<size_t, double>> old_weights;
+	auto fail = [&](std::string const &message) {
+		for (size_t i = old_weights.size(); i > 0; --i) {
+			auto [edge, weight] = old_weights[i - 1];
+			edge_at(edge).weight = weight;
+		}
+		error = message;
+		return false;
+	};
+	for (auto const &change : changes) {
+		size_t from, to;
+		bool add = change.kind == '+';
+		if (!vertex(change.from, add, from) or
+		    !vertex(change.to, add, to)) {
+			return fail(change.where + ": no such vertex");
+		}
+		auto &edges = index[Pair(from, to)];
+		if (add) {
+			edges.push_back(graph.edges.size() + added.size());
+			added.push_back({change.weight, from, to});
+			removed.push_back(false);
+			summary.added += 1;
+			continue;
+		}
+		size_t matched = 0;
+		for (size_t j = 0; j < edges.size(); ) {
+			size_t i = edges[j];
+			if (change.kind == '=') {
+				old_weights.emplace_back(i, edge_at(i).weight);
+				edge_at(i).weight = change.weight;
+				matched += 1;
+				j += 1;
+			} else if (!change.has_weight or
+			           edge_at(i).weight == change.weight) {
+				removed[i] = true;
+				edges.erase(edges.begin() + j);
+				matched += 1;
+				if (change.has_weight) {
+					break;
+				}
+			} else {
+				j += 1;
+			}
+		}
+		if (matched == 0) {
+			return fail(change.where + ": no such edge");
+		}
+		if (change.kind == '=') {
+			summary.reweighted += matched;
+		} else {
+			summary.removed += matched;
+		}
+	}
+
+	std::vector<Edge> edges;
+	edges.reserve(graph.edges.size() + added.size() - summary.removed);
+	for (size_t i = 0; i < graph.edges.size() + added.size(); ++i) {
+		if (!removed[i]) {
+			edges.push_back(edge_at(i));
+		}
+	}
+	Graph result = build_graph(num_vertices, std::move(edges));
+	if (!original_ids.empty()) {
+		set_original_ids(result, std::move(original_ids));
+	} else {
+		result.id_offset = offset;
+	}
+	/* Vertices the delta adds have no known position. */
+	if (!graph.coordinates.empty()) {
+		result.coordinates = std::move(graph.coordinates);
+		result.coordinates.resize(num_vertices, {NAN, NAN});
+	}
+	graph = std::move(result);
+	return true;
+}
+
+#endif
@@ -0,0 +1,313 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "chains.hpp"
+#include "checkpoint.hpp"
+#include "engines.hpp"
+#include "generate.hpp"
+#include "graph.hpp"
+#include "search.hpp"
+
+/* `k-diff' is a differential test of the engines: it generates random graphs
+ * and queries, runs every engine on them, and checks that they all find the
+ * same path lengths as the reference engine. When one doesn't, the failing
+ * graph is shrunk down as far as it will go while still failing, and written
+ * out as a `k-short' input file which reproduces the problem.
+ */
+
+bool
+same_path_lengths(std::vector<double> const &a, std::vector<double> const &b,
+	double tolerance)
+{
+	if (a.size() != b.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < a.size(); ++i) {
+		double scale = std::max(1.0, std::fabs(a[i]));
+		if (!(std::fabs(a[i] - b[i]) <= tolerance * scale)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Besides every engine, the reference engine is also run with the graph's
+ * trees and chains contracted (see chains.hpp), and with its search stopped
+ * and resumed every few pops (as the scheduler does), and the 4-ary A*
+ * engine is run saving a checkpoint every few pops and carrying on from it
+ * in a new workspace (as `--resume' does), none of which must make any
+ * difference.
+ */
+size_t const num_results = num_engines + 3;
+
+char const *
+result_name(size_t index)
+{
+	return index < num_engines ? engines[index].name
+		: index == num_engines ? "astar-contracted"
+		: index == num_engines + 1 ? "astar-sliced"
+		: "astar-4ary-restored";
+}
+
+std::vector<double>
+run_sliced(Graph const &graph, Workspace &workspace, Query const &query)
+{
+	engines[0].prepare(graph, workspace, query);
+	while (!engines[0].resume(graph, workspace, query, 3)) {
+	}
+	return workspace.path_lengths;
+}
+
+std::vector<double>
+run_restored(Graph const &graph, Query const &query)
+{
+	auto const &engine = engines[1];
+	auto workspace = std::make_unique<Workspace>();
+	engine.prepare(graph, *workspace, query);
+	while (!engine.resume(graph, *workspace, query, 3)) {
+		Checkpoint checkpoint;
+		checkpoint.query = query;
+		engine.save(*workspace, checkpoint);
+		workspace = std::make_unique<Workspace>();
+		engine.prepare(graph, *workspace, query);
+		engine.restore(checkpoint, *workspace);
+	}
+	return workspace->path_lengths;
+}
+
+/* Run every engine on the query, each with a workspace of its own, and
+ * return the index of the first engine which disagrees with the reference,
+ * or 0 if they all agree. The path lengths found are left in `results'.
+ */
+size_t
+find_disagreement(Graph const &graph, Query const &query, double tolerance,
+	std::vector<std::vector<double>> &results)
+{
+	results.resize(num_results);
+	Graph contracted = graph;
+	contracted.chains = contract_chains(graph);
+	for (size_t i = 0; i < num_results; ++i) {
+		Workspace workspace;
+		if (i < num_engines) {
+			results[i] = run_engine(engines[i], graph, workspace,
+				query);
+		} else if (i == num_engines) {
+			results[i] = run_engine(engines[0], contracted,
+				workspace, query);
+		} else if (i == num_engines + 1) {
+			results[i] = run_sliced(graph, workspace, query);
+		} else {
+			results[i] = run_restored(graph, query);
+		}
+		if (i > 0 and
+		    !same_path_lengths(results[0], results[i], tolerance)) {
+			return i;
+		}
+	}
+	return 0;
+}
+
+/* Shrink a failing case. First edges are removed, in ever smaller blocks
+ * (as in delta debugging), for as long as the engines still disagree. Then
+ * `k' is lowered as far as it can be, and finally the vertices no edge uses
+ * any more are dropped and the rest renumbered.
+ */
+void
+minimise(Graph &graph, Query &query, double tolerance)
+{
+	std::vector<std::vector<double>> results;
+	size_t const num_vertices = graph.vertices.size();
+	auto still_fails = [&](std::vector<Edge> const &edges,
+	                       Query const &query) {
+		Graph smaller = build_graph(num_vertices, edges);
+		return find_disagreement(smaller, query, tolerance,
+			results) != 0;
+	};
+	std::vector<Edge> edges = graph.edges;
+	size_t block = std::max<size_t>(1, edges.size() / 2);
+	while (!edges.empty()) {
+		bool removed = false;
+		for (size_t start = 0; start < edges.size(); ) {
+			std::vector<Edge> candidate(edges.begin(),
+				edges.begin() + start);
+			size_t end = std::min(start + block, edges.size());
+			candidate.insert(candidate.end(), edges.begin() + end,
+				edges.end());
+			if (still_fails(candidate, query)) {
+				edges = std::move(candidate);
+				removed = true;
+			} else {
+				start += block;
+			}
+		}
+		if (!removed) {
+			if (block == 1) {
+				break;
+			}
+			block = std::max<size_t>(1, block / 2);
+		}
+	}
+	while (query.k > 1) {
+		Query candidate = query;
+		candidate.k -= 1;
+		if (!still_fails(edges, candidate)) {
+			break;
+		}
+		query = candidate;
+	}
+
+	std::vector<size_t> renumbered(num_vertices, SIZE_MAX);
+	size_t next = 0;
+	auto renumber = [&](size_t &vertex) {
+		if (renumbered[vertex] == SIZE_MAX) {
+			renumbered[vertex] = next++;
+		}
+		vertex = renumbered[vertex];
+	};
+	renumber(query.source);
+	renumber(query.destination);
+	for (auto &edge : edges) {
+		renumber(edge.from);
+		renumber(edge.to);
+	}
+	graph = build_graph(next, std::move(edges));
+}
+
+void
+print_path_lengths(std::ostream &out, std::vector<double> const &lengths)
+{
+	out.precision(17);
+	for (size_t i = 0; i < lengths.size(); ++i) {
+		out << (i > 0 ? ", " : "") << lengths[i];
+	}
+	out << std::endl;
+}
+
+/* Generate the graph for one iteration: a random graph, a road-like grid or
+ * a DAG, small enough that the minimiser is quick when something fails.
+ */
+Graph
+generate_case_graph(std::mt19937_64 &rng)
+{
+	bool whole_weights = random_below(rng, 2) == 0;
+	switch (random_below(rng, 3)) {
+	case 0: {
+		size_t num_vertices = 2 + random_below(rng, 40);
+		size_t num_edges = random_below(rng, 4 * num_vertices);
+		return generate_random_graph(rng, num_vertices, num_edges,
+			whole_weights);
+	}
+	case 1: {
+		size_t width = 1 + random_below(rng, 8);
+		size_t height = 2 + random_below(rng, 8);
+		return generate_grid_graph(rng, width, height, whole_weights);
+	}
+	default: {
+		size_t num_vertices = 2 + random_below(rng, 40);
+		size_t num_edges = random_below(rng, 4 * num_vertices);
+		return generate_dag(rng, num_vertices, num_edges,
+			whole_weights);
+	}
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	uint64_t seed = 1;
+	size_t iterations = 500;
+	size_t queries_per_graph = 5;
+	double tolerance = 1e-9;
+	std::string output_filename = "k-diff-failure.txt";
+	bool bad_usage = false;
+
+	static option const long_options[] = {
+		{"seed", required_argument, nullptr, 's'},
+		{"iterations", required_argument, nullptr, 'n'},
+		{"tolerance", required_argument, nullptr, 't'},
+		{"output", required_argument, nullptr, 'o'},
+		{nullptr, 0, nullptr, 0},
+	};
+	int option;
+	while ((option = getopt_long(argc, argv, "s:n:t:o:", long_options,
+	                             nullptr)) != -1) {
+		switch (option) {
+		case 's':
+			seed = std::strtoull(optarg, nullptr, 10);
+			break;
+		case 'n':
+			iterations = std::strtoull(optarg, nullptr, 10);
+			break;
+		case 't':
+			tolerance = std::atof(optarg);
+			break;
+		case 'o':
+			output_filename = optarg;
+			break;
+		default:
+			bad_usage = true;
+			break;
+		}
+	}
+	if (bad_usage or optind != argc) {
+		std::cerr << "Usage: " << argv[0] << " [--seed SEED]";
+		std::cerr << " [--iterations N] [--tolerance TOLERANCE]";
+		std::cerr << " [--output FAILUREFILE]" << std::endl;
+		return 2;
+	}
+
+	std::mt19937_64 rng(seed);
+	std::vector<std::vector<double>> results;
+	size_t num_queries = 0;
+	for (size_t iteration = 0; iteration < iterations; ++iteration) {
+		Graph graph = generate_case_graph(rng);
+		for (size_t i = 0; i < queries_per_graph; ++i) {
+			size_t num_vertices = graph.vertices.size();
+			Query query = {
+				random_below(rng, num_vertices),
+				random_below(rng, num_vertices),
+				1 + random_below(rng, 30)};
+			num_queries += 1;
+			size_t engine = find_disagreement(graph, query,
+				tolerance, results);
+			if (engine == 0) {
+				continue;
+			}
+			std::cout << "Engine `" << result_name(engine);
+			std::cout << "' disagrees with `" << result_name(0);
+			std::cout << "' on iteration " << iteration;
+			std::cout << " (seed " << seed << "):" << std::endl;
+			print_path_lengths(std::cout, results[0]);
+			print_path_lengths(std::cout, results[engine]);
+
+			minimise(graph, query, tolerance);
+			find_disagreement(graph, query, tolerance, results);
+			std::cout << "Minimised to " << graph.vertices.size();
+			std::cout << " vertices, " << graph.edges.size();
+			std::cout << " edges and k = " << query.k << ":";
+			std::cout << std::endl;
+			print_path_lengths(std::cout, results[0]);
+			print_path_lengths(std::cout, results[engine]);
+
+			std::ofstream output(output_filename);
+			write_graph_to_file(output, graph);
+			output << query.source << " " << query.destination;
+			output << " " << query.k << std::endl;
+			std::cout << "Written to " << output_filename << ".";
+			std::cout << std::endl;
+			return 1;
+		}
+	}
+	std::cout << "All " << num_results;
+	std::cout << " engines agreed on " << num_queries << " queries over ";
+	std::cout << iterations << " graphs." << std::endl;
+	return 0;
+}
@@ -0,0 +1,613 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <map>
+#include <mpi.h>
+#include <string>
+#include <vector>
+
+#include "graph.hpp"
+#include "search.hpp"
+#include "snapshot.hpp"
+
+/* `k-mpi' works out the heuristic with the graph's vertices split between
+ * MPI ranks, for graphs whose backwards Dijkstra takes too long on one
+ * machine. It runs like any MPI program, and on one machine too:
+ *
+ *	mpirun -np 4 k-mpi --queries QUERYFILE GRAPHFILE
+ *
+ * Each rank owns a block of consecutive vertices, and keeps only the edges
+ * into them, for a vertex's distance is worked out from its neighbours'
+ * along the edges out of it. From a snapshot the other ranks read the edges
+ * a chunk at a time, keeping only their own, so they never hold more than
+ * their block. A text graph can't be read that way, and each rank reads it
+ * whole before throwing away what isn't its own; `k-delta' with no
+ * deltas turns one into a snapshot. Rank 0 keeps the whole graph for the
+ * search, whatever the format: the search itself isn't distributed, only
+ * the heuristic, so rank 0 has to have room for all of it.
+ *
+ * The heuristic is worked out by delta-stepping (Meyer and Sanders): the
+ * vertices are put in buckets of distances `delta' wide, and every vertex in
+ * the lowest bucket, on every rank, is settled at once. The edges no heavier
+ * than `delta' may put vertices back into the same bucket, so they are
+ * followed over and over until the bucket stays empty on every rank; the
+ * heavier ones can't, so they are followed once, after. Each round of
+ * following edges sends each other rank the new distances for its
+ * vertices, after the duplicates have been dropped (only the least distance
+ * for a vertex is sent). MPI counts messages in ints, so anything over a
+ * gigabyte goes in pieces.
+ *
+ * Once every bucket is empty the distances are gathered on rank 0, which
+ * does the search as usual. At the end each rank's time working, and time
+ * waiting on the others or on messages, is reported along with the number of
+ * rounds and of messages, so runs with different numbers of ranks can be
+ * compared. `--check' works out each heuristic on rank 0 alone as well and
+ * counts the distances which differ.
+ */
+
+struct Block {
+	/* The vertices each rank owns are from `bounds[rank]' up to but not
+	 * including `bounds[rank + 1]'.
+	 */
+	std::vector<size_t> bounds;
+	size_t first;
+	size_t last;
+	/* The edges into each vertex, the light ones first. */
+	std::vector<size_t> offsets;
+	std::vector<size_t> light_end;
+	std::vector<size_t> from;
+	std::vector<double> weight;
+};
+
+/* A new distance from a vertex to the destination. */
+struct Relaxation {
+	uint64_t vertex;
+	double distance;
+};
+
+struct Statistics {
+	double working = 0.0;
+	double waiting = 0.0;
+	uint64_t rounds = 0;
+	uint64_t buckets = 0;
+	uint64_t relaxations_sent = 0;
+	uint64_t relaxations_dropped = 0;
+	uint64_t bytes_sent = 0;
+};
+
+using Clock = std::chrono::steady_clock;
+
+double
+seconds_since(Clock::time_point &start)
+{
+	auto now = Clock::now();
+	std::chrono::duration<double> elapsed = now - start;
+	start = now;
+	return elapsed.count();
+}
+
+Block
+block_bounds(size_t num_vertices, int rank, int num_ranks)
+{
+	Block block;
+	for (int i = 0; i <= num_ranks; ++i) {
+		block.bounds.push_back(num_vertices * i / num_ranks);
+	}
+	block.first = block.bounds[rank];
+	block.last = block.bounds[rank + 1];
+	return block;
+}
+
+/* Sort the edges into the block's vertices by the vertex they go into, the
+ * light ones first, and otherwise in the order they came in.
+ */
+void
+build_block(Block &block, std::vector<Edge> const &incoming, double delta)
+{
+	size_t num_owned = block.last - block.first;
+	block.offsets.assign(num_owned + 1, 0);
+	block.light_end.assign(num_owned, 0);
+	for (auto const &edge : incoming) {
+		block.offsets[edge.to - block.first + 1] += 1;
+		if (edge.weight <= delta) {
+			block.light_end[edge.to - block.first] += 1;
+		}
+	}
+	for (size_t v = 0; v < num_owned; ++v) {
+		block.offsets[v + 1] += block.offsets[v];
+		block.light_end[v] += block.offsets[v];
+	}
+	std::vector<size_t> next_light(block.offsets.begin(),
+		block.offsets.end() - 1);
+	std::vector<size_t> next_heavy(block.light_end);
+	block.from.resize(incoming.size());
+	block.weight.resize(incoming.size());
+	for (auto const &edge : incoming) {
+		size_t v = edge.to - block.first;
+		size_t e = edge.weight <= delta ? next_light[v]++
+			: next_heavy[v]++;
+		block.from[e] = edge.from;
+		block.weight[e] = edge.weight;
+	}
+}
+
+int
+owner(Block const &block, size_t vertex)
+{
+	auto found = std::upper_bound(block.bounds.begin(),
+		block.bounds.end(), vertex);
+	return int(found - block.bounds.begin()) - 1;
+}
+
+/* The most sent in one message; more goes in pieces of this size. */
+uint64_t const max_message = uint64_t(1) << 30;
+
+void
+send_in_pieces(void const *data, uint64_t bytes, int to,
+	std::vector<MPI_Request> &requests)
+{
+	auto pointer = (char const *) data;
+	while (bytes > 0) {
+		int size = int(std::min(bytes, max_message));
+		requests.emplace_back();
+		MPI_Isend(pointer, size, MPI_BYTE, to, 0, MPI_COMM_WORLD,
+			&requests.back());
+		pointer += size;
+		bytes -= size;
+	}
+}
+
+/* Messages between two ranks arrive in the order they were sent, so the
+ * pieces are put back together just by receiving them in order.
+ */
+void
+receive_in_pieces(void *data, uint64_t bytes, int from,
+	std::vector<MPI_Request> &requests)
+{
+	auto pointer = (char *) data;
+	while (bytes > 0) {
+		int size = int(std::min(bytes, max_message));
+		requests.emplace_back();
+		MPI_Irecv(pointer, size, MPI_BYTE, from, 0, MPI_COMM_WORLD,
+			&requests.back());
+		pointer += size;
+		bytes -= size;
+	}
+}
+
+/* Send each rank the relaxations for its vertices, keeping only the least
+ * distance for each vertex, and return those sent to this one.
+ */
+std::vector<Relaxation>
+exchange(std::vector<std::vector<Relaxation>> &outgoing, Statistics &stats,
+	Clock::time_point &clock)
+{
+	int num_ranks = int(outgoing.size());
+	int rank;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	std::vector<uint64_t> send_counts(num_ranks);
+	std::vector<uint64_t> send_offsets(num_ranks + 1, 0);
+	std::vector<Relaxation> send_buffer;
+	for (int r = 0; r < num_ranks; ++r) {
+		auto &messages = outgoing[r];
+		std::sort(messages.begin(), messages.end(),
+			[](Relaxation const &a, Relaxation const &b) {
+				return a.vertex < b.vertex or
+					(a.vertex == b.vertex and
+					 a.distance < b.distance);
+			});
+		size_t before = send_buffer.size();
+		for (size_t i = 0; i < messages.size(); ++i) {
+			if (i == 0 or messages[i].vertex !=
+			    messages[i - 1].vertex) {
+				send_buffer.push_back(messages[i]);
+			}
+		}
+		size_t sent = send_buffer.size() - before;
+		stats.relaxations_sent += sent;
+		stats.relaxations_dropped += messages.size() - sent;
+		messages.clear();
+		send_counts[r] = sent;
+		send_offsets[r + 1] = send_offsets[r] + sent;
+	}
+	stats.bytes_sent += send_offsets[num_ranks] * sizeof(Relaxation);
+	stats.working += seconds_since(clock);
+
+	std::vector<uint64_t> receive_counts(num_ranks);
+	MPI_Alltoall(send_counts.data(), 1, MPI_UINT64_T,
+		receive_counts.data(), 1, MPI_UINT64_T, MPI_COMM_WORLD);
+	std::vector<uint64_t> receive_offsets(num_ranks + 1, 0);
+	for (int r = 0; r < num_ranks; ++r) {
+		receive_offsets[r + 1] = receive_offsets[r] +
+			receive_counts[r];
+	}
+	std::vector<Relaxation> received(receive_offsets[num_ranks]);
+	std::vector<MPI_Request> requests;
+	for (int r = 0; r < num_ranks; ++r) {
+		if (r == rank) {
+			std::copy_n(send_buffer.begin() + send_offsets[r],
+				send_counts[r],
+				received.begin() + receive_offsets[r]);
+			continue;
+		}
+		receive_in_pieces(received.data() + receive_offsets[r],
+			receive_counts[r] * sizeof(Relaxation), r, requests);
+		send_in_pieces(send_buffer.data() + send_offsets[r],
+			send_counts[r] * sizeof(Relaxation), r, requests);
+	}
+	MPI_Waitall(int(requests.size()), requests.data(),
+		MPI_STATUSES_IGNORE);
+	stats.waiting += seconds_since(clock);
+	stats.rounds += 1;
+	return received;
+}
+
+/* Work out this rank's part of the heuristic for `destination'. */
+std::vector<double>
+delta_stepping(Block const &block, size_t destination, double delta,
+	Statistics &stats)
+{
+	int num_ranks = int(block.bounds.size()) - 1;
+	auto clock = Clock::now();
+	std::vector<double> distance(block.last - block.first, INFINITY);
+	std::map<uint64_t, std::vector<size_t>> buckets;
+	auto bucket_of = [&](double d) {
+		return uint64_t(d / delta);
+	};
+	auto relax = [&](std::vector<Relaxation> const &received) {
+		for (auto const &relaxation : received) {
+			size_t v = relaxation.vertex - block.first;
+			if (relaxation.distance < distance[v]) {
+				distance[v] = relaxation.distance;
+				buckets[bucket_of(relaxation.distance)]
+					.push_back(v);
+			}
+		}
+	};
+	if (destination >= block.first and destination < block.last) {
+		relax({{destination, 0.0}});
+	}
+	std::vector<std::vector<Relaxation>> outgoing(num_ranks);
+	auto follow = [&](size_t v, bool heavy) {
+		size_t begin = heavy ? block.light_end[v] : block.offsets[v];
+		size_t end = heavy ? block.offsets[v + 1] : block.light_end[v];
+		for (size_t e = begin; e < end; ++e) {
+			size_t u = block.from[e];
+			outgoing[owner(block, u)].push_back(
+				{u, distance[v] + block.weight[e]});
+		}
+	};
+	for (;;) {
+		uint64_t lowest = buckets.empty() ? UINT64_MAX
+			: buckets.begin()->first;
+		stats.working += seconds_since(clock);
+		MPI_Allreduce(MPI_IN_PLACE, &lowest, 1, MPI_UINT64_T, MPI_MIN,
+			MPI_COMM_WORLD);
+		stats.waiting += seconds_since(clock);
+		if (lowest == UINT64_MAX) {
+			break;
+		}
+		stats.buckets += 1;
+		/* A vertex is left in its old bucket when it moves to a lower
+		 * one, so those in a bucket which aren't there any more are
+		 * skipped.
+		 */
+		std::vector<size_t> settled;
+		for (;;) {
+			std::vector<size_t> frontier;
+			auto found = buckets.find(lowest);
+			if (found != buckets.end()) {
+				frontier = std::move(found->second);
+				buckets.erase(found);
+			}
+			std::sort(frontier.begin(), frontier.end());
+			frontier.erase(std::unique(frontier.begin(),
+				frontier.end()), frontier.end());
+			for (auto v : frontier) {
+				if (bucket_of(distance[v]) == lowest) {
+					follow(v, false);
+					settled.push_back(v);
+				}
+			}
+			relax(exchange(outgoing, stats, clock));
+			int more = buckets.count(lowest) > 0;
+			stats.working += seconds_since(clock);
+			MPI_Allreduce(MPI_IN_PLACE, &more, 1, MPI_INT, MPI_LOR,
+				MPI_COMM_WORLD);
+			stats.waiting += seconds_since(clock);
+			if (!more) {
+				break;
+			}
+		}
+		std::sort(settled.begin(), settled.end());
+		settled.erase(std::unique(settled.begin(), settled.end()),
+			settled.end());
+		for (auto v : settled) {
+			follow(v, true);
+		}
+		relax(exchange(outgoing, stats, clock));
+	}
+	stats.working += seconds_since(clock);
+	return distance;
+}
+
+/* Put every rank's part of the heuristic together on rank 0. */
+void
+gather_heuristic(Block const &block, std::vector<double> const &distance,
+	std::vector<double> &shortest_path, int rank)
+{
+	int num_ranks = int(block.bounds.size()) - 1;
+	std::vector<MPI_Request> requests;
+	if (rank != 0) {
+		send_in_pieces(distance.data(),
+			distance.size() * sizeof(double), 0, requests);
+	} else {
+		shortest_path.resize(block.bounds.back());
+		std::copy(distance.begin(), distance.end(),
+			shortest_path.begin());
+		for (int r = 1; r < num_ranks; ++r) {
+			receive_in_pieces(shortest_path.data() +
+				block.bounds[r], (block.bounds[r + 1] -
+				block.bounds[r]) * sizeof(double), r,
+				requests);
+		}
+	}
+	MPI_Waitall(int(requests.size()), requests.data(),
+		MPI_STATUSES_IGNORE);
+}
+
+/* Distances summed along different paths of the same length may differ in
+ * the last place.
+ */
+bool
+same_distance(double a, double b)
+{
+	return a == b or std::fabs(a - b) <= 1e-9 * std::max(std::fabs(a),
+		std::fabs(b));
+}
+
+void
+write_path_lengths(std::ostream &out, std::vector<double> const &lengths)
+{
+	for (size_t i = 0; i < lengths.size(); ++i) {
+		if (i > 0) {
+			out << ", ";
+		}
+		out << lengths[i];
+	}
+	out << std::endl;
+}
+
+int
+main(int argc, char *argv[])
+{
+	MPI_Init(&argc, &argv);
+	int rank, num_ranks;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &num_ranks);
+
+	char const *queries_filename = nullptr;
+	double delta = 0.0;
+	bool check = false;
+	bool bad_usage = false;
+	static option const long_options[] = {
+		{"queries", required_argument, nullptr, 'q'},
+		{"delta", required_argument, nullptr, 'd'},
+		{"check", no_argument, nullptr, 'c'},
+		{nullptr, 0, nullptr, 0},
+	};
+	int option;
+	while ((option = getopt_long(argc, argv, "q:d:c", long_options,
+	                             nullptr)) != -1) {
+		switch (option) {
+		case 'q':
+			queries_filename = optarg;
+			break;
+		case 'd':
+			delta = std::strtod(optarg, nullptr);
+			break;
+		case 'c':
+			check = true;
+			break;
+		default:
+			bad_usage = true;
+			break;
+		}
+	}
+	if (bad_usage or !queries_filename or optind + 1 != argc) {
+		if (rank == 0) {
+			std::cerr << "Usage: mpirun -np N " << argv[0];
+			std::cerr << " --queries QUERYFILE [--delta DELTA]";
+			std::cerr << " [--check] FILENAME" << std::endl;
+		}
+		MPI_Finalize();
+		return 2;
+	}
+
+	/* Rank 0 reads the whole graph, for the search; the others read
+	 * just the edges into their own block when they can.
+	 */
+	auto clock = Clock::now();
+	Graph graph;
+	std::ifstream file(argv[optind], std::ios::binary);
+	uint64_t num_vertices = 0;
+	uint64_t num_edges = 0;
+	double total_weight = 0.0;
+	Block block;
+	std::vector<Edge> incoming;
+	int ok;
+	if (rank != 0 and file.peek() == snapshot_magic[0]) {
+		ok = scan_snapshot_edges(file,
+			[&](uint64_t vertices, uint64_t edges) {
+				num_vertices = vertices;
+				num_edges = edges;
+				block = block_bounds(num_vertices, rank,
+					num_ranks);
+			},
+			[&](std::vector<Edge> const &edges) {
+				for (auto const &edge : edges) {
+					total_weight += edge.weight;
+					if (edge.to >= block.first and
+					    edge.to < block.last) {
+						incoming.push_back(edge);
+					}
+				}
+			});
+	} else {
+		ok = file and read_graph(file, graph) and
+			!graph_problem(graph);
+		num_vertices = graph.vertices.size();
+		num_edges = graph.edges.size();
+		block = block_bounds(num_vertices, rank, num_ranks);
+		for (auto const &edge : graph.edges) {
+			total_weight += edge.weight;
+			if (edge.to >= block.first and edge.to < block.last) {
+				incoming.push_back(edge);
+			}
+		}
+		if (rank != 0) {
+			graph = Graph();
+		}
+	}
+	MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_LAND,
+		MPI_COMM_WORLD);
+	if (!ok) {
+		if (rank == 0) {
+			std::cerr << argv[optind] << ": could not read graph";
+			std::cerr << std::endl;
+		}
+		MPI_Finalize();
+		return 2;
+	}
+	/* By default the buckets are as wide as the mean edge weight. Every
+	 * rank adds up the same weights in the same order, so they agree.
+	 */
+	if (delta <= 0.0) {
+		delta = num_edges == 0 ? 1.0
+			: total_weight / double(num_edges);
+		if (!(delta > 0.0)) {
+			delta = 1.0;
+		}
+	}
+	build_block(block, incoming, delta);
+	incoming = std::vector<Edge>();
+	double loading_time = seconds_since(clock);
+
+	std::ifstream query_file;
+	if (rank == 0) {
+		query_file.open(queries_filename);
+	}
+	Workspace workspace;
+	Statistics stats;
+	double gathering = 0.0;
+	double searching = 0.0;
+	size_t num_queries = 0;
+	size_t reused = 0;
+	uint64_t last_destination = UINT64_MAX;
+	size_t mismatches = 0;
+	for (;;) {
+		/* Rank 0 reads the next query and tells the others its
+		 * destination, or that there are no more.
+		 */
+		Query query;
+		uint64_t destination = UINT64_MAX;
+		if (rank == 0) {
+			while (query_file >> query.source >>
+			       query.destination >> query.k) {
+				if (translate_query(graph, query) and
+				    query_is_valid(graph, query)) {
+					destination = query.destination;
+					break;
+				}
+				std::cerr << "invalid query" << std::endl;
+			}
+		}
+		MPI_Bcast(&destination, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+		if (destination == UINT64_MAX) {
+			break;
+		}
+		num_queries += 1;
+		/* Every rank knows the last destination, so they all agree
+		 * on reusing its heuristic.
+		 */
+		if (destination != last_destination) {
+			auto distance = delta_stepping(block, destination,
+				delta, stats);
+			clock = Clock::now();
+			gather_heuristic(block, distance,
+				workspace.shortest_path, rank);
+			gathering += seconds_since(clock);
+			last_destination = destination;
+		} else if (rank == 0) {
+			reused += 1;
+		}
+		if (rank != 0) {
+			continue;
+		}
+		if (check and workspace.destination != destination) {
+			Workspace sequential;
+			calculate_heuristic(graph, sequential, destination);
+			for (size_t v = 0; v < num_vertices; ++v) {
+				if (!same_distance(sequential.shortest_path[v],
+				    workspace.shortest_path[v])) {
+					mismatches += 1;
+				}
+			}
+		}
+		workspace.destination = destination;
+		clock = Clock::now();
+		auto const &lengths = search(graph, workspace, query.source,
+			query.destination, query.k);
+		write_path_lengths(std::cout, lengths);
+		searching += seconds_since(clock);
+	}
+
+	/* Rank 0 reports the totals, then each rank's share of the work. */
+	double times[2] = {stats.working, stats.waiting};
+	std::vector<double> all_times(2 * num_ranks);
+	MPI_Gather(times, 2, MPI_DOUBLE, all_times.data(), 2, MPI_DOUBLE, 0,
+		MPI_COMM_WORLD);
+	uint64_t counts[3] = {stats.relaxations_sent,
+		stats.relaxations_dropped, stats.bytes_sent};
+	MPI_Reduce(rank == 0 ? MPI_IN_PLACE : counts, counts, 3,
+		MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+	if (rank == 0) {
+		auto &log = std::cerr;
+		log << "Ranks: " << num_ranks << ", delta " << delta;
+		log << ", loading time " << 1000 * loading_time;
+		log << " milliseconds." << std::endl;
+		log << "Answered " << num_queries << " queries, ";
+		log << reused << " reusing the last heuristic: ";
+		log << stats.buckets << " buckets in " << stats.rounds;
+		log << " rounds, " << counts[0] << " relaxations sent (";
+		log << counts[1] << " duplicates dropped), " << counts[2];
+		log << " bytes." << std::endl;
+		double heuristic = 0.0;
+		for (int r = 0; r < num_ranks; ++r) {
+			heuristic = std::max(heuristic, all_times[2 * r] +
+				all_times[2 * r + 1]);
+		}
+		log << "Heuristic time: " << 1000 * heuristic;
+		log << " milliseconds, gathering " << 1000 * gathering;
+		log << ", searching " << 1000 * searching << "." << std::endl;
+		for (int r = 0; r < num_ranks; ++r) {
+			log << "  rank " << r << ": " << block.bounds[r + 1] -
+				block.bounds[r] << " vertices, working ";
+			log << 1000 * all_times[2 * r] << " ms, waiting ";
+			log << 1000 * all_times[2 * r + 1] << " ms.";
+			log << std::endl;
+		}
+		if (check) {
+			log << "Check: " << mismatches;
+			log << " distances differ from Dijkstra's.";
+			log << std::endl;
+		}
+	}
+	MPI_Finalize();
+	return mismatches > 0 ? 1 : 0;
+}
@@ -0,0 +1,243 @@
+#ifndef ENGINES_HPP
+#define ENGINES_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include "chains.hpp"
+#include "checkpoint.hpp"
+#include "graph.hpp"
+#include "queues.hpp"
+#include "search.hpp"
+#include "trace.hpp"
+
+/* Every way we have of answering a query: each algorithm with each kind of
+ * queue. They must all find the same path lengths as the reference
+ * A*-search (the first engine), which is what `k-diff' checks; they differ
+ * only in how quickly they get there, which is what the planner (see
+ * planner.hpp) tries to predict.
+ */
+
+enum EngineAlgorithm {
+	ENGINE_ASTAR,
+	ENGINE_COUNTED,
+};
+
+enum QueuePolicy {
+	QUEUE_BINARY,
+	QUEUE_QUATERNARY,
+};
+
+using BinaryQueue = std::priority_queue<QueueElement>;
+using QuaternaryQueue = DaryHeap<QueueElement, 4>;
+
+/* Dijkstra's algorithm generalised to k paths: rather than being settled
+ * once, each vertex may be popped off the queue up to `k' times, the i-th
+ * time with the length of the i-th shortest path to it. The destination's
+ * pops are the answer. There is no heuristic, so this explores far more of
+ * the graph than the A*-search does, but it shares nothing with it except
+ * the graph, which makes it a good independent check.
+ */
+template <typename Queue = BinaryQueue>
+std::vector<double> const &
+search_counted(Graph const &graph, Workspace &workspace, size_t source,
+	size_t destination, size_t k)
+{
+	TraceScope trace("search");
+	auto &path_lengths = workspace.path_lengths;
+	auto &work = workspace.work;
+	path_lengths.clear();
+	std::vector<size_t> times_popped(graph.vertices.size(), 0);
+	Queue queue;
+	queue.push({source, 0.0, 0.0, SIZE_MAX});
+	work.search_pushes += 1;
+	while (!queue.empty()) {
+		auto element = queue.top();
+		queue.pop();
+		work.search_pops += 1;
+		auto &popped = times_popped[element.vertex_index];
+		if (popped == k) {
+			continue;
+		}
+		popped += 1;
+		/* Like the A*-search, a path ends the first time it
+		 * reaches the destination; it is never extended beyond it.
+		 */
+		if (element.vertex_index == destination) {
+			path_lengths.push_back(element.path_length);
+			if (path_lengths.size() == k) {
+				break;
+			}
+			continue;
+		}
+		auto const &vertex = graph.vertices[element.vertex_index];
+		work.relaxations += vertex.outgoing.size();
+		for (auto edge_index : vertex.outgoing) {
+			auto const &edge = graph.edges[edge_index];
+			if (times_popped[edge.to] == k) {
+				continue;
+			}
+			double path_length = element.path_length + edge.weight;
+			queue.push({edge.to, path_length, path_length,
+				SIZE_MAX});
+			work.search_pushes += 1;
+		}
+		workspace.queue_peak = std::max(workspace.queue_peak,
+			queue.size());
+	}
+	return path_lengths;
+}
+
+/* An engine answers a query in two phases: `prepare' does whatever can be
+ * shared by queries with the same destination (it is null if there is no
+ * such thing), and `search' does the rest.
+ *
+ * `resume' is the search done a slice at a time: each call carries on for
+ * at most `max_pops' pops, starting the search if it hasn't been, and
+ * returns true once it has finished with the answer in the workspace. It is
+ * null for engines which can only run a search through to the end.
+ *
+ * `save' copies a search which `resume' has paused into a checkpoint (see
+ * checkpoint.hpp), and `restore' pauses one as it was saved, so that the
+ * next `resume' carries on from there. They are null along with `resume'.
+ */
+struct Engine {
+	char const *name;
+	EngineAlgorithm algorithm;
+	QueuePolicy queue;
+	void (*prepare)(Graph const &, Workspace &, Query const &);
+	std::vector<double> const &(*search)(Graph const &, Workspace &,
+		Query const &);
+	bool (*resume)(Graph const &, Workspace &, Query const &, uint64_t);
+	void (*save)(Workspace const &, Checkpoint &);
+	void (*restore)(Checkpoint const &, Workspace &);
+};
+
+/* The heuristic is worked out on the contracted graph if there is one. */
+template <typename Queue>
+void
+prepare_astar(Graph const &graph, Workspace &workspace, Query const &query)
+{
+	if (workspace.destination == query.destination) {
+		return;
+	}
+	if (graph.chains) {
+		calculate_contracted_heuristic<Queue>(graph, workspace,
+			query.destination);
+	} else {
+		calculate_heuristic<Queue>(graph, workspace,
+			query.destination);
+	}
+}
+
+template <typename Queue>
+std::vector<double> const &
+run_astar(Graph const &graph, Workspace &workspace, Query const &query)
+{
+	return search<Queue>(graph, workspace, query.source,
+		query.destination, query.k);
+}
+
+/* The search's state is kept in the workspace between slices. */
+template <typename Queue>
+bool
+resume_astar(Graph const &graph, Workspace &workspace, Query const &query,
+	uint64_t max_pops)
+{
+	if (!workspace.paused_search) {
+		auto state = std::make_shared<SearchState<Queue>>();
+		start_search(workspace, *state, query.source,
+			query.destination, query.k);
+		workspace.paused_search = state;
+	}
+	auto &state = *std::static_pointer_cast<SearchState<Queue>>(
+		workspace.paused_search);
+	if (!continue_search(graph, workspace, state, max_pops)) {
+		return false;
+	}
+	workspace.paused_search.reset();
+	return true;
+}
+
+template <typename Queue>
+void
+save_astar(Workspace const &workspace, Checkpoint &checkpoint)
+{
+	auto &state = *std::static_pointer_cast<SearchState<Queue>>(
+		workspace.paused_search);
+	save_search(state, workspace, checkpoint);
+}
+
+template <typename Queue>
+void
+restore_astar(Checkpoint const &checkpoint, Workspace &workspace)
+{
+	auto state = std::make_shared<SearchState<Queue>>();
+	restore_search(checkpoint, *state, workspace);
+	workspace.paused_search = state;
+}
+
+template <typename Queue>
+std::vector<double> const &
+run_counted(Graph const &graph, Workspace &workspace, Query const &query)
+{
+	return search_counted<Queue>(graph, workspace, query.source,
+		query.destination, query.k);
+}
+
+inline Engine const engines[] = {
+	{"astar", ENGINE_ASTAR, QUEUE_BINARY,
+		prepare_astar<BinaryQueue>, run_astar<BinaryQueue>,
+		resume_astar<BinaryQueue>, save_astar<BinaryQueue>,
+		restore_astar<BinaryQueue>},
+	{"astar-4ary", ENGINE_ASTAR, QUEUE_QUATERNARY,
+		prepare_astar<QuaternaryQueue>, run_astar<QuaternaryQueue>,
+		resume_astar<QuaternaryQueue>, save_astar<QuaternaryQueue>,
+		restore_astar<QuaternaryQueue>},
+	{"dijkstra", ENGINE_COUNTED, QUEUE_BINARY,
+		nullptr, run_counted<BinaryQueue>, nullptr, nullptr, nullptr},
+	{"dijkstra-4ary", ENGINE_COUNTED, QUEUE_QUATERNARY,
+		nullptr, run_counted<QuaternaryQueue>, nullptr, nullptr,
+		nullptr},
+};
+
+inline size_t const num_engines = sizeof(engines) / sizeof(engines[0]);
+
+inline std::vector<double> const &
+run_engine(Engine const &engine, Graph const &graph, Workspace &workspace,
+	Query const &query)
+{
+	if (engine.prepare) {
+		engine.prepare(graph, workspace, query);
+	}
+	return engine.search(graph, workspace, query);
+}
+
+/* Returns null if there is no engine by that name. */
+inline Engine const *
+find_engine(std::string const &name)
+{
+	for (auto const &engine : engines) {
+		if (name == engine.name) {
+			return &engine;
+		}
+	}
+	return nullptr;
+}
+
+inline Engine const *
+find_engine(EngineAlgorithm algorithm, QueuePolicy queue)
+{
+	for (auto const &engine : engines) {
+		if (engine.algorithm == algorithm and engine.queue == queue) {
+			return &engine;
+		}
+	}
+	return nullptr;
+}
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef GENERATE_HPP
+#define GENERATE_HPP
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "graph.hpp"
+
+/* Generators of random graphs, for testing and benchmarking. Only the raw
+ * output of std::mt19937_64 is used (never the standard distributions, whose
+ * results differ between standard libraries), so the same seed gives the
+ * same graph everywhere.
+ */
+
+inline size_t
+random_below(std::mt19937_64 &rng, size_t n)
+{
+	return rng() % n;
+}
+
+inline double
+random_unit(std::mt19937_64 &rng)
+{
+	return (rng() >> 11) * 0x1.0p-53;
+}
+
+/* Weights are either small whole numbers, which produce lots of paths of
+ * exactly the same length, or real numbers between 1 and 10 like the road
+ * lengths in the real inputs.
+ */
+inline double
+random_weight(std::mt19937_64 &rng, bool whole_weights)
+{
+	if (whole_weights) {
+		return double(random_below(rng, 5));
+	}
+	return 1.0 + 9.0 * random_unit(rng);
+}
+
+/* Edges between uniformly random pairs of vertices. Self-loops and parallel
+ * edges can both occur.
+ */
+inline Graph
+generate_random_graph(std::mt19937_64 &rng, size_t num_vertices,
+	size_t num_edges, bool whole_weights)
+{
+	std::vector<Edge> edges;
+	edges.reserve(num_edges);
+	for (size_t i = 0; i < num_edges; ++i) {
+		size_t from = random_below(rng, num_vertices);
+		size_t to = random_below(rng, num_vertices);
+		edges.push_back({random_weight(rng, whole_weights), from, to});
+	}
+	return build_graph(num_vertices, std::move(edges));
+}
+
+/* A road network lookalike: a `width' by `height' grid of two-way streets
+ * (with the same length both ways), of which a few are missing and a few are
+ * duplicated.
+ */
+inline Graph
+generate_grid_graph(std::mt19937_64 &rng, size_t width, size_t height,
+	bool whole_weights)
+{
+	std::vector<Edge> edges;
+	auto add_street = [&](size_t a, size_t b) {
+		size_t copies = 1;
+		size_t roll = random_below(rng, 20);
+		if (roll == 0) {
+			return;
+		} else if (roll == 1) {
+			copies = 2;
+		}
+		for (size_t i = 0; i < copies; ++i) {
+			double weight = random_weight(rng, whole_weights);
+			edges.push_back({weight, a, b});
+			edges.push_back({weight, b, a});
+		}
+	};
+	for (size_t y = 0; y < height; ++y) {
+		for (size_t x = 0; x < width; ++x) {
+			size_t vertex = y * width + x;
+			if (x + 1 < width) {
+				add_street(vertex, vertex + 1);
+			}
+			if (y + 1 < height) {
+				add_street(vertex, vertex + width);
+			}
+		}
+	}
+	return build_graph(width * height, std::move(edges));
+}
+
+/* A directed acyclic graph: every edge goes from a lower numbered vertex to
+ * a higher numbered one.
+ */
+inline Graph
+generate_dag(std::mt19937_64 &rng, size_t num_vertices, size_t num_edges,
+	bool whole_weights)
+{
+	std::vector<Edge> edges;
+	edges.reserve(num_edges);
+	for (size_t i = 0; i < num_edges and num_vertices > 1; ++i) {
+		size_t from = random_below(rng, num_vertices - 1);
+		size_t to = from + 1 + random_below(rng,
+			num_vertices - from - 1);
+		edges.push_back({random_weight(rng, whole_weights), from, to});
+	}
+	return build_graph(num_vertices, std::move(edges));
+}
+
+#endif
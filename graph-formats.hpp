@@ -0,0 +1,506 @@
+#ifndef GRAPH_FORMATS_HPP
+#define GRAPH_FORMATS_HPP
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "graph.hpp"
+#include "parallel.hpp"
+#include "trace.hpp"
+
+/* Besides our own text format and snapshots, graphs can be read from the
+ * two formats most published graphs come in:
+ *
+ * - DIMACS, from the 9th DIMACS implementation challenge (which the
+ *   USA-road graphs are in): a ".gr" file with a "p sp N M" line and then
+ *   an "a FROM TO WEIGHT" line for each of the M arcs, and optionally a
+ *   ".co" file with a "p aux sp co N" line and then a "v VERTEX X Y" line
+ *   giving each vertex's coordinates. Lines starting with "c" are comments.
+ *
+ * - METIS: a header line "N M [FMT [NCON]]" and then a line for each vertex
+ *   listing its neighbours, each followed by the weight of the edge to it if
+ *   the last digit of FMT is 1. If the first or second digit is 1 the line
+ *   starts with the vertex's size or its NCON weights, which are skipped.
+ *   Each of the M edges is undirected and listed from both ends, so becomes
+ *   an edge each way. Lines starting with "%" are comments.
+ *
+ * Both number the vertices from 1, and they keep those numbers as their
+ * original ids, by an id offset of 1 rather than a table of every id, so
+ * that queries and answers use them as published. Edges without a weight
+ * weigh 1.
+ *
+ * The files are mapped into memory rather than read through a stream, and
+ * split at line boundaries into a block for each thread, which parses its
+ * lines in place with `std::from_chars'. The blocks' edges are then put
+ * together in order and built into the graph like any other's.
+ */
+
+/* A file mapped read-only into memory, which must be a regular file. */
+struct MappedFile {
+	char const *data = nullptr;
+	size_t size = 0;
+
+	MappedFile() = default;
+	MappedFile(MappedFile const &) = delete;
+	MappedFile &operator=(MappedFile const &) = delete;
+
+	~MappedFile()
+	{
+		if (data) {
+			munmap((void *) data, size);
+		}
+	}
+
+	bool
+	open(std::string const &filename)
+	{
+		int fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat status;
+		bool ok = fstat(fd, &status) == 0;
+		if (ok and status.st_size > 0) {
+			void *mapped = mmap(nullptr, status.st_size, PROT_READ,
+				MAP_PRIVATE, fd, 0);
+			ok = mapped != MAP_FAILED;
+			if (ok) {
+				madvise(mapped, status.st_size,
+					MADV_SEQUENTIAL);
+				data = (char const *) mapped;
+				size = status.st_size;
+			}
+		}
+		close(fd);
+		return ok;
+	}
+};
+
+/* The fields of a line, parsed one at a time. */
+struct LineFields {
+	char const *at;
+	char const *end;
+
+	void
+	skip_space()
+	{
+		while (at < end and (*at == ' ' or *at == '\t' or
+		                     *at == '\r')) {
+			++at;
+		}
+	}
+
+	bool
+	done()
+	{
+		skip_space();
+		return at == end;
+	}
+
+	template <typename T>
+	bool
+	next(T &value)
+	{
+		skip_space();
+		auto result = std::from_chars(at, end, value);
+		if (result.ec != std::errc() or (result.ptr < end and
+		    *result.ptr != ' ' and *result.ptr != '\t' and
+		    *result.ptr != '\r')) {
+			return false;
+		}
+		at = result.ptr;
+		return true;
+	}
+
+	/* Skip a word such as the "p" or "a" starting a DIMACS line. */
+	bool
+	word(char const *expected)
+	{
+		skip_space();
+		size_t length = std::strlen(expected);
+		if (size_t(end - at) < length or
+		    std::memcmp(at, expected, length) != 0) {
+			return false;
+		}
+		at += length;
+		return at == end or *at == ' ' or *at == '\t' or *at == '\r';
+	}
+};
+
+/* Call `visit(fields)' for each line of [begin, end), stopping at the first
+ * one for which it returns false and returning where that line starts (or
+ * `end' if there isn't one).
+ */
+template <typename Visit>
+char const *
+for_each_line(char const *begin, char const *end, Visit const &visit)
+{
+	while (begin < end) {
+		char const *line_end = std::find(begin, end, '\n');
+		LineFields fields = {begin, line_end};
+		if (!visit(fields)) {
+			return begin;
+		}
+		begin = line_end + (line_end < end);
+	}
+	return end;
+}
+
+/* Split [begin, end) into `num_blocks' blocks of whole lines. */
+inline std::vector<char const *>
+split_lines(char const *begin, char const *end, size_t num_blocks)
+{
+	std::vector<char const *> bounds = {begin};
+	for (size_t i = 1; i < num_blocks; ++i) {
+		char const *at = std::max(begin + (end - begin) * i /
+			num_blocks, bounds.back());
+		if (at > begin and at[-1] != '\n') {
+			at = std::find(at, end, '\n');
+			at += at < end;
+		}
+		bounds.push_back(at);
+	}
+	bounds.push_back(end);
+	return bounds;
+}
+
+/* Parse the blocks between `bounds' in parallel, a thread to each, with
+ * `parse(block, fields)' called for each line. If it returns an error
+ * message for any, the first in the file is reported along with its line
+ * number.
+ */
+template <typename Parse>
+bool
+parse_blocks(MappedFile const &file, std::vector<char const *> const &bounds,
+	std::string const &filename, std::string &error, Parse const &parse)
+{
+	size_t num_blocks = bounds.size() - 1;
+	std::vector<char const *> bad_lines(num_blocks, nullptr);
+	std::vector<char const *> messages(num_blocks, nullptr);
+	run_in_blocks(num_blocks, num_blocks, [&](size_t first, size_t last) {
+		for (size_t block = first; block < last; ++block) {
+			TraceScope trace("parse block");
+			char const *stop = for_each_line(bounds[block],
+				bounds[block + 1], [&](LineFields &fields) {
+					messages[block] = parse(block, fields);
+					return messages[block] == nullptr;
+				});
+			if (stop < bounds[block + 1]) {
+				bad_lines[block] = stop;
+			}
+		}
+	});
+	for (size_t block = 0; block < num_blocks; ++block) {
+		if (bad_lines[block]) {
+			size_t line = 1 + std::count(file.data,
+				bad_lines[block], '\n');
+			error = filename + ":" + std::to_string(line) + ": " +
+				messages[block];
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Find the "p" line of a DIMACS file, reading the fields after `format'
+ * into `counts'. The lines after it are left in [begin, end).
+ */
+inline bool
+read_dimacs_problem(MappedFile const &file, std::string const &filename,
+	char const *format, uint64_t *counts, size_t num_counts,
+	char const *&begin, std::string &error)
+{
+	bool found = false;
+	char const *end = file.data + file.size;
+	begin = for_each_line(file.data, end, [&](LineFields &fields) {
+		if (fields.done() or *fields.at == 'c') {
+			return true;
+		}
+		found = fields.word("p") and fields.word(format);
+		for (size_t i = 0; i < num_counts and found; ++i) {
+			found = fields.next(counts[i]);
+		}
+		found = found and fields.done();
+		return false;
+	});
+	if (!found) {
+		error = filename + ": expected a \"p " + format + "\" line";
+		return false;
+	}
+	begin = std::find(begin, end, '\n');
+	begin += begin < end;
+	return true;
+}
+
+inline bool
+read_dimacs_graph(std::string const &filename, Graph &graph,
+	size_t num_threads, std::string &error)
+{
+	TraceScope trace("read dimacs");
+	MappedFile file;
+	if (!file.open(filename)) {
+		error = filename + ": could not open";
+		return false;
+	}
+	uint64_t counts[2];
+	char const *begin;
+	if (!read_dimacs_problem(file, filename, "sp", counts, 2, begin,
+	                         error)) {
+		return false;
+	}
+	uint64_t const num_vertices = counts[0];
+	auto bounds = split_lines(begin, file.data + file.size, num_threads);
+	std::vector<std::vector<Edge>> blocks(bounds.size() - 1);
+	bool parsed = parse_blocks(file, bounds, filename, error,
+		[&](size_t block, LineFields &fields) -> char const * {
+			if (fields.done() or *fields.at == 'c') {
+				return nullptr;
+			}
+			uint64_t from, to;
+			double weight;
+			if (!fields.word("a") or !fields.next(from) or
+			    !fields.next(to) or !fields.next(weight) or
+			    !fields.done()) {
+				return "expected a FROM TO WEIGHT";
+			}
+			if (from < 1 or from > num_vertices or to < 1 or
+			    to > num_vertices) {
+				return "no such vertex";
+			}
+			if (!(weight >= 0.0 and weight < INFINITY)) {
+				return "weights must be finite and not"
+					" negative";
+			}
+			blocks[block].push_back({weight, from - 1, to - 1});
+			return nullptr;
+		});
+	if (!parsed) {
+		return false;
+	}
+	std::vector<Edge> edges;
+	for (auto const &block : blocks) {
+		edges.insert(edges.end(), block.begin(), block.end());
+	}
+	if (edges.size() != counts[1]) {
+		error = filename + ": expected " + std::to_string(counts[1]) +
+			" arcs but found " + std::to_string(edges.size());
+		return false;
+	}
+	graph = build_graph(num_vertices, std::move(edges));
+	graph.id_offset = 1;
+	return true;
+}
+
+/* Read the coordinates of a DIMACS graph's vertices from a ".co" file. */
+inline bool
+read_dimacs_coordinates(std::string const &filename, Graph &graph,
+	size_t num_threads, std::string &error)
+{
+	TraceScope trace("read coordinates");
+	MappedFile file;
+	if (!file.open(filename)) {
+		error = filename + ": could not open";
+		return false;
+	}
+	uint64_t num_vertices;
+	char const *begin;
+	if (!read_dimacs_problem(file, filename, "aux sp co", &num_vertices,
+	                         1, begin, error)) {
+		return false;
+	}
+	if (num_vertices != graph.vertices.size()) {
+		error = filename + ": coordinates for " +
+			std::to_string(num_vertices) + " vertices but the"
+			" graph has " + std::to_string(graph.vertices.size());
+		return false;
+	}
+	std::vector<Point> coordinates(num_vertices, {NAN, NAN});
+	auto bounds = split_lines(begin, file.data + file.size, num_threads);
+	bool parsed = parse_blocks(file, bounds, filename, error,
+		[&](size_t, LineFields &fields) -> char const * {
+			if (fields.done() or *fields.at == 'c') {
+				return nullptr;
+			}
+			uint64_t vertex;
+			Point point;
+			if (!fields.word("v") or !fields.next(vertex) or
+			    !fields.next(point.x) or !fields.next(point.y) or
+			    !fields.done()) {
+				return "expected v VERTEX X Y";
+			}
+			if (vertex < 1 or vertex > num_vertices) {
+				return "no such vertex";
+			}
+			coordinates[vertex - 1] = point;
+			return nullptr;
+		});
+	if (!parsed) {
+		return false;
+	}
+	graph.coordinates = std::move(coordinates);
+	return true;
+}
+
+inline bool
+read_metis_graph(std::string const &filename, Graph &graph,
+	size_t num_threads, std::string &error)
+{
+	TraceScope trace("read metis");
+	MappedFile file;
+	if (!file.open(filename)) {
+		error = filename + ": could not open";
+		return false;
+	}
+	char const *end = file.data + file.size;
+	uint64_t num_vertices = 0, num_edges = 0;
+	std::string format = "000";
+	uint64_t num_constraints = 1;
+	bool found = false;
+	char const *begin = for_each_line(file.data, end,
+		[&](LineFields &fields) {
+			if (fields.at < fields.end and *fields.at == '%') {
+				return true;
+			}
+			found = fields.next(num_vertices) and
+				fields.next(num_edges);
+			if (found and !fields.done()) {
+				uint64_t digits;
+				found = fields.next(digits) and digits <= 111;
+				format = std::to_string(1000 + digits)
+					.substr(1);
+			}
+			if (found and !fields.done()) {
+				found = fields.next(num_constraints);
+			}
+			found = found and fields.done() and
+				format.find_first_not_of("01") ==
+				std::string::npos;
+			return false;
+		});
+	if (!found) {
+		error = filename + ": expected a header N M [FMT [NCON]]";
+		return false;
+	}
+	begin = std::find(begin, end, '\n');
+	begin += begin < end;
+	size_t skipped = (format[0] == '1') +
+		(format[1] == '1') * num_constraints;
+	bool weighted = format[2] == '1';
+
+	/* Each vertex's number is how many vertex lines come before it, so
+	 * the lines are counted first, each block separately in parallel.
+	 */
+	auto bounds = split_lines(begin, end, num_threads);
+	size_t num_blocks = bounds.size() - 1;
+	std::vector<uint64_t> first_vertex(num_blocks + 1, 0);
+	run_in_blocks(num_blocks, num_blocks, [&](size_t first, size_t last) {
+		for (size_t block = first; block < last; ++block) {
+			for_each_line(bounds[block], bounds[block + 1],
+				[&](LineFields &fields) {
+					first_vertex[block + 1] +=
+						fields.at == fields.end or
+						*fields.at != '%';
+					return true;
+				});
+		}
+	});
+	for (size_t block = 0; block < num_blocks; ++block) {
+		first_vertex[block + 1] += first_vertex[block];
+	}
+
+	std::vector<std::vector<Edge>> blocks(num_blocks);
+	std::vector<uint64_t> next_vertex(first_vertex.begin(),
+		first_vertex.end() - 1);
+	bool parsed = parse_blocks(file, bounds, filename, error,
+		[&](size_t block, LineFields &fields) -> char const * {
+			if (fields.at < fields.end and *fields.at == '%') {
+				return nullptr;
+			}
+			uint64_t from = next_vertex[block]++;
+			if (from >= num_vertices) {
+				return fields.done() ? nullptr
+					: "more vertices than the header says";
+			}
+			for (size_t i = 0; i < skipped; ++i) {
+				uint64_t ignored;
+				if (!fields.next(ignored)) {
+					return "expected the vertex's size and"
+						" weights";
+				}
+			}
+			while (!fields.done()) {
+				uint64_t to;
+				double weight = 1.0;
+				if (!fields.next(to) or (weighted and
+				    !fields.next(weight))) {
+					return weighted ? "expected NEIGHBOUR"
+						" WEIGHT pairs"
+						: "expected neighbours";
+				}
+				if (to < 1 or to > num_vertices) {
+					return "no such vertex";
+				}
+				if (!(weight >= 0.0 and weight < INFINITY)) {
+					return "weights must be finite and not"
+						" negative";
+				}
+				blocks[block].push_back({weight, from,
+					to - 1});
+			}
+			return nullptr;
+		});
+	if (!parsed) {
+		return false;
+	}
+	std::vector<Edge> edges;
+	for (auto const &block : blocks) {
+		edges.insert(edges.end(), block.begin(), block.end());
+	}
+	if (first_vertex.back() < num_vertices or
+	    edges.size() != 2 * num_edges) {
+		error = filename + ": expected " +
+			std::to_string(num_vertices) + " vertices and " +
+			std::to_string(num_edges) + " edges";
+		return false;
+	}
+	graph = build_graph(num_vertices, std::move(edges));
+	graph.id_offset = 1;
+	return true;
+}
+
+/* Read a graph in the named format, "dimacs" or "metis", along with the
+ * coordinates from a DIMACS ".co" file if one is named.
+ */
+inline bool
+read_graph_in_format(std::string const &format, std::string const &filename,
+	std::string const &coordinates_filename, Graph &graph,
+	size_t num_threads, std::string &error)
+{
+	bool ok;
+	if (format == "dimacs") {
+		ok = read_dimacs_graph(filename, graph, num_threads, error);
+	} else if (format == "metis") {
+		ok = read_metis_graph(filename, graph, num_threads, error);
+	} else {
+		error = "unknown format " + format + "; expected text, dimacs"
+			" or metis";
+		return false;
+	}
+	if (ok and !coordinates_filename.empty()) {
+		ok = read_dimacs_coordinates(coordinates_filename, graph,
+			num_threads, error);
+	}
+	return ok;
+}
+
+#endif
@@ -0,0 +1,389 @@
+#ifndef GRAPH_STORE_HPP
+#define GRAPH_STORE_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <ios>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chains.hpp"
+#include "graph.hpp"
+#include "memory-usage.hpp"
+#include "profile.hpp"
+#include "search.hpp"
+#include "snapshot.hpp"
+
+/* The graphs a server holds, by name. Each has its own workspace (so each
+ * keeps its own cached heuristic) and profile, and counts how much memory it
+ * holds and how it has been used.
+ *
+ * Graphs are loaded when they are first queried. If the memory they hold
+ * together goes over the budget then the least recently used ones are
+ * evicted until it doesn't, and loaded again if they are queried again. A
+ * graph loaded from text is reloaded from a snapshot, written to the
+ * snapshot directory when it is first evicted, if there is one.
+ *
+ * A graph can also be replaced by a new version while the server carries
+ * on: the new version is loaded, validated and profiled by a thread of its
+ * own, and swapped in between queries once it is ready. Until then it is
+ * counted against the budget as being as big as the old version (or as its
+ * file, if the old version isn't loaded), so other graphs are evicted to
+ * make room for it, and a reload which couldn't fit alongside the old
+ * version is refused. Queries hold their
+ * own reference to the graph they started on, so one in flight finishes on
+ * the old version, which is freed when the last of them lets go. The
+ * cached heuristic is only kept if the new version's checksum shows it is
+ * really the same graph.
+ */
+
+/* A graph as loaded from a file, ready to be stored, or why it isn't. Its
+ * trees and chains are contracted (see chains.hpp) if `contract' is set.
+ */
+struct LoadedGraph {
+	std::shared_ptr<Graph const> graph;
+	GraphProfile profile;
+	uint64_t checksum = 0;
+	bool is_snapshot = false;
+	std::string error;
+};
+
+inline LoadedGraph
+load_graph_file(std::string const &filename, bool contract)
+{
+	LoadedGraph loaded;
+	std::ifstream file(filename, std::ios::binary);
+	if (!file) {
+		loaded.error = "could not open " + filename;
+		return loaded;
+	}
+	auto graph = std::make_shared<Graph>();
+	loaded.is_snapshot = file.peek() == snapshot_magic[0];
+	if (!read_graph(file, *graph)) {
+		loaded.error = "could not read a graph from " + filename;
+		return loaded;
+	}
+	if (char const *problem = graph_problem(*graph)) {
+		loaded.error = filename + " has " + problem;
+		return loaded;
+	}
+	if (contract) {
+		graph->chains = contract_chains(*graph);
+	}
+	loaded.profile = profile_graph(*graph);
+	loaded.checksum = graph_checksum(*graph);
+	loaded.graph = std::move(graph);
+	return loaded;
+}
+
+struct StoredGraph {
+	std::string name;
+	std::string filename;
+	/* Where to reload the graph from, if not `filename'. */
+	std::string snapshot;
+	bool contract = true;
+	/* Null while the graph is not loaded. */
+	std::shared_ptr<Graph const> graph;
+	std::unique_ptr<Workspace> workspace;
+	GraphProfile profile;
+	size_t bytes = 0;
+	uint64_t checksum = 0;
+	uint64_t queries = 0;
+	uint64_t loads = 0;
+	uint64_t evictions = 0;
+	uint64_t reloads = 0;
+	uint64_t last_used = 0;
+	/* The reload in progress, if `reloader' is running, and what it is
+	 * expected to hold. Once it has finished `reload_done' is set and
+	 * the new version (or the error) is in `reloaded', both guarded by
+	 * the store's mutex.
+	 */
+	std::thread reloader;
+	std::string reload_filename;
+	size_t reload_bytes = 0;
+	bool reload_done = false;
+	LoadedGraph reloaded;
+};
+
+struct GraphStore {
+	std::vector<std::unique_ptr<StoredGraph>> graphs;
+	size_t budget = SIZE_MAX;
+	std::string snapshot_dir;
+	/* Counts up with every use, to order them. */
+	uint64_t clock = 0;
+	/* `changed' is notified when a reload finishes, and may be waited
+	 * on for other things under the same mutex.
+	 */
+	std::mutex mutex;
+	std::condition_variable changed;
+
+	~GraphStore()
+	{
+		for (auto &stored : graphs) {
+			if (stored->reloader.joinable()) {
+				stored->reloader.join();
+			}
+		}
+	}
+};
+
+inline void
+add_stored_graph(GraphStore &store, std::string const &name,
+	std::string const &filename)
+{
+	auto stored = std::make_unique<StoredGraph>();
+	stored->name = name;
+	stored->filename = filename;
+	store.graphs.push_back(std::move(stored));
+}
+
+inline StoredGraph *
+find_stored_graph(GraphStore &store, std::string const &name)
+{
+	for (auto &stored : store.graphs) {
+		if (stored->name == name) {
+			return stored.get();
+		}
+	}
+	return nullptr;
+}
+
+inline size_t
+memory_usage_bytes(MemoryUsage const &usage)
+{
+	size_t total = 0;
+	for (auto const &component : usage) {
+		total += component.bytes;
+	}
+	return total;
+}
+
+/* The workspace grows as it is used, so this is redone after every query. */
+inline void
+update_stored_bytes(StoredGraph &stored)
+{
+	stored.bytes = 0;
+	if (stored.graph) {
+		stored.bytes += memory_usage_bytes(
+			graph_memory_usage(*stored.graph));
+		stored.bytes += memory_usage_bytes(
+			workspace_memory_usage(*stored.workspace));
+	}
+}
+
+/* Put a loaded graph in place of whatever version was there. A graph which
+ * is already a snapshot needn't be written as one.
+ */
+inline void
+install_stored_graph(StoredGraph &stored, LoadedGraph &loaded,
+	std::string const &filename)
+{
+	bool same = stored.workspace and stored.checksum == loaded.checksum;
+	if (!same) {
+		stored.workspace = std::make_unique<Workspace>();
+	}
+	stored.snapshot = loaded.is_snapshot ? filename : "";
+	stored.profile = loaded.profile;
+	stored.checksum = loaded.checksum;
+	stored.graph = std::move(loaded.graph);
+	update_stored_bytes(stored);
+}
+
+inline bool
+load_stored_graph(StoredGraph &stored)
+{
+	auto const &filename = stored.snapshot.empty() ? stored.filename
+		: stored.snapshot;
+	auto loaded = load_graph_file(filename, stored.contract);
+	if (!loaded.graph) {
+		return false;
+	}
+	install_stored_graph(stored, loaded, filename);
+	stored.loads += 1;
+	return true;
+}
+
+inline void
+evict_stored_graph(GraphStore &store, StoredGraph &stored)
+{
+	if (stored.snapshot.empty() and !store.snapshot_dir.empty()) {
+		std::string snapshot = store.snapshot_dir + "/" + stored.name +
+			".snapshot";
+		if (write_snapshot(snapshot, *stored.graph)) {
+			stored.snapshot = snapshot;
+		}
+	}
+	stored.graph.reset();
+	stored.workspace.reset();
+	stored.evictions += 1;
+	stored.bytes = 0;
+}
+
+/* Evict the least recently used graphs, other than `keep', until the rest
+ * (and the reloads under way) fit in the budget. `keep' stays even if it
+ * doesn't fit on its own.
+ */
+inline void
+enforce_memory_budget(GraphStore &store, StoredGraph const *keep)
+{
+	for (;;) {
+		size_t total = 0;
+		StoredGraph *oldest = nullptr;
+		for (auto &stored : store.graphs) {
+			total += stored->bytes + stored->reload_bytes;
+			if (stored->graph and stored.get() != keep and
+			    (!oldest or
+			     stored->last_used < oldest->last_used)) {
+				oldest = stored.get();
+			}
+		}
+		if (total <= store.budget or !oldest) {
+			return;
+		}
+		evict_stored_graph(store, *oldest);
+	}
+}
+
+/* Get a graph ready to be queried, loading it if need be. Returns null if
+ * there is no graph by that name or it couldn't be loaded.
+ */
+inline StoredGraph *
+acquire_stored_graph(GraphStore &store, std::string const &name)
+{
+	StoredGraph *stored = find_stored_graph(store, name);
+	if (!stored) {
+		return nullptr;
+	}
+	stored->last_used = ++store.clock;
+	if (!stored->graph) {
+		if (!load_stored_graph(*stored)) {
+			return nullptr;
+		}
+		enforce_memory_budget(store, stored);
+	}
+	return stored;
+}
+
+/* Start loading a new version of the graph, from `filename' or else from
+ * where it came from, in the background, evicting other graphs to make room
+ * for it. Returns why not if it can't be.
+ */
+inline char const *
+start_reload(GraphStore &store, StoredGraph &stored,
+	std::string const &filename)
+{
+	if (stored.reloader.joinable()) {
+		return "is already being reloaded";
+	}
+	std::string reload_filename = filename.empty() ? stored.filename
+		: filename;
+	size_t bytes = 0;
+	if (stored.graph) {
+		bytes = memory_usage_bytes(graph_memory_usage(*stored.graph));
+	} else {
+		std::ifstream file(reload_filename, std::ios::binary |
+			std::ios::ate);
+		bytes = file ? size_t(file.tellg()) : 0;
+	}
+	if (stored.graph and (bytes > store.budget or
+	                      stored.bytes > store.budget - bytes)) {
+		return "would not fit in the memory budget while reloading";
+	}
+	stored.reload_filename = reload_filename;
+	stored.reload_bytes = bytes;
+	stored.reload_done = false;
+	enforce_memory_budget(store, &stored);
+	stored.reloader = std::thread([&store, &stored] {
+		auto loaded = load_graph_file(stored.reload_filename,
+			stored.contract);
+		std::lock_guard<std::mutex> lock(store.mutex);
+		stored.reloaded = std::move(loaded);
+		stored.reload_done = true;
+		store.changed.notify_all();
+	});
+	return nullptr;
+}
+
+/* Whether a reload has finished and is waiting to be swapped in. The store's
+ * mutex must be held.
+ */
+inline bool
+reload_finished(GraphStore const &store)
+{
+	for (auto const &stored : store.graphs) {
+		if (stored->reload_done) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Swap in every new version which has finished loading, reporting each to
+ * `log'. With `wait' set, reloads still under way are waited for first.
+ */
+inline void
+finish_reloads(GraphStore &store, std::ostream &log, bool wait)
+{
+	for (auto &stored : store.graphs) {
+		if (!stored->reloader.joinable()) {
+			continue;
+		}
+		{
+			std::lock_guard<std::mutex> lock(store.mutex);
+			if (!stored->reload_done and !wait) {
+				continue;
+			}
+		}
+		stored->reloader.join();
+		{
+			std::lock_guard<std::mutex> lock(store.mutex);
+			stored->reload_done = false;
+		}
+		stored->reload_bytes = 0;
+		auto &loaded = stored->reloaded;
+		log << "Graph " << stored->name << ": ";
+		if (!loaded.graph) {
+			log << "reload failed: " << loaded.error << "; ";
+			log << "still serving the old version." << std::endl;
+			continue;
+		}
+		bool same = stored->workspace and
+			stored->checksum == loaded.checksum;
+		stored->filename = stored->reload_filename;
+		install_stored_graph(*stored, loaded, stored->filename);
+		stored->reloads += 1;
+		stored->last_used = ++store.clock;
+		log << "reloaded from " << stored->filename << " (checksum ";
+		log << std::hex << stored->checksum << std::dec << ", ";
+		log << (same ? "unchanged, cache kept)." : "cache dropped).");
+		log << std::endl;
+		enforce_memory_budget(store, stored.get());
+	}
+}
+
+/* e.g. "Graph east: resident, 1843.2 KiB, 12 queries, 2 loads, 1
+ * evictions, 0 reloads, checksum 5eb1..." for each graph, with `separator'
+ * after each.
+ */
+inline void
+print_graph_store(std::ostream &out, GraphStore const &store,
+	char const *separator)
+{
+	for (auto const &stored : store.graphs) {
+		out << "Graph " << stored->name << ": ";
+		out << (stored->graph ? "resident, " : "not resident, ");
+		out << stored->bytes / 1024.0 << " KiB, ";
+		out << stored->queries << " queries, " << stored->loads;
+		out << " loads, " << stored->evictions << " evictions, ";
+		out << stored->reloads << " reloads, checksum ";
+		out << std::hex << stored->checksum << std::dec;
+		out << separator;
+	}
+}
+
+#endif
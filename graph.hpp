@@ -0,0 +1,380 @@
+#ifndef GRAPH_HPP
+#define GRAPH_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include "memory-usage.hpp"
+#include "trace.hpp"
+
+struct Vertex;
+
+/* Edges keep a record of both from which vertex they are emanating
+ * and to which vertex they are going. This allows us to easily follow
+ * edges backwards.
+ */
+struct Edge {
+	double weight;
+	size_t from;
+	size_t to;
+};
+
+/* Similarly, vertices keep a record of both incoming and outgoing edges. */
+struct Vertex {
+	std::vector<size_t> outgoing;
+	std::vector<size_t> incoming;
+};
+
+/* The graph is stored as a list of vertices and edges, where each vertex also
+ * maintains a list of edges, so therefore the graph is essentially an adjacency
+ * list.
+ *
+ * If the vertices have been renumbered (by `k-reorder', say) then each one's
+ * id in the original input is kept in `original_ids', and `id_index' holds
+ * the same ids sorted, each with its vertex, for looking them up. Queries
+ * and answers use the original ids, so the renumbering is invisible outside
+ * the graph. Both are empty if the vertices have their original ids, which
+ * are then their numbers plus `id_offset': 1 for the formats which number
+ * vertices from 1, and otherwise 0.
+ *
+ * `coordinates' holds each vertex's position, if the graph came with them
+ * (from a DIMACS ".co" file, say), for geometric heuristics and drawing the
+ * graph; a vertex whose position isn't known has NaN for both. It is empty
+ * if there are none.
+ *
+ * `chains' is the graph with its dead-end trees peeled off and its chains of
+ * degree-2 vertices contracted (see chains.hpp), if that has been done, for
+ * the searches which can use it.
+ */
+struct ChainContraction;
+
+struct Point {
+	double x;
+	double y;
+};
+
+struct Graph {
+	std::vector<Vertex> vertices;
+	std::vector<Edge> edges;
+	std::vector<uint64_t> original_ids;
+	std::vector<std::pair<uint64_t, size_t>> id_index;
+	uint64_t id_offset = 0;
+	std::vector<Point> coordinates;
+	std::shared_ptr<ChainContraction const> chains;
+};
+
+/* A chain is a run of interior vertices, each of which has edges to and from
+ * just the vertices either side of it, between two junctions (which may be
+ * the same vertex). `forwards[i]' is the weight of the cheapest edge from
+ * the i-th vertex along the chain to the next, counting the junction at the
+ * start as the 0th, and `backwards[i]' that of the cheapest edge back from
+ * the next to the i-th; they are infinite if there is no such edge.
+ *
+ * A tree is a part of the graph which only joins the rest at one vertex, a
+ * dead end. Its vertices are peeled off before the chains are found, each
+ * one's parent being the next vertex towards where the tree is attached;
+ * `tree_up' and `tree_down' are the weights of the cheapest edges to and
+ * from the parent (infinite if there are none), and `tree_order' lists the
+ * vertices in the trees with every parent before its children.
+ *
+ * The contraction is the graph of just the junctions, with each chain
+ * replaced by an edge each way (where it can be followed all the way that
+ * way) as long as the whole chain. Every vertex is either a junction, with
+ * its number in that graph, or is in a chain, at a position from 1 on, or
+ * is in a tree.
+ */
+struct Chain {
+	size_t first;
+	size_t last;
+	std::vector<size_t> interior;
+	std::vector<double> forwards;
+	std::vector<double> backwards;
+};
+
+struct ChainContraction {
+	Graph junctions;
+	std::vector<size_t> junction_vertex;
+	std::vector<Chain> chains;
+	/* For each vertex, its junction number, or SIZE_MAX if it is in a
+	 * chain; then which chain and where in it.
+	 */
+	std::vector<size_t> vertex_junction;
+	std::vector<size_t> vertex_chain;
+	std::vector<size_t> vertex_position;
+	/* The parent of each vertex in a tree, or SIZE_MAX. */
+	std::vector<size_t> tree_parent;
+	std::vector<double> tree_up;
+	std::vector<double> tree_down;
+	std::vector<size_t> tree_order;
+};
+
+inline void
+set_original_ids(Graph &graph, std::vector<uint64_t> original_ids)
+{
+	graph.original_ids = std::move(original_ids);
+	graph.id_index.clear();
+	graph.id_index.reserve(graph.original_ids.size());
+	for (size_t i = 0; i < graph.original_ids.size(); ++i) {
+		graph.id_index.emplace_back(graph.original_ids[i], i);
+	}
+	std::sort(graph.id_index.begin(), graph.id_index.end());
+}
+
+inline uint64_t
+original_id(Graph const &graph, size_t vertex)
+{
+	return graph.original_ids.empty() ? vertex + graph.id_offset
+		: graph.original_ids[vertex];
+}
+
+/* Find the vertex with the given original id, if there is one. */
+inline bool
+find_vertex(Graph const &graph, uint64_t original, size_t &vertex)
+{
+	if (graph.original_ids.empty()) {
+		vertex = original - graph.id_offset;
+		return original >= graph.id_offset and
+			vertex < graph.vertices.size();
+	}
+	auto found = std::lower_bound(graph.id_index.begin(),
+		graph.id_index.end(), std::make_pair(original, size_t(0)));
+	if (found == graph.id_index.end() or found->first != original) {
+		return false;
+	}
+	vertex = found->second;
+	return true;
+}
+
+inline MemoryUsage
+graph_memory_usage(Graph const &graph)
+{
+	size_t adjacency = 0;
+	for (auto const &vertex : graph.vertices) {
+		adjacency += vector_bytes(vertex.outgoing);
+		adjacency += vector_bytes(vertex.incoming);
+	}
+	MemoryUsage usage = {
+		{"vertices", vector_bytes(graph.vertices)},
+		{"adjacency", adjacency},
+		{"edges", vector_bytes(graph.edges)},
+		{"id mapping", vector_bytes(graph.original_ids) +
+			vector_bytes(graph.id_index)},
+		{"coordinates", vector_bytes(graph.coordinates)},
+	};
+	if (graph.chains) {
+		auto const &contraction = *graph.chains;
+		size_t bytes = vector_bytes(contraction.junction_vertex) +
+			vector_bytes(contraction.chains) +
+			vector_bytes(contraction.vertex_junction) +
+			vector_bytes(contraction.vertex_chain) +
+			vector_bytes(contraction.vertex_position) +
+			vector_bytes(contraction.tree_parent) +
+			vector_bytes(contraction.tree_up) +
+			vector_bytes(contraction.tree_down) +
+			vector_bytes(contraction.tree_order);
+		for (auto const &chain : contraction.chains) {
+			bytes += vector_bytes(chain.interior) +
+				vector_bytes(chain.forwards) +
+				vector_bytes(chain.backwards);
+		}
+		for (auto const &component :
+		     graph_memory_usage(contraction.junctions)) {
+			bytes += component.bytes;
+		}
+		usage.push_back({"contraction", bytes});
+	}
+	return usage;
+}
+
+/* Once the edges have been read in, link each of them into the incoming and
+ * outgoing lists of the vertices at either end.
+ */
+inline void
+build_adjacency(Graph &graph)
+{
+	TraceScope trace("build");
+	auto &vertices = graph.vertices;
+	auto &edges = graph.edges;
+	/* Counting the degrees first means each list is allocated once. */
+	std::vector<uint32_t> out_degree(vertices.size(), 0);
+	std::vector<uint32_t> in_degree(vertices.size(), 0);
+	for (auto const &edge : edges) {
+		out_degree[edge.from] += 1;
+		in_degree[edge.to] += 1;
+	}
+	for (size_t i = 0; i < vertices.size(); ++i) {
+		vertices[i].outgoing.reserve(out_degree[i]);
+		vertices[i].incoming.reserve(in_degree[i]);
+	}
+	for (size_t i = 0; i < edges.size(); ++i) {
+		vertices[edges[i].from].outgoing.push_back(i);
+		vertices[edges[i].to].incoming.push_back(i);
+	}
+}
+
+inline Graph
+read_graph_from_file(std::istream &file)
+{
+	Graph graph;
+	size_t num_vertices = 0;
+	size_t num_edges = 0;
+	auto &edges = graph.edges;
+	file >> num_vertices;
+	file >> num_edges;
+	if (!file) {
+		return graph;
+	}
+	/* Vertices start out with empty `forwards' and `backwards' edges. */
+	Vertex initial_vertex = {{}, {}};
+	graph.vertices = std::vector<Vertex>(num_vertices, initial_vertex);
+	graph.edges.reserve(num_edges);
+	/* Loop over all the edges in the file. They are parsed in chunks only
+	 * so that the trace shows how parsing progresses.
+	 */
+	size_t const chunk_size = 1 << 16;
+	for (size_t chunk = 0; chunk < num_edges; chunk += chunk_size) {
+		TraceScope trace("parse chunk");
+		size_t end = std::min(chunk + chunk_size, num_edges);
+		for (size_t i = chunk; i < end; ++i) {
+			size_t from, to;
+			double weight;
+			file >> from;
+			file >> to;
+			file >> weight;
+			/* An edge to a vertex which doesn't exist fails the
+			 * stream, the same as an edge which can't be parsed.
+			 */
+			if (!file or from >= num_vertices or
+			    to >= num_vertices) {
+				file.setstate(std::ios::failbit);
+				break;
+			}
+			edges.push_back({weight, from, to});
+		}
+	}
+	build_adjacency(graph);
+	return graph;
+}
+
+/* Returns a description of the first thing wrong with the graph which the
+ * searches can't cope with, or null if there is nothing.
+ */
+inline char const *
+graph_problem(Graph const &graph)
+{
+	for (auto const &edge : graph.edges) {
+		if (edge.from >= graph.vertices.size() or
+		    edge.to >= graph.vertices.size()) {
+			return "an edge to a vertex which doesn't exist";
+		}
+		if (!(edge.weight >= 0.0) or edge.weight == INFINITY) {
+			return "an edge with a negative or infinite weight";
+		}
+	}
+	if (!graph.original_ids.empty() and
+	    graph.original_ids.size() != graph.vertices.size()) {
+		return "original ids for the wrong number of vertices";
+	}
+	if (!graph.coordinates.empty() and
+	    graph.coordinates.size() != graph.vertices.size()) {
+		return "coordinates for the wrong number of vertices";
+	}
+	return nullptr;
+}
+
+/* A checksum of everything which affects the answers to queries: the
+ * edges, in order, and the original ids or their offset. It is 64-bit
+ * FNV-1a. A graph numbered from 0 adds nothing for its offset, so its
+ * checkpoints stay valid.
+ */
+inline uint64_t
+graph_checksum(Graph const &graph)
+{
+	uint64_t hash = 0xcbf29ce484222325;
+	auto add = [&](void const *data, size_t size) {
+		auto bytes = (unsigned char const *) data;
+		for (size_t i = 0; i < size; ++i) {
+			hash = (hash ^ bytes[i]) * 0x100000001b3;
+		}
+	};
+	uint64_t num_vertices = graph.vertices.size();
+	add(&num_vertices, sizeof(num_vertices));
+	add(graph.edges.data(), graph.edges.size() * sizeof(Edge));
+	add(graph.original_ids.data(),
+		graph.original_ids.size() * sizeof(uint64_t));
+	if (graph.id_offset != 0) {
+		add(&graph.id_offset, sizeof(graph.id_offset));
+	}
+	return hash;
+}
+
+/* Build a graph out of a list of edges between `num_vertices' vertices. */
+inline Graph
+build_graph(size_t num_vertices, std::vector<Edge> edges)
+{
+	Graph graph;
+	graph.vertices = std::vector<Vertex>(num_vertices);
+	graph.edges = std::move(edges);
+	build_adjacency(graph);
+	return graph;
+}
+
+/* The graph with its vertices renumbered: `order[i]' is the vertex which
+ * becomes the i-th. Each vertex keeps its original id, so queries and
+ * answers are unaffected, and its coordinates. The edges are sorted by
+ * their new `from' vertex, so those expanded together are stored together.
+ */
+inline Graph
+renumber(Graph const &graph, std::vector<size_t> const &order)
+{
+	size_t const num_vertices = graph.vertices.size();
+	std::vector<size_t> new_id(num_vertices);
+	std::vector<uint64_t> original_ids(num_vertices);
+	for (size_t i = 0; i < num_vertices; ++i) {
+		new_id[order[i]] = i;
+		original_ids[i] = original_id(graph, order[i]);
+	}
+	std::vector<Edge> edges;
+	edges.reserve(graph.edges.size());
+	for (auto const &edge : graph.edges) {
+		edges.push_back({edge.weight, new_id[edge.from],
+			new_id[edge.to]});
+	}
+	std::stable_sort(edges.begin(), edges.end(),
+		[](Edge const &a, Edge const &b) {
+			return a.from != b.from ? a.from < b.from
+				: a.to < b.to;
+		});
+	Graph reordered = build_graph(num_vertices, std::move(edges));
+	set_original_ids(reordered, std::move(original_ids));
+	if (!graph.coordinates.empty()) {
+		for (size_t i = 0; i < num_vertices; ++i) {
+			reordered.coordinates.push_back(
+				graph.coordinates[order[i]]);
+		}
+	}
+	return reordered;
+}
+
+/* Write the graph out in the format `read_graph_from_file' reads, with the
+ * weights to full precision so that nothing is lost on the way back in.
+ */
+inline void
+write_graph_to_file(std::ostream &file, Graph const &graph)
+{
+	auto precision = file.precision(17);
+	file << graph.vertices.size() << " " << graph.edges.size() << "\n";
+	for (auto const &edge : graph.edges) {
+		file << edge.from << " " << edge.to << " " << edge.weight;
+		file << "\n";
+	}
+	file.precision(precision);
+}
+
+#endif
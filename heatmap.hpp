@@ -0,0 +1,96 @@
+#ifndef HEATMAP_HPP
+#define HEATMAP_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "graph.hpp"
+
+/* An expansion heat-map counts, per vertex, how many times the search popped
+ * it off the queue (expanded it) and how many times it was pushed on. A
+ * handful of vertices with enormous counts is the sign of a query which
+ * keeps going around the same short cycles.
+ *
+ * The binary dump is the 8 byte magic "KSHEAT1\0", the number of vertices as
+ * a 64-bit integer, then that many 64-bit pop counts followed by that many
+ * 64-bit push counts, all in native byte order.
+ */
+struct Heatmap {
+	std::vector<uint64_t> pops;
+	std::vector<uint64_t> pushes;
+};
+
+char const heatmap_magic[8] = {'K', 'S', 'H', 'E', 'A', 'T', '1', '\0'};
+
+inline bool
+write_heatmap(std::string const &filename, Heatmap const &heatmap)
+{
+	std::ofstream file(filename, std::ios::binary);
+	if (!file) {
+		return false;
+	}
+	uint64_t num_vertices = heatmap.pops.size();
+	file.write(heatmap_magic, sizeof(heatmap_magic));
+	file.write((char const *) &num_vertices, sizeof(num_vertices));
+	file.write((char const *) heatmap.pops.data(),
+		num_vertices * sizeof(uint64_t));
+	file.write((char const *) heatmap.pushes.data(),
+		num_vertices * sizeof(uint64_t));
+	return bool(file);
+}
+
+inline bool
+read_heatmap(std::string const &filename, Heatmap &heatmap)
+{
+	std::ifstream file(filename, std::ios::binary);
+	char magic[sizeof(heatmap_magic)];
+	uint64_t num_vertices;
+	file.read(magic, sizeof(magic));
+	file.read((char *) &num_vertices, sizeof(num_vertices));
+	if (!file or std::memcmp(magic, heatmap_magic, sizeof(magic)) != 0) {
+		return false;
+	}
+	heatmap.pops.resize(num_vertices);
+	heatmap.pushes.resize(num_vertices);
+	file.read((char *) heatmap.pops.data(),
+		num_vertices * sizeof(uint64_t));
+	file.read((char *) heatmap.pushes.data(),
+		num_vertices * sizeof(uint64_t));
+	return bool(file);
+}
+
+/* Print the `n' most expanded vertices of the graph, most expanded first,
+ * by their original ids.
+ */
+inline void
+print_heatmap_top(std::ostream &out, Heatmap const &heatmap, size_t n,
+	Graph const &graph)
+{
+	auto const &pops = heatmap.pops;
+	std::vector<size_t> order(pops.size());
+	std::iota(order.begin(), order.end(), 0);
+	n = std::min(n, order.size());
+	std::partial_sort(order.begin(), order.begin() + n, order.end(),
+		[&](size_t a, size_t b) {
+			return pops[a] > pops[b];
+		});
+	uint64_t total = std::accumulate(pops.begin(), pops.end(),
+		uint64_t(0));
+	out << "Most expanded vertices (of " << total << " expansions):";
+	out << std::endl;
+	for (size_t i = 0; i < n and pops[order[i]] > 0; ++i) {
+		size_t vertex = order[i];
+		out << "  vertex ";
+		out << original_id(graph, vertex);
+		out << ": " << pops[vertex] << " pops, ";
+		out << heatmap.pushes[vertex] << " pushes" << std::endl;
+	}
+}
+
+#endif
@@ -0,0 +1,204 @@
+#ifndef LATENCY_HISTOGRAM_HPP
+#define LATENCY_HISTOGRAM_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/* A histogram of latencies in nanoseconds, bucketed the way HdrHistogram
+ * does it: values are split by their power of two, and each power of two is
+ * split again into `2^sub_bucket_bits' linear sub-buckets. This keeps the
+ * relative error under 1% from a nanosecond up to hundreds of years, in a
+ * fixed 58 KiB.
+ *
+ * A histogram is only ever recorded into by one thread, so the counts are
+ * updated with plain relaxed loads and stores rather than read-modify-write
+ * operations; the atomics are there only so that another thread can merge
+ * them into a report at any time.
+ */
+struct LatencyHistogram {
+	static int const sub_bucket_bits = 7;
+	static size_t const sub_bucket_count = size_t(1) << sub_bucket_bits;
+	static size_t const num_buckets =
+		(65 - sub_bucket_bits) << sub_bucket_bits;
+
+	LatencyHistogram() :
+		counts(num_buckets)
+	{}
+
+	void record(uint64_t value)
+	{
+		auto &count = counts[bucket_index(value)];
+		count.store(count.load(std::memory_order_relaxed) + 1,
+			std::memory_order_relaxed);
+		total.store(total.load(std::memory_order_relaxed) + 1,
+			std::memory_order_relaxed);
+		if (value > max.load(std::memory_order_relaxed)) {
+			max.store(value, std::memory_order_relaxed);
+		}
+	}
+
+	void merge(LatencyHistogram const &other)
+	{
+		for (size_t i = 0; i < num_buckets; ++i) {
+			auto n = other.counts[i].load(std::memory_order_relaxed);
+			counts[i].store(counts[i].load(
+				std::memory_order_relaxed) + n,
+				std::memory_order_relaxed);
+		}
+		total.store(total.load(std::memory_order_relaxed) +
+			other.total.load(std::memory_order_relaxed),
+			std::memory_order_relaxed);
+		max.store(std::max(max.load(std::memory_order_relaxed),
+			other.max.load(std::memory_order_relaxed)),
+			std::memory_order_relaxed);
+	}
+
+	uint64_t count() const
+	{
+		return total.load(std::memory_order_relaxed);
+	}
+
+	uint64_t maximum() const
+	{
+		return max.load(std::memory_order_relaxed);
+	}
+
+	/* The smallest value such that `percentile' percent of the recorded
+	 * values are no greater than it, to within the bucket's precision.
+	 */
+	uint64_t value_at_percentile(double percentile) const
+	{
+		uint64_t n = count();
+		if (n == 0) {
+			return 0;
+		}
+		uint64_t rank = std::ceil(percentile / 100.0 * n);
+		rank = std::max<uint64_t>(1, std::min(rank, n));
+		uint64_t seen = 0;
+		for (size_t i = 0; i < num_buckets; ++i) {
+			seen += counts[i].load(std::memory_order_relaxed);
+			if (seen >= rank) {
+				return std::min(highest_in_bucket(i), maximum());
+			}
+		}
+		return maximum();
+	}
+
+	static size_t bucket_index(uint64_t value)
+	{
+		if (value < sub_bucket_count) {
+			return value;
+		}
+		int exponent = 63 - __builtin_clzll(value);
+		int shift = exponent - sub_bucket_bits;
+		return ((size_t(shift) + 1) << sub_bucket_bits) +
+			(value >> shift) - sub_bucket_count;
+	}
+
+	static uint64_t highest_in_bucket(size_t index)
+	{
+		size_t octave = index >> sub_bucket_bits;
+		if (octave == 0) {
+			return index;
+		}
+		int shift = octave - 1;
+		uint64_t lowest = ((index & (sub_bucket_count - 1)) +
+			sub_bucket_count) << shift;
+		return lowest + ((uint64_t(1) << shift) - 1);
+	}
+private:
+	std::vector<std::atomic<uint64_t>> counts;
+	std::atomic<uint64_t> total{0};
+	std::atomic<uint64_t> max{0};
+};
+
+/* The parts of a query whose latency is tracked. `total' is end to end,
+ * including writing out the answer, and with the scheduler (see
+ * scheduler.hpp) from when the query came in; `waiting' is the time the
+ * scheduler kept it before starting it.
+ */
+enum LatencyPhase {
+	LATENCY_TOTAL,
+	LATENCY_HEURISTIC,
+	LATENCY_SEARCH,
+	LATENCY_WAITING,
+	NUM_LATENCY_PHASES
+};
+
+struct LatencyHistograms {
+	LatencyHistogram phases[NUM_LATENCY_PHASES];
+};
+
+inline std::mutex latency_mutex;
+inline std::vector<std::unique_ptr<LatencyHistograms>> latency_histograms;
+
+/* Each thread records into its own set of histograms, registered the first
+ * time it records anything, so recording never contends with other threads.
+ */
+inline LatencyHistograms &
+thread_latency_histograms()
+{
+	thread_local LatencyHistograms *histograms = nullptr;
+	if (histograms == nullptr) {
+		std::lock_guard<std::mutex> lock(latency_mutex);
+		latency_histograms.push_back(
+			std::make_unique<LatencyHistograms>());
+		histograms = latency_histograms.back().get();
+	}
+	return *histograms;
+}
+
+inline void
+record_latency(LatencyPhase phase, std::chrono::steady_clock::duration time)
+{
+	auto nanoseconds = std::chrono::duration_cast<
+		std::chrono::nanoseconds>(time).count();
+	thread_latency_histograms().phases[phase].record(nanoseconds);
+}
+
+/* Merge every thread's histograms and print the percentiles of each phase,
+ * e.g. "Search latency: 100 queries, p50 1.2 ms, p99 ..., max 3.4 ms.".
+ */
+inline void
+report_latency(std::ostream &out)
+{
+	static char const *const names[NUM_LATENCY_PHASES] = {
+		"Query",
+		"Preprocessing",
+		"Search",
+		"Waiting",
+	};
+	LatencyHistograms merged;
+	{
+		std::lock_guard<std::mutex> lock(latency_mutex);
+		for (auto const &histograms : latency_histograms) {
+			for (size_t i = 0; i < NUM_LATENCY_PHASES; ++i) {
+				merged.phases[i].merge(histograms->phases[i]);
+			}
+		}
+	}
+	for (size_t i = 0; i < NUM_LATENCY_PHASES; ++i) {
+		auto const &histogram = merged.phases[i];
+		/* Only the scheduler has queries wait. */
+		if (i == LATENCY_WAITING and histogram.count() == 0) {
+			continue;
+		}
+		out << names[i] << " latency: ";
+		out << histogram.count() << " queries";
+		out << ", p50 " << histogram.value_at_percentile(50) / 1e6;
+		out << " ms, p99 " << histogram.value_at_percentile(99) / 1e6;
+		out << " ms, p99.9 ";
+		out << histogram.value_at_percentile(99.9) / 1e6;
+		out << " ms, max " << histogram.maximum() / 1e6;
+		out << " ms." << std::endl;
+	}
+}
+
+#endif
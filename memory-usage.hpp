@@ -0,0 +1,63 @@
+#ifndef MEMORY_USAGE_HPP
+#define MEMORY_USAGE_HPP
+
+#include <cstddef>
+#include <iostream>
+#include <vector>
+
+#ifdef __unix__
+#include <sys/resource.h>
+#endif
+
+/* Memory accounting. Each structure reports the bytes held by each of its
+ * components, counting what has been allocated (a vector's capacity, not its
+ * size) since that is what actually occupies memory.
+ */
+struct MemoryComponent {
+	char const *name;
+	size_t bytes;
+};
+
+using MemoryUsage = std::vector<MemoryComponent>;
+
+template <typename T>
+size_t
+vector_bytes(std::vector<T> const &vector)
+{
+	return vector.capacity() * sizeof(T);
+}
+
+/* The high-water mark of the whole process's resident set, or 0 if it can't
+ * be found out on this platform.
+ */
+inline size_t
+peak_rss_bytes()
+{
+#ifdef __unix__
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0) {
+		/* Linux reports this in kilobytes. */
+		return size_t(usage.ru_maxrss) * 1024;
+	}
+#endif
+	return 0;
+}
+
+/* Print the components in the same style as the timing output, e.g.
+ * "Graph memory: 184.8 KiB vertices, 222.8 KiB adjacency, ... KiB total.".
+ */
+inline void
+print_memory_usage(std::ostream &out, char const *what,
+	MemoryUsage const &usage)
+{
+	size_t total = 0;
+	out << what << " memory: ";
+	for (auto const &component : usage) {
+		out << component.bytes / 1024.0 << " KiB ";
+		out << component.name << ", ";
+		total += component.bytes;
+	}
+	out << total / 1024.0 << " KiB total." << std::endl;
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+/* Run `work(first, last)' on `num_threads' contiguous blocks of [0, size),
+ * one on this thread and the rest each on a thread of its own.
+ */
+template <typename Work>
+void
+run_in_blocks(size_t size, size_t num_threads, Work const &work)
+{
+	num_threads = std::max<size_t>(1, std::min(num_threads, size));
+	std::vector<std::thread> threads;
+	for (size_t t = 1; t < num_threads; ++t) {
+		threads.emplace_back(work, size * t / num_threads,
+			size * (t + 1) / num_threads);
+	}
+	work(0, size / num_threads);
+	for (auto &thread : threads) {
+		thread.join();
+	}
+}
+
+#endif
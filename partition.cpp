@@ -0,0 +1,130 @@
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "graph.hpp"
+#include "partition.hpp"
+#include "snapshot.hpp"
+#include "trace.hpp"
+
+/* `k-partition' splits a graph's vertices into cells of about the same size
+ * with few edges between them (see partition.hpp), and writes out each
+ * vertex's cell, one "ID CELL" line per vertex, with its original id. With
+ * `--snapshot' it also writes the graph renumbered so that each cell's
+ * vertices are numbered contiguously, which `k-short' loads like any other
+ * snapshot: the original ids are kept in it, and queries and answers still
+ * use them.
+ */
+int
+main(int argc, char *argv[])
+{
+	PartitionOptions options;
+	options.num_threads = std::max(1u, std::thread::hardware_concurrency());
+	std::string snapshot_filename;
+	std::string trace_filename;
+	bool bad_usage = false;
+
+	static option const long_options[] = {
+		{"cells", required_argument, nullptr, 'k'},
+		{"imbalance", required_argument, nullptr, 'e'},
+		{"threads", required_argument, nullptr, 'j'},
+		{"snapshot", required_argument, nullptr, 's'},
+		{"trace", required_argument, nullptr, 't'},
+		{nullptr, 0, nullptr, 0},
+	};
+	int option;
+	while ((option = getopt_long(argc, argv, "k:e:j:s:t:", long_options,
+	                             nullptr)) != -1) {
+		switch (option) {
+		case 'k':
+			options.num_cells = std::strtoull(optarg, nullptr, 10);
+			bad_usage = bad_usage or options.num_cells == 0;
+			break;
+		case 'e':
+			options.imbalance = std::strtod(optarg, nullptr);
+			bad_usage = bad_usage or !(options.imbalance >= 0.0);
+			break;
+		case 'j':
+			options.num_threads = std::max<size_t>(1,
+				std::strtoull(optarg, nullptr, 10));
+			break;
+		case 's':
+			snapshot_filename = optarg;
+			break;
+		case 't':
+			trace_filename = optarg;
+			trace_enabled = true;
+			break;
+		default:
+			bad_usage = true;
+			break;
+		}
+	}
+	if (bad_usage or optind + 2 != argc) {
+		std::cerr << "Usage: " << argv[0] << " [--cells N]";
+		std::cerr << " [--imbalance FRACTION] [--threads N]";
+		std::cerr << " [--snapshot SNAPSHOTFILE] [--trace TRACEFILE]";
+		std::cerr << " GRAPHFILE CELLFILE";
+		std::cerr << std::endl;
+		return 2;
+	}
+
+	std::ifstream graph_file(argv[optind], std::ios::binary);
+	Graph graph;
+	if (!graph_file or !read_graph(graph_file, graph)) {
+		std::cerr << argv[optind] << ": could not read graph";
+		std::cerr << std::endl;
+		return 2;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	PartitionStats stats;
+	auto cell = partition_graph(graph, options, stats);
+	auto end = std::chrono::steady_clock::now();
+
+	std::ofstream cell_file(argv[optind + 1]);
+	for (size_t v = 0; v < cell.size(); ++v) {
+		cell_file << original_id(graph, v) << " " << cell[v] << "\n";
+	}
+	if (!cell_file.flush()) {
+		std::cerr << argv[optind + 1] << ": could not write cells";
+		std::cerr << std::endl;
+		return 2;
+	}
+	if (!snapshot_filename.empty() and
+	    !write_snapshot(snapshot_filename,
+	                    renumber(graph, cell_order(cell)))) {
+		std::cerr << snapshot_filename << ": could not write snapshot";
+		std::cerr << std::endl;
+		return 2;
+	}
+
+	std::chrono::duration<double, std::milli> elapsed = end - start;
+	std::cout << "Partitioned " << graph.vertices.size();
+	std::cout << " vertices into " << options.num_cells << " cells in ";
+	std::cout << elapsed.count() << " milliseconds on ";
+	std::cout << options.num_threads << " threads." << std::endl;
+	std::cout << "Levels:";
+	for (auto size : stats.level_sizes) {
+		std::cout << " " << size;
+	}
+	std::cout << " vertices." << std::endl;
+	std::cout << "Cut: " << stats.cut << " of " << graph.edges.size();
+	std::cout << " edges (";
+	std::cout << 100.0 * double(stats.cut) /
+		double(std::max<size_t>(1, graph.edges.size()));
+	std::cout << "%), heaviest cell " << stats.heaviest_cell;
+	std::cout << " vertices, " << 100 * stats.imbalance;
+	std::cout << "% over the average." << std::endl;
+
+	/* With `--trace' the timeline of every phase is written out last. */
+	if (!trace_filename.empty() and !trace_write(trace_filename)) {
+		std::cerr << "could not write trace file" << std::endl;
+	}
+	return 0;
+}
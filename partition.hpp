@@ -0,0 +1,933 @@
+#ifndef PARTITION_HPP
+#define PARTITION_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <numeric>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "graph.hpp"
+#include "parallel.hpp"
+#include "trace.hpp"
+
+/* A multilevel partitioner, which splits the vertices into `num_cells' cells
+ * of about the same size with as few edges between the cells as it can find.
+ * Cells of vertices which are close together are what a cache-friendly
+ * layout, sharding between processes, and overlay graphs all want.
+ *
+ * The partitioner ignores the edges' directions and weights: it works on
+ * the graph with each pair of vertices joined by edges either way merged
+ * into one undirected edge, weighted by the number of edges it stands for,
+ * so the weight of the cut is the number of the graph's edges between
+ * different cells. Each vertex weighs one, at first.
+ *
+ * 1. Coarsening. The vertices are clustered by label propagation: each one
+ *    in turn joins whichever neighbouring cluster it has the heaviest edges
+ *    to, as long as that cluster isn't already too heavy, for a few rounds.
+ *    A cluster may weigh at most four times the level's average vertex, so
+ *    that each level shrinks the graph only a few times over and refining
+ *    it has something to work with.
+ *    Each cluster then becomes one vertex of a coarser graph, weighing as
+ *    much as its members, with their edges to other clusters merged. This is
+ *    repeated until the graph is a few dozen vertices per cell, or stops
+ *    shrinking.
+ * 2. Initial partition. The coarsest graph is cut into cells by recursive
+ *    bisection, each part split in two in breadth-first order, from several
+ *    starting vertices; the cut found lightest after refinement is kept.
+ * 3. Uncoarsening. The cells are projected back down one level at a time,
+ *    each vertex taking its cluster's cell, and refined at each level by
+ *    Fiduccia-Mattheyses: vertices on the boundary are moved to the
+ *    neighbouring cell that reduces the cut most, in order of that gain,
+ *    each at most once a pass, including moves which make the cut heavier
+ *    for a while; at the end of the pass the moves after the lightest cut
+ *    seen are undone. Passes are repeated while they improve the cut.
+ *
+ * A cell may weigh at most `1 + imbalance' times the average; at the coarser
+ * levels, where a vertex may weigh a lot, by as much again as the heaviest
+ * vertex. Any cell still too heavy at the end has its vertices moved out
+ * to cells with room, cheapest first.
+ *
+ * The label propagation, and building the coarser graphs, run on
+ * `num_threads' threads, each over a block of the vertices; the cluster
+ * weights are atomic, so a move which would take a cluster over the limit
+ * is seen and backed out. The threads race, so the clusters, and so the
+ * cells, may differ from run to run; they are always valid. Refinement works
+ * on one thread, but only on the boundary vertices.
+ */
+struct PartitionGraph {
+	std::vector<size_t> offsets;
+	std::vector<size_t> neighbours;
+	std::vector<uint64_t> edge_weights;
+	std::vector<uint64_t> vertex_weights;
+
+	size_t size() const
+	{
+		return vertex_weights.size();
+	}
+};
+
+struct PartitionOptions {
+	size_t num_cells = 16;
+	double imbalance = 0.03;
+	size_t num_threads = 1;
+	size_t label_propagation_rounds = 5;
+	size_t initial_tries = 8;
+	size_t refinement_passes = 4;
+};
+
+struct PartitionStats {
+	std::vector<size_t> level_sizes;
+	uint64_t cut = 0;
+	uint64_t heaviest_cell = 0;
+	double imbalance = 0.0;
+};
+
+/* Merge each pair of vertices' edges into one undirected, weighted edge. */
+inline PartitionGraph
+undirected_partition_graph(Graph const &graph, size_t num_threads)
+{
+	TraceScope trace("partition graph");
+	size_t const num_vertices = graph.vertices.size();
+	PartitionGraph result;
+	result.vertex_weights.assign(num_vertices, 1);
+	std::vector<std::vector<std::pair<size_t, uint64_t>>> adjacent(
+		num_vertices);
+	run_in_blocks(num_vertices, num_threads, [&](size_t first,
+	                                             size_t last) {
+		for (size_t v = first; v < last; ++v) {
+			auto &list = adjacent[v];
+			auto const &vertex = graph.vertices[v];
+			for (auto edge_index : vertex.outgoing) {
+				list.push_back({graph.edges[edge_index].to, 1});
+			}
+			for (auto edge_index : vertex.incoming) {
+				list.push_back({graph.edges[edge_index].from,
+					1});
+			}
+			std::sort(list.begin(), list.end());
+			size_t kept = 0;
+			for (auto const &entry : list) {
+				if (entry.first == v) {
+					continue;
+				}
+				if (kept > 0 and
+				    list[kept - 1].first == entry.first) {
+					list[kept - 1].second += entry.second;
+				} else {
+					list[kept++] = entry;
+				}
+			}
+			list.resize(kept);
+		}
+	});
+	result.offsets.push_back(0);
+	for (auto &list : adjacent) {
+		for (auto const &entry : list) {
+			result.neighbours.push_back(entry.first);
+			result.edge_weights.push_back(entry.second);
+		}
+		result.offsets.push_back(result.neighbours.size());
+		list = {};
+	}
+	return result;
+}
+
+/* Cluster the vertices by size-constrained label propagation, returning each
+ * vertex's cluster, numbered from 0 up to `num_clusters'.
+ */
+inline std::vector<size_t>
+propagate_labels(PartitionGraph const &graph, uint64_t max_weight,
+	PartitionOptions const &options, size_t &num_clusters)
+{
+	TraceScope trace("label propagation");
+	size_t const n = graph.size();
+	std::vector<std::atomic<size_t>> label(n);
+	std::vector<std::atomic<uint64_t>> cluster_weight(n);
+	for (size_t v = 0; v < n; ++v) {
+		label[v].store(v, std::memory_order_relaxed);
+		cluster_weight[v].store(graph.vertex_weights[v],
+			std::memory_order_relaxed);
+	}
+	for (size_t round = 0; round < options.label_propagation_rounds;
+	     ++round) {
+		std::atomic<size_t> moved{0};
+		run_in_blocks(n, options.num_threads, [&](size_t first,
+		                                          size_t last) {
+			std::vector<std::pair<size_t, uint64_t>> ratings;
+			size_t moved_here = 0;
+			for (size_t v = first; v < last; ++v) {
+				size_t own = label[v].load(
+					std::memory_order_relaxed);
+				uint64_t weight = graph.vertex_weights[v];
+				ratings.clear();
+				for (size_t e = graph.offsets[v];
+				     e < graph.offsets[v + 1]; ++e) {
+					ratings.push_back({label[
+						graph.neighbours[e]].load(
+						std::memory_order_relaxed),
+						graph.edge_weights[e]});
+				}
+				std::sort(ratings.begin(), ratings.end());
+				size_t best = own;
+				uint64_t best_rating = 0;
+				for (size_t i = 0; i < ratings.size();) {
+					size_t cluster = ratings[i].first;
+					uint64_t rating = 0;
+					for (; i < ratings.size() and
+					     ratings[i].first == cluster; ++i) {
+						rating += ratings[i].second;
+					}
+					if (cluster == own) {
+						if (rating >= best_rating) {
+							best = own;
+							best_rating = rating;
+						}
+					} else if (rating > best_rating and
+					           cluster_weight[cluster].load(
+					           std::memory_order_relaxed) +
+					           weight <= max_weight) {
+						best = cluster;
+						best_rating = rating;
+					}
+				}
+				if (best == own) {
+					continue;
+				}
+				/* Another thread may have filled the
+				 * cluster meanwhile.
+				 */
+				uint64_t before = cluster_weight[best]
+					.fetch_add(weight);
+				if (before + weight > max_weight) {
+					cluster_weight[best].fetch_sub(weight);
+					continue;
+				}
+				cluster_weight[own].fetch_sub(weight);
+				label[v].store(best,
+					std::memory_order_relaxed);
+				moved_here += 1;
+			}
+			moved += moved_here;
+		});
+		if (moved.load() < n / 100 + 1) {
+			break;
+		}
+	}
+	std::vector<size_t> number(n, SIZE_MAX);
+	std::vector<size_t> cluster(n);
+	num_clusters = 0;
+	for (size_t v = 0; v < n; ++v) {
+		size_t l = label[v].load(std::memory_order_relaxed);
+		if (number[l] == SIZE_MAX) {
+			number[l] = num_clusters++;
+		}
+		cluster[v] = number[l];
+	}
+	return cluster;
+}
+
+/* The graph of the clusters, with each cluster's edges to each other merged.
+ */
+inline PartitionGraph
+contract_clusters(PartitionGraph const &graph,
+	std::vector<size_t> const &cluster, size_t num_clusters,
+	size_t num_threads)
+{
+	TraceScope trace("contract clusters");
+	size_t const n = graph.size();
+	/* The members of each cluster, by counting sort. */
+	std::vector<size_t> first_member(num_clusters + 1, 0);
+	for (size_t v = 0; v < n; ++v) {
+		first_member[cluster[v] + 1] += 1;
+	}
+	std::partial_sum(first_member.begin(), first_member.end(),
+		first_member.begin());
+	std::vector<size_t> members(n);
+	{
+		auto next = first_member;
+		for (size_t v = 0; v < n; ++v) {
+			members[next[cluster[v]]++] = v;
+		}
+	}
+	PartitionGraph coarse;
+	coarse.vertex_weights.assign(num_clusters, 0);
+	std::vector<std::vector<std::pair<size_t, uint64_t>>> adjacent(
+		num_clusters);
+	run_in_blocks(num_clusters, num_threads, [&](size_t first,
+	                                             size_t last) {
+		for (size_t c = first; c < last; ++c) {
+			auto &list = adjacent[c];
+			for (size_t m = first_member[c];
+			     m < first_member[c + 1]; ++m) {
+				size_t v = members[m];
+				coarse.vertex_weights[c] +=
+					graph.vertex_weights[v];
+				for (size_t e = graph.offsets[v];
+				     e < graph.offsets[v + 1]; ++e) {
+					size_t to = cluster[
+						graph.neighbours[e]];
+					if (to != c) {
+						list.push_back({to,
+							graph.edge_weights[e]});
+					}
+				}
+			}
+			std::sort(list.begin(), list.end());
+			size_t kept = 0;
+			for (auto const &entry : list) {
+				if (kept > 0 and
+				    list[kept - 1].first == entry.first) {
+					list[kept - 1].second += entry.second;
+				} else {
+					list[kept++] = entry;
+				}
+			}
+			list.resize(kept);
+		}
+	});
+	coarse.offsets.push_back(0);
+	for (auto &list : adjacent) {
+		for (auto const &entry : list) {
+			coarse.neighbours.push_back(entry.first);
+			coarse.edge_weights.push_back(entry.second);
+		}
+		coarse.offsets.push_back(coarse.neighbours.size());
+		list = {};
+	}
+	return coarse;
+}
+
+inline uint64_t
+cut_weight(PartitionGraph const &graph, std::vector<size_t> const &cell)
+{
+	uint64_t cut = 0;
+	for (size_t v = 0; v < graph.size(); ++v) {
+		for (size_t e = graph.offsets[v]; e < graph.offsets[v + 1];
+		     ++e) {
+			if (cell[graph.neighbours[e]] != cell[v]) {
+				cut += graph.edge_weights[e];
+			}
+		}
+	}
+	/* Each edge was counted from both ends. */
+	return cut / 2;
+}
+
+inline std::vector<uint64_t>
+cell_weights(PartitionGraph const &graph, std::vector<size_t> const &cell,
+	size_t num_cells)
+{
+	std::vector<uint64_t> weights(num_cells, 0);
+	for (size_t v = 0; v < graph.size(); ++v) {
+		weights[cell[v]] += graph.vertex_weights[v];
+	}
+	return weights;
+}
+
+/* The weight of `v's edges into each cell next to it, and into its own,
+ * into `connection' (which holds zeroes for every cell beforehand, and is
+ * cleared again by the caller through `touched').
+ */
+inline void
+cell_connections(PartitionGraph const &graph, std::vector<size_t> const &cell,
+	size_t v, std::vector<uint64_t> &connection,
+	std::vector<size_t> &touched)
+{
+	touched.clear();
+	touched.push_back(cell[v]);
+	for (size_t e = graph.offsets[v]; e < graph.offsets[v + 1]; ++e) {
+		size_t c = cell[graph.neighbours[e]];
+		if (connection[c] == 0 and c != cell[v]) {
+			touched.push_back(c);
+		}
+		connection[c] += graph.edge_weights[e];
+	}
+}
+
+/* The best cell to move `v' to, which has room for it, and the reduction in
+ * the cut from moving it there; SIZE_MAX if there is no other cell next to
+ * it with room.
+ */
+inline size_t
+best_move(PartitionGraph const &graph, std::vector<size_t> const &cell,
+	std::vector<uint64_t> const &weights, uint64_t max_weight, size_t v,
+	std::vector<uint64_t> &connection, std::vector<size_t> &touched,
+	int64_t &gain)
+{
+	cell_connections(graph, cell, v, connection, touched);
+	size_t own = cell[v];
+	size_t best = SIZE_MAX;
+	gain = INT64_MIN;
+	for (size_t i = 1; i < touched.size(); ++i) {
+		size_t c = touched[i];
+		int64_t g = int64_t(connection[c]) - int64_t(connection[own]);
+		/* Between equal gains the lighter cell is better. */
+		if (weights[c] + graph.vertex_weights[v] <= max_weight and
+		    (g > gain or (g == gain and weights[c] < weights[best]))) {
+			best = c;
+			gain = g;
+		}
+	}
+	for (auto c : touched) {
+		connection[c] = 0;
+	}
+	return best;
+}
+
+/* Rounds of moving each boundary vertex to the neighbouring cell with room
+ * which reduces the cut most, if any does, on `num_threads' threads. This
+ * takes the easy gains quickly before Fiduccia-Mattheyses looks for the
+ * rest, which it does one move at a time.
+ */
+inline void
+refine_by_label_propagation(PartitionGraph const &graph,
+	std::vector<size_t> &cell, size_t num_cells, uint64_t max_weight,
+	PartitionOptions const &options)
+{
+	TraceScope trace("refine by label propagation");
+	size_t const n = graph.size();
+	std::vector<std::atomic<size_t>> shared_cell(n);
+	for (size_t v = 0; v < n; ++v) {
+		shared_cell[v].store(cell[v], std::memory_order_relaxed);
+	}
+	std::vector<std::atomic<uint64_t>> weights(num_cells);
+	auto initial = cell_weights(graph, cell, num_cells);
+	for (size_t c = 0; c < num_cells; ++c) {
+		weights[c].store(initial[c], std::memory_order_relaxed);
+	}
+	for (size_t round = 0; round < options.label_propagation_rounds;
+	     ++round) {
+		std::atomic<size_t> moved{0};
+		run_in_blocks(n, options.num_threads, [&](size_t first,
+		                                          size_t last) {
+			std::vector<uint64_t> connection(num_cells, 0);
+			std::vector<size_t> touched;
+			size_t moved_here = 0;
+			for (size_t v = first; v < last; ++v) {
+				size_t own = shared_cell[v].load(
+					std::memory_order_relaxed);
+				uint64_t weight = graph.vertex_weights[v];
+				touched.clear();
+				for (size_t e = graph.offsets[v];
+				     e < graph.offsets[v + 1]; ++e) {
+					size_t c = shared_cell[
+						graph.neighbours[e]].load(
+						std::memory_order_relaxed);
+					if (connection[c] == 0) {
+						touched.push_back(c);
+					}
+					connection[c] += graph.edge_weights[e];
+				}
+				size_t best = own;
+				uint64_t best_connection = connection[own];
+				for (auto c : touched) {
+					if (connection[c] > best_connection and
+					    weights[c].load(
+					    std::memory_order_relaxed) +
+					    weight <= max_weight) {
+						best = c;
+						best_connection = connection[c];
+					}
+				}
+				for (auto c : touched) {
+					connection[c] = 0;
+				}
+				if (best == own) {
+					continue;
+				}
+				if (weights[best].fetch_add(weight) + weight >
+				    max_weight) {
+					weights[best].fetch_sub(weight);
+					continue;
+				}
+				weights[own].fetch_sub(weight);
+				shared_cell[v].store(best,
+					std::memory_order_relaxed);
+				moved_here += 1;
+			}
+			moved += moved_here;
+		});
+		if (moved.load() < n / 1000 + 1) {
+			break;
+		}
+	}
+	for (size_t v = 0; v < n; ++v) {
+		cell[v] = shared_cell[v].load(std::memory_order_relaxed);
+	}
+}
+
+/* For refinement, each vertex's edges into each cell it has edges to, kept
+ * up to date as vertices move, so that finding a vertex's best move takes
+ * a look at the few cells next to it rather than at all its edges. Each
+ * vertex's list is kept where its adjacency list is, as it can't be next
+ * to more cells than it has neighbours.
+ */
+struct CellConnections {
+	std::vector<size_t> cells;
+	std::vector<uint64_t> weights;
+	std::vector<size_t> count;
+};
+
+inline void
+add_connection(PartitionGraph const &graph, CellConnections &connections,
+	size_t v, size_t cell, int64_t weight)
+{
+	size_t const base = graph.offsets[v];
+	size_t &count = connections.count[v];
+	for (size_t i = base; i < base + count; ++i) {
+		if (connections.cells[i] != cell) {
+			continue;
+		}
+		connections.weights[i] += weight;
+		if (connections.weights[i] == 0) {
+			count -= 1;
+			connections.cells[i] = connections.cells[base + count];
+			connections.weights[i] =
+				connections.weights[base + count];
+		}
+		return;
+	}
+	connections.cells[base + count] = cell;
+	connections.weights[base + count] = weight;
+	count += 1;
+}
+
+inline CellConnections
+build_cell_connections(PartitionGraph const &graph,
+	std::vector<size_t> const &cell)
+{
+	CellConnections connections;
+	connections.cells.resize(graph.neighbours.size());
+	connections.weights.resize(graph.neighbours.size());
+	connections.count.assign(graph.size(), 0);
+	for (size_t v = 0; v < graph.size(); ++v) {
+		for (size_t e = graph.offsets[v]; e < graph.offsets[v + 1];
+		     ++e) {
+			add_connection(graph, connections, v,
+				cell[graph.neighbours[e]],
+				graph.edge_weights[e]);
+		}
+	}
+	return connections;
+}
+
+/* The best cell to move `v' to, as `best_move' but from its connections. */
+inline size_t
+best_connected_move(PartitionGraph const &graph,
+	CellConnections const &connections, std::vector<size_t> const &cell,
+	std::vector<uint64_t> const &weights, uint64_t max_weight, size_t v,
+	int64_t &gain)
+{
+	size_t const base = graph.offsets[v];
+	size_t const end = base + connections.count[v];
+	size_t own = cell[v];
+	int64_t own_connection = 0;
+	for (size_t i = base; i < end; ++i) {
+		if (connections.cells[i] == own) {
+			own_connection = connections.weights[i];
+		}
+	}
+	size_t best = SIZE_MAX;
+	gain = INT64_MIN;
+	for (size_t i = base; i < end; ++i) {
+		size_t c = connections.cells[i];
+		int64_t g = int64_t(connections.weights[i]) - own_connection;
+		if (c != own and
+		    weights[c] + graph.vertex_weights[v] <= max_weight and
+		    (g > gain or (g == gain and weights[c] < weights[best]))) {
+			best = c;
+			gain = g;
+		}
+	}
+	return best;
+}
+
+/* Passes of Fiduccia-Mattheyses refinement, as described above. Returns the
+ * cut, which is never heavier than it was.
+ */
+inline uint64_t
+refine_cells(PartitionGraph const &graph, std::vector<size_t> &cell,
+	size_t num_cells, uint64_t max_weight, size_t passes)
+{
+	TraceScope trace("refine");
+	size_t const n = graph.size();
+	auto weights = cell_weights(graph, cell, num_cells);
+	uint64_t cut = cut_weight(graph, cell);
+	auto connections = build_cell_connections(graph, cell);
+	std::vector<bool> locked(n, false);
+	struct Candidate {
+		int64_t gain;
+		size_t vertex;
+		size_t to;
+		bool operator<(Candidate const &other) const
+		{
+			return gain != other.gain ? gain < other.gain
+				: vertex > other.vertex;
+		}
+	};
+	auto move_vertex = [&](size_t v, size_t to) {
+		size_t from = cell[v];
+		weights[from] -= graph.vertex_weights[v];
+		weights[to] += graph.vertex_weights[v];
+		cell[v] = to;
+		for (size_t e = graph.offsets[v]; e < graph.offsets[v + 1];
+		     ++e) {
+			size_t u = graph.neighbours[e];
+			int64_t weight = graph.edge_weights[e];
+			add_connection(graph, connections, u, from, -weight);
+			add_connection(graph, connections, u, to, weight);
+		}
+	};
+	/* A pass gives up after this many moves in a row without finding a
+	 * lighter cut.
+	 */
+	size_t const patience = std::max<size_t>(50, n / 100);
+	for (size_t pass = 0; pass < passes; ++pass) {
+		std::priority_queue<Candidate> queue;
+		auto consider = [&](size_t v) {
+			int64_t gain;
+			size_t to = best_connected_move(graph, connections,
+				cell, weights, max_weight, v, gain);
+			if (to != SIZE_MAX) {
+				queue.push({gain, v, to});
+			}
+		};
+		for (size_t v = 0; v < n; ++v) {
+			consider(v);
+		}
+		struct Move {
+			size_t vertex;
+			size_t from;
+		};
+		std::vector<Move> moves;
+		int64_t change = 0;
+		int64_t best_change = 0;
+		size_t best_moves = 0;
+		while (!queue.empty() and
+		       moves.size() - best_moves < patience) {
+			auto candidate = queue.top();
+			queue.pop();
+			size_t v = candidate.vertex;
+			if (locked[v]) {
+				continue;
+			}
+			/* The gain may have changed since it was pushed;
+			 * if so it goes back in with the new one.
+			 */
+			int64_t gain;
+			size_t to = best_connected_move(graph, connections,
+				cell, weights, max_weight, v, gain);
+			if (to == SIZE_MAX) {
+				continue;
+			}
+			if (gain != candidate.gain or to != candidate.to) {
+				queue.push({gain, v, to});
+				continue;
+			}
+			moves.push_back({v, cell[v]});
+			move_vertex(v, to);
+			locked[v] = true;
+			change -= gain;
+			if (change < best_change) {
+				best_change = change;
+				best_moves = moves.size();
+			}
+			for (size_t e = graph.offsets[v];
+			     e < graph.offsets[v + 1]; ++e) {
+				size_t u = graph.neighbours[e];
+				if (!locked[u]) {
+					consider(u);
+				}
+			}
+		}
+		while (moves.size() > best_moves) {
+			move_vertex(moves.back().vertex, moves.back().from);
+			moves.pop_back();
+		}
+		std::fill(locked.begin(), locked.end(), false);
+		cut = uint64_t(int64_t(cut) + best_change);
+		if (best_change == 0) {
+			break;
+		}
+	}
+	return cut;
+}
+
+/* Move vertices out of any cell heavier than `max_weight', each to the cell
+ * with room which costs the cut least: a neighbouring one if there is one,
+ * otherwise the lightest.
+ */
+inline void
+rebalance_cells(PartitionGraph const &graph, std::vector<size_t> &cell,
+	size_t num_cells, uint64_t max_weight)
+{
+	auto weights = cell_weights(graph, cell, num_cells);
+	std::vector<uint64_t> connection(num_cells, 0);
+	std::vector<size_t> touched;
+	for (size_t c = 0; c < num_cells; ++c) {
+		if (weights[c] <= max_weight) {
+			continue;
+		}
+		std::vector<std::pair<int64_t, size_t>> candidates;
+		for (size_t v = 0; v < graph.size(); ++v) {
+			if (cell[v] != c) {
+				continue;
+			}
+			int64_t gain;
+			best_move(graph, cell, weights, max_weight, v,
+				connection, touched, gain);
+			candidates.push_back({gain, v});
+		}
+		std::sort(candidates.begin(), candidates.end(),
+			[](std::pair<int64_t, size_t> const &a,
+			   std::pair<int64_t, size_t> const &b) {
+				return a.first > b.first;
+			});
+		for (auto const &candidate : candidates) {
+			if (weights[c] <= max_weight) {
+				break;
+			}
+			size_t v = candidate.second;
+			int64_t gain;
+			size_t to = best_move(graph, cell, weights, max_weight,
+				v, connection, touched, gain);
+			if (to == SIZE_MAX) {
+				to = size_t(std::min_element(weights.begin(),
+					weights.end()) - weights.begin());
+			}
+			if (to == c) {
+				break;
+			}
+			weights[c] -= graph.vertex_weights[v];
+			weights[to] += graph.vertex_weights[v];
+			cell[v] = to;
+		}
+	}
+}
+
+/* The vertices of `part' (those whose `part_of' is `id') in breadth-first
+ * order, starting from the last vertex reached by a first breadth-first
+ * search from `part[start]', which is one at the edge of the part. A part
+ * which isn't connected is taken a piece at a time.
+ */
+inline std::vector<size_t>
+breadth_first_order(PartitionGraph const &graph,
+	std::vector<size_t> const &part, std::vector<size_t> const &part_of,
+	size_t id, size_t start, std::vector<size_t> &seen, size_t &visit)
+{
+	std::vector<size_t> order;
+	for (int sweep = 0; sweep < 2; ++sweep) {
+		size_t root = sweep == 0 ? part[start % part.size()]
+			: order.back();
+		visit += 1;
+		order.clear();
+		for (size_t i = 0; order.size() < part.size(); ++i) {
+			if (i > 0) {
+				root = part[(start + i) % part.size()];
+			}
+			if (seen[root] == visit) {
+				continue;
+			}
+			seen[root] = visit;
+			order.push_back(root);
+			for (size_t head = order.size() - 1;
+			     head < order.size(); ++head) {
+				size_t v = order[head];
+				for (size_t e = graph.offsets[v];
+				     e < graph.offsets[v + 1]; ++e) {
+					size_t u = graph.neighbours[e];
+					if (part_of[u] == id and
+					    seen[u] != visit) {
+						seen[u] = visit;
+						order.push_back(u);
+					}
+				}
+			}
+		}
+	}
+	return order;
+}
+
+/* Cut the coarsest graph into cells by recursive bisection: each part is
+ * split in breadth-first order from a vertex at its edge, into two with
+ * their weights in proportion to the numbers of cells they are to be cut
+ * into, so a grid is cut into strips and then blocks. `start' varies where
+ * the searches start from, so that each try cuts differently.
+ */
+inline std::vector<size_t>
+bisect_cells(PartitionGraph const &graph, size_t num_cells, size_t start)
+{
+	size_t const n = graph.size();
+	std::vector<size_t> cell(n, 0);
+	std::vector<size_t> part_of(n, 0);
+	std::vector<size_t> seen(n, 0);
+	size_t visit = 0;
+	size_t next_id = 1;
+	struct Part {
+		std::vector<size_t> vertices;
+		size_t id;
+		size_t first_cell;
+		size_t num_cells;
+	};
+	std::vector<Part> parts;
+	std::vector<size_t> everything(n);
+	std::iota(everything.begin(), everything.end(), 0);
+	parts.push_back({std::move(everything), 0, 0, num_cells});
+	while (!parts.empty()) {
+		auto part = std::move(parts.back());
+		parts.pop_back();
+		if (part.num_cells == 1 or part.vertices.empty()) {
+			for (auto v : part.vertices) {
+				cell[v] = part.first_cell;
+			}
+			continue;
+		}
+		uint64_t total = 0;
+		for (auto v : part.vertices) {
+			total += graph.vertex_weights[v];
+		}
+		size_t left_cells = part.num_cells / 2;
+		uint64_t target = total * left_cells / part.num_cells;
+		auto order = breadth_first_order(graph, part.vertices,
+			part_of, part.id, start, seen, visit);
+		Part left = {{}, next_id++, part.first_cell, left_cells};
+		Part right = {{}, next_id++, part.first_cell + left_cells,
+			part.num_cells - left_cells};
+		uint64_t so_far = 0;
+		for (auto v : order) {
+			auto &side = so_far < target ? left : right;
+			so_far += graph.vertex_weights[v];
+			side.vertices.push_back(v);
+			part_of[v] = side.id;
+		}
+		parts.push_back(std::move(left));
+		parts.push_back(std::move(right));
+	}
+	return cell;
+}
+
+inline uint64_t
+max_cell_weight(PartitionGraph const &graph, size_t num_cells,
+	double imbalance, bool strict)
+{
+	uint64_t total = std::accumulate(graph.vertex_weights.begin(),
+		graph.vertex_weights.end(), uint64_t(0));
+	uint64_t limit = uint64_t((1.0 + imbalance) * double(total) /
+		double(num_cells));
+	limit = std::max(limit, (total + num_cells - 1) / num_cells);
+	if (!strict) {
+		limit += *std::max_element(graph.vertex_weights.begin(),
+			graph.vertex_weights.end());
+	}
+	return limit;
+}
+
+/* The cell of each of the graph's vertices, numbered from 0. */
+inline std::vector<size_t>
+partition_graph(Graph const &graph, PartitionOptions const &options,
+	PartitionStats &stats)
+{
+	TraceScope trace("partition");
+	size_t const num_cells = std::max<size_t>(1, options.num_cells);
+	std::vector<PartitionGraph> levels;
+	std::vector<std::vector<size_t>> clusters;
+	levels.push_back(undirected_partition_graph(graph,
+		options.num_threads));
+	stats.level_sizes = {levels[0].size()};
+	if (levels[0].size() == 0) {
+		return {};
+	}
+
+	/* Coarsen until there are a few dozen vertices per cell. Clusters
+	 * are kept light enough that the coarsest graph can still be cut
+	 * evenly, and grow only a few times heavier than the level's
+	 * vertices.
+	 */
+	size_t const coarsest = 32 * num_cells;
+	uint64_t total = levels[0].size();
+	uint64_t max_cluster = std::max<uint64_t>(1, total / (coarsest / 2));
+	while (levels.back().size() > coarsest) {
+		size_t num_clusters;
+		uint64_t average = total / levels.back().size();
+		uint64_t cap = std::min<uint64_t>(max_cluster,
+			std::max<uint64_t>(1, 4 * average));
+		auto cluster = propagate_labels(levels.back(), cap, options,
+			num_clusters);
+		if (num_clusters > levels.back().size() * 9 / 10) {
+			break;
+		}
+		levels.push_back(contract_clusters(levels.back(), cluster,
+			num_clusters, options.num_threads));
+		clusters.push_back(std::move(cluster));
+		stats.level_sizes.push_back(num_clusters);
+	}
+
+	/* Cut the coarsest graph several ways and keep the best. */
+	auto const &top = levels.back();
+	uint64_t top_limit = max_cell_weight(top, num_cells,
+		options.imbalance, levels.size() == 1);
+	std::vector<size_t> cell;
+	uint64_t best_cut = UINT64_MAX;
+	size_t tries = std::max<size_t>(1, options.initial_tries);
+	for (size_t t = 0; t < tries; ++t) {
+		auto tried = bisect_cells(top, num_cells,
+			top.size() * t / tries);
+		uint64_t cut = refine_cells(top, tried, num_cells, top_limit,
+			options.refinement_passes);
+		if (cut < best_cut) {
+			best_cut = cut;
+			cell = std::move(tried);
+		}
+	}
+
+	/* Project the cells back down, refining them at every level. */
+	for (size_t level = levels.size() - 1; level-- > 0;) {
+		auto const &fine = levels[level];
+		auto const &cluster = clusters[level];
+		std::vector<size_t> projected(fine.size());
+		for (size_t v = 0; v < fine.size(); ++v) {
+			projected[v] = cell[cluster[v]];
+		}
+		cell = std::move(projected);
+		uint64_t limit = max_cell_weight(fine, num_cells,
+			options.imbalance, level == 0);
+		if (level == 0) {
+			rebalance_cells(fine, cell, num_cells, limit);
+		}
+		refine_by_label_propagation(fine, cell, num_cells, limit,
+			options);
+		refine_cells(fine, cell, num_cells, limit,
+			options.refinement_passes);
+	}
+	if (levels.size() == 1) {
+		rebalance_cells(levels[0], cell, num_cells, top_limit);
+	}
+
+	auto weights = cell_weights(levels[0], cell, num_cells);
+	stats.cut = cut_weight(levels[0], cell);
+	stats.heaviest_cell = *std::max_element(weights.begin(),
+		weights.end());
+	stats.imbalance = double(stats.heaviest_cell) * double(num_cells) /
+		double(total) - 1.0;
+	return cell;
+}
+
+/* The vertices in order of their cells, and in their old order within each
+ * cell, for renumbering the graph so that each cell's vertices are
+ * numbered contiguously.
+ */
+inline std::vector<size_t>
+cell_order(std::vector<size_t> const &cell)
+{
+	std::vector<size_t> order(cell.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return cell[a] < cell[b];
+	});
+	return order;
+}
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/* The hardware events collected for each phase. Each one is opened as its
+ * own counter rather than as a group, so that a machine (or a VM) which
+ * doesn't support one of them still reports the others.
+ */
+enum PerfEvent {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_LLC_MISSES,
+	PERF_DTLB_MISSES,
+	PERF_BRANCH_MISSES,
+	NUM_PERF_EVENTS
+};
+
+/* The counts collected over one phase. Events which could not be opened
+ * are marked as not `available' and are reported as such.
+ */
+struct PerfSample {
+	uint64_t counts[NUM_PERF_EVENTS];
+	bool available[NUM_PERF_EVENTS];
+};
+
+/* A set of counters for the calling thread, which is started and stopped
+ * around each phase of the program. If perf events are not permitted (for
+ * example because of `/proc/sys/kernel/perf_event_paranoid', or because we
+ * are inside a container) `open' fails, `error' says why, and every sample
+ * taken afterwards is simply empty.
+ */
+struct PerfCounters {
+	PerfCounters()
+	{
+		for (auto &fd : fds) {
+			fd = -1;
+		}
+	}
+	~PerfCounters()
+	{
+		close_all();
+	}
+	PerfCounters(PerfCounters const &) = delete;
+	PerfCounters &operator=(PerfCounters const &) = delete;
+
+	bool open()
+	{
+#ifdef __linux__
+		static uint64_t const configs[NUM_PERF_EVENTS][2] = {
+			{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+			{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+			{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+			{PERF_TYPE_HW_CACHE,
+				PERF_COUNT_HW_CACHE_DTLB |
+				(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+				(PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+			{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+		};
+		bool any = false;
+		for (size_t i = 0; i < NUM_PERF_EVENTS; ++i) {
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = configs[i][0];
+			attr.config = configs[i][1];
+			attr.disabled = 1;
+			/* Only user space is counted, which is all that
+			 * an unprivileged process is normally allowed.
+			 */
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+				PERF_FORMAT_TOTAL_TIME_RUNNING;
+			fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1,
+				-1, 0);
+			if (fds[i] >= 0) {
+				any = true;
+			} else if (error.empty()) {
+				error = std::strerror(errno);
+			}
+		}
+		if (!any) {
+			return false;
+		}
+		error.clear();
+		return true;
+#else
+		error = "not supported on this platform";
+		return false;
+#endif
+	}
+
+	void start()
+	{
+#ifdef __linux__
+		for (auto fd : fds) {
+			if (fd >= 0) {
+				ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+				ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+			}
+		}
+#endif
+	}
+
+	PerfSample stop()
+	{
+		PerfSample sample = {};
+#ifdef __linux__
+		for (size_t i = 0; i < NUM_PERF_EVENTS; ++i) {
+			if (fds[i] < 0) {
+				continue;
+			}
+			ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+			/* value, time enabled, time running. */
+			uint64_t values[3];
+			if (read(fds[i], values, sizeof(values)) !=
+			    sizeof(values)) {
+				continue;
+			}
+			/* If the kernel had to multiplex the counters
+			 * then scale up to the whole time enabled.
+			 */
+			if (values[2] == 0) {
+				continue;
+			}
+			double scale = (double) values[1] / values[2];
+			sample.counts[i] = values[0] * scale;
+			sample.available[i] = true;
+		}
+#endif
+		return sample;
+	}
+
+	std::string error;
+private:
+	int fds[NUM_PERF_EVENTS];
+
+	void close_all()
+	{
+#ifdef __linux__
+		for (auto &fd : fds) {
+			if (fd >= 0) {
+				close(fd);
+				fd = -1;
+			}
+		}
+#endif
+	}
+};
+
+/* Add the counts of `sample' into `total', for phases which are run more
+ * than once.
+ */
+inline void
+add_perf_sample(PerfSample &total, PerfSample const &sample)
+{
+	for (size_t i = 0; i < NUM_PERF_EVENTS; ++i) {
+		if (sample.available[i]) {
+			total.counts[i] += sample.counts[i];
+			total.available[i] = true;
+		}
+	}
+}
+
+/* Print a sample in the same style as the timing output, e.g.
+ * "Searching counters: 1234 cycles, 2345 instructions (IPC 1.9), ...".
+ */
+inline void
+print_perf_sample(std::ostream &out, char const *phase,
+	PerfSample const &sample)
+{
+	static char const *const names[NUM_PERF_EVENTS] = {
+		"cycles",
+		"instructions",
+		"LLC misses",
+		"dTLB misses",
+		"branch misses",
+	};
+	out << phase << " counters: ";
+	for (size_t i = 0; i < NUM_PERF_EVENTS; ++i) {
+		if (i > 0) {
+			out << ", ";
+		}
+		if (sample.available[i]) {
+			out << sample.counts[i];
+		} else {
+			out << "n/a";
+		}
+		out << " " << names[i];
+		if (i == PERF_INSTRUCTIONS and sample.available[i] and
+		    sample.available[PERF_CYCLES] and
+		    sample.counts[PERF_CYCLES] > 0) {
+			out << " (IPC ";
+			out << (double) sample.counts[PERF_INSTRUCTIONS] /
+				sample.counts[PERF_CYCLES];
+			out << ")";
+		}
+	}
+	out << "." << std::endl;
+}
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/* With `--pipeline' a batch of queries is answered by three stages running
+ * at once, each on threads of its own: the heuristic stage works out the
+ * heuristic for each run of queries with the same destination, the search
+ * stage searches for each query in the runs whose heuristic is ready, and
+ * the output stage writes the answers out in the order the queries were
+ * asked. So the next run's heuristic is worked out while the current run is
+ * searched, and the answers are formatted while both go on.
+ *
+ * The stages hand work on through bounded queues, which are lock-free rings
+ * (Dmitry Vyukov's bounded MPMC queue): each cell has a sequence number
+ * which says whether it is ready to be written or read on this lap of the
+ * ring, so pushing and popping are a compare-and-swap on the position and
+ * never block each other. A full or empty queue is waited on by yielding,
+ * and the time spent waiting is counted so that each stage's utilisation
+ * can be reported.
+ */
+template <typename T>
+struct BoundedQueue {
+	struct Cell {
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	explicit BoundedQueue(size_t capacity) :
+		cells(round_up(capacity)),
+		mask(cells.size() - 1)
+	{
+		for (size_t i = 0; i < cells.size(); ++i) {
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	bool try_push(T &value)
+	{
+		size_t position = tail.load(std::memory_order_relaxed);
+		for (;;) {
+			Cell &cell = cells[position & mask];
+			size_t sequence = cell.sequence.load(
+				std::memory_order_acquire);
+			auto difference = intptr_t(sequence) -
+				intptr_t(position);
+			if (difference == 0) {
+				if (tail.compare_exchange_weak(position,
+				    position + 1, std::memory_order_relaxed)) {
+					cell.value = std::move(value);
+					cell.sequence.store(position + 1,
+						std::memory_order_release);
+					return true;
+				}
+			} else if (difference < 0) {
+				return false;
+			} else {
+				position = tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	bool try_pop(T &value)
+	{
+		size_t position = head.load(std::memory_order_relaxed);
+		for (;;) {
+			Cell &cell = cells[position & mask];
+			size_t sequence = cell.sequence.load(
+				std::memory_order_acquire);
+			auto difference = intptr_t(sequence) -
+				intptr_t(position + 1);
+			if (difference == 0) {
+				if (head.compare_exchange_weak(position,
+				    position + 1, std::memory_order_relaxed)) {
+					value = std::move(cell.value);
+					cell.sequence.store(position + mask + 1,
+						std::memory_order_release);
+					return true;
+				}
+			} else if (difference < 0) {
+				return false;
+			} else {
+				position = head.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	/* These wait for room or for a value, adding the time waited to
+	 * `waited'.
+	 */
+	void push(T value, std::chrono::steady_clock::duration &waited)
+	{
+		if (try_push(value)) {
+			return;
+		}
+		auto start = std::chrono::steady_clock::now();
+		while (!try_push(value)) {
+			std::this_thread::yield();
+		}
+		waited += std::chrono::steady_clock::now() - start;
+	}
+
+	T pop(std::chrono::steady_clock::duration &waited)
+	{
+		T value;
+		if (try_pop(value)) {
+			return value;
+		}
+		auto start = std::chrono::steady_clock::now();
+		while (!try_pop(value)) {
+			std::this_thread::yield();
+		}
+		waited += std::chrono::steady_clock::now() - start;
+		return value;
+	}
+
+	static size_t round_up(size_t capacity)
+	{
+		size_t size = 2;
+		while (size < capacity) {
+			size *= 2;
+		}
+		return size;
+	}
+
+	std::vector<Cell> cells;
+	size_t const mask;
+	/* Apart, so that producers and consumers don't share a cache line. */
+	alignas(64) std::atomic<size_t> tail{0};
+	alignas(64) std::atomic<size_t> head{0};
+};
+
+/* How long each thread of a stage ran for and how much of that it spent
+ * waiting on the queues either side of it.
+ */
+struct StageTimes {
+	char const *name;
+	std::vector<std::chrono::steady_clock::duration> running;
+	std::vector<std::chrono::steady_clock::duration> waiting;
+};
+
+/* e.g. "Pipeline: heuristic stage 2 threads 91.5% busy, ...". */
+inline void
+print_stage_utilisation(std::ostream &out,
+	std::vector<StageTimes> const &stages,
+	std::chrono::steady_clock::duration elapsed)
+{
+	out << "Pipeline:";
+	for (size_t i = 0; i < stages.size(); ++i) {
+		auto const &stage = stages[i];
+		std::chrono::duration<double> busy{};
+		for (size_t t = 0; t < stage.running.size(); ++t) {
+			busy += stage.running[t] - stage.waiting[t];
+		}
+		std::chrono::duration<double> available = elapsed *
+			stage.running.size();
+		out << (i > 0 ? ", " : " ") << stage.name << " stage ";
+		out << stage.running.size();
+		out << (stage.running.size() == 1 ? " thread " : " threads ");
+		out << 100 * busy.count() / available.count() << "% busy";
+	}
+	std::chrono::duration<double> seconds = elapsed;
+	out << ", over " << 1000 * seconds.count() << " milliseconds.";
+	out << std::endl;
+}
+
+#endif
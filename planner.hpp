@@ -0,0 +1,96 @@
+#ifndef PLANNER_HPP
+#define PLANNER_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+#include "engines.hpp"
+#include "profile.hpp"
+#include "search.hpp"
+
+/* The planner picks the engine for each query from the graph's profile, `k'
+ * and whether the heuristic for the destination is already to hand. Its
+ * costs are rough counts of edge relaxations and queue comparisons; only how
+ * they compare matters.
+ *
+ * - The A*-search first needs the heuristic, a Dijkstra over the whole
+ *   graph, unless it is already cached. Its cost is shared by the `reuse'
+ *   queries known to be coming with the same destination (1 when the
+ *   future is unknown, as in server mode). With the exact heuristic the
+ *   search itself only strays from the k paths on ties, so it costs about
+ *   k times the length of a path in hops times the degree. If the graph
+ *   has been contracted the Dijkstra only visits the junctions, and the
+ *   rest of the vertices cost a step each.
+ * - The counted Dijkstra needs nothing up front, but has to settle every
+ *   vertex nearer than the destination up to k times: on average half the
+ *   graph, or less in a DAG where only the source's descendants can be
+ *   reached. It wins for one-off queries with small k.
+ *
+ * A path is about the square root of the graph's size in hops in a road
+ * network (which is symmetric and nearly planar), and about its logarithm
+ * in the degree in a random graph.
+ *
+ * The 4-ary heap does fewer comparisons per push and wins once the queue
+ * outgrows the cache; below that the binary heap's cheaper pops win. The
+ * A*-search's queue holds the fringe of every path explored, and the
+ * heuristic's queue the frontier of the Dijkstra: a circle around the
+ * destination in a road network, a good part of the graph otherwise. The
+ * counted Dijkstra's queue holds up to k copies of its frontier.
+ */
+struct QueryPlan {
+	Engine const *engine;
+	double astar_cost;
+	double counted_cost;
+	size_t expected_queue;
+};
+
+/* Queues with more elements than this don't fit in the L1 cache. */
+inline size_t const large_queue = 1024;
+
+inline QueryPlan
+plan_query(GraphProfile const &profile, bool heuristic_ready,
+	Query const &query, size_t reuse)
+{
+	double vertices = std::max<double>(profile.num_vertices, 2);
+	double degree = std::max(profile.mean_degree, 1.0);
+	double log_vertices = std::log2(vertices);
+	double hops = profile.symmetric ? std::sqrt(vertices)
+		: log_vertices / std::log2(std::max(degree, 2.0));
+	double k = double(query.k);
+
+	double heuristic_cost = 0.0;
+	if (!heuristic_ready) {
+		double junctions = std::max<double>(
+			profile.heuristic_vertices, 2);
+		heuristic_cost = (junctions * (degree + log_vertices) +
+			(vertices - junctions)) /
+			double(std::max<size_t>(reuse, 1));
+	}
+	double search_queue = k * hops * degree;
+	double astar_cost = heuristic_cost +
+		search_queue * std::log2(search_queue + 2);
+	double reached = profile.acyclic ? vertices / 4 : vertices / 2;
+	double counted_cost = k * reached * (degree + log_vertices);
+
+	QueryPlan plan;
+	plan.astar_cost = astar_cost;
+	plan.counted_cost = counted_cost;
+	EngineAlgorithm algorithm = ENGINE_ASTAR;
+	double frontier = profile.symmetric
+		? std::sqrt(vertices) * degree : vertices / 4;
+	double queue = search_queue;
+	if (!heuristic_ready) {
+		queue = std::max(queue, frontier);
+	}
+	if (counted_cost < astar_cost) {
+		algorithm = ENGINE_COUNTED;
+		queue = k * std::sqrt(reached) * degree;
+	}
+	plan.expected_queue = size_t(queue);
+	plan.engine = find_engine(algorithm, queue > large_queue
+		? QUEUE_QUATERNARY : QUEUE_BINARY);
+	return plan;
+}
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include "graph.hpp"
+#include "trace.hpp"
+
+/* A profile of the graph's shape, taken once when it is loaded, which the
+ * planner uses to choose how to answer each query (see planner.hpp).
+ *
+ * Out-degrees are counted into power of two buckets: bucket 0 holds the
+ * vertices with no outgoing edges, and bucket i > 0 those with between
+ * 2^(i-1) and 2^i - 1. The graph is symmetric if every edge has a matching
+ * edge the other way with the same weight, as in a road network of two-way
+ * streets; parallel edges must match up one for one.
+ *
+ * If the graph has been contracted (see chains.hpp) then the heuristic's
+ * Dijkstra only visits the junctions; `heuristic_vertices' is how many
+ * vertices it does visit.
+ */
+struct GraphProfile {
+	size_t num_vertices = 0;
+	size_t num_edges = 0;
+	double mean_degree = 0.0;
+	size_t max_degree = 0;
+	std::vector<size_t> degree_histogram;
+	double min_weight = 0.0;
+	double max_weight = 0.0;
+	/* The 10th, 50th and 90th percentile weights. */
+	double weight_quantiles[3] = {0.0, 0.0, 0.0};
+	bool whole_weights = true;
+	bool symmetric = true;
+	bool acyclic = true;
+	size_t heuristic_vertices = 0;
+	size_t num_chains = 0;
+	size_t chain_vertices = 0;
+	size_t tree_vertices = 0;
+};
+
+inline size_t
+degree_bucket(size_t degree)
+{
+	size_t bucket = 0;
+	while (degree > 0) {
+		degree >>= 1;
+		bucket += 1;
+	}
+	return bucket;
+}
+
+/* Kahn's algorithm: the graph is acyclic if and only if repeatedly removing
+ * the vertices with no incoming edges left removes all of them.
+ */
+inline bool
+graph_is_acyclic(Graph const &graph)
+{
+	std::vector<size_t> remaining(graph.vertices.size());
+	std::vector<size_t> ready;
+	for (size_t i = 0; i < graph.vertices.size(); ++i) {
+		remaining[i] = graph.vertices[i].incoming.size();
+		if (remaining[i] == 0) {
+			ready.push_back(i);
+		}
+	}
+	size_t removed = 0;
+	while (!ready.empty()) {
+		size_t vertex = ready.back();
+		ready.pop_back();
+		removed += 1;
+		for (auto edge_index : graph.vertices[vertex].outgoing) {
+			size_t to = graph.edges[edge_index].to;
+			if (--remaining[to] == 0) {
+				ready.push_back(to);
+			}
+		}
+	}
+	return removed == graph.vertices.size();
+}
+
+/* The graph is symmetric if every vertex's edges out go to the same
+ * neighbours with the same weights as its edges in come from. Each vertex's
+ * lists are small, so sorting them one vertex at a time is cheap, and the
+ * first vertex whose degrees differ settles it.
+ */
+inline bool
+graph_is_symmetric(Graph const &graph)
+{
+	using Key = std::pair<size_t, double>;
+	std::vector<Key> out;
+	std::vector<Key> in;
+	for (size_t v = 0; v < graph.vertices.size(); ++v) {
+		auto const &vertex = graph.vertices[v];
+		if (vertex.outgoing.size() != vertex.incoming.size()) {
+			return false;
+		}
+		out.clear();
+		in.clear();
+		for (size_t e : vertex.outgoing) {
+			out.emplace_back(graph.edges[e].to,
+				graph.edges[e].weight);
+		}
+		for (size_t e : vertex.incoming) {
+			in.emplace_back(graph.edges[e].from,
+				graph.edges[e].weight);
+		}
+		std::sort(out.begin(), out.end());
+		std::sort(in.begin(), in.end());
+		if (out != in) {
+			return false;
+		}
+	}
+	return true;
+}
+
+inline GraphProfile
+profile_graph(Graph const &graph)
+{
+	TraceScope trace("profile");
+	GraphProfile profile;
+	profile.num_vertices = graph.vertices.size();
+	profile.num_edges = graph.edges.size();
+	if (profile.num_vertices > 0) {
+		profile.mean_degree = double(profile.num_edges) /
+			profile.num_vertices;
+	}
+	for (auto const &vertex : graph.vertices) {
+		size_t degree = vertex.outgoing.size();
+		size_t bucket = degree_bucket(degree);
+		if (bucket >= profile.degree_histogram.size()) {
+			profile.degree_histogram.resize(bucket + 1, 0);
+		}
+		profile.degree_histogram[bucket] += 1;
+		profile.max_degree = std::max(profile.max_degree, degree);
+	}
+
+	std::vector<double> weights;
+	weights.reserve(graph.edges.size());
+	for (auto const &edge : graph.edges) {
+		weights.push_back(edge.weight);
+		if (edge.weight != std::floor(edge.weight)) {
+			profile.whole_weights = false;
+		}
+	}
+	if (!weights.empty()) {
+		double const fractions[3] = {0.1, 0.5, 0.9};
+		for (size_t i = 0; i < 3; ++i) {
+			auto nth = weights.begin() +
+				size_t(fractions[i] * (weights.size() - 1));
+			std::nth_element(weights.begin(), nth, weights.end());
+			profile.weight_quantiles[i] = *nth;
+		}
+		auto [min, max] = std::minmax_element(weights.begin(),
+			weights.end());
+		profile.min_weight = *min;
+		profile.max_weight = *max;
+	}
+	profile.symmetric = graph_is_symmetric(graph);
+	profile.acyclic = graph_is_acyclic(graph);
+	profile.heuristic_vertices = profile.num_vertices;
+	if (graph.chains) {
+		profile.heuristic_vertices =
+			graph.chains->junction_vertex.size();
+		profile.num_chains = graph.chains->chains.size();
+		profile.tree_vertices = graph.chains->tree_order.size();
+		profile.chain_vertices = profile.num_vertices -
+			profile.heuristic_vertices - profile.tree_vertices;
+	}
+	return profile;
+}
+
+/* e.g. "Graph profile: 11825 vertices, 28524 edges, mean out-degree 2.41
+ * (max 6), weights 0.12 to 63.5 (p10 ..., p50 ..., p90 ...), symmetric,
+ * cyclic." followed by the degree histogram, and how far the graph was
+ * contracted if it was.
+ */
+inline void
+print_graph_profile(std::ostream &out, GraphProfile const &profile)
+{
+	out << "Graph profile: " << profile.num_vertices << " vertices, ";
+	out << profile.num_edges << " edges, mean out-degree ";
+	out << profile.mean_degree << " (max " << profile.max_degree;
+	out << "), weights " << profile.min_weight << " to ";
+	out << profile.max_weight << " (p10 ";
+	out << profile.weight_quantiles[0] << ", p50 ";
+	out << profile.weight_quantiles[1] << ", p90 ";
+	out << profile.weight_quantiles[2] << ")";
+	out << (profile.whole_weights ? ", whole" : "");
+	out << (profile.symmetric ? ", symmetric" : ", asymmetric");
+	out << (profile.acyclic ? ", acyclic." : ", cyclic.") << std::endl;
+	out << "Out-degrees:";
+	for (size_t i = 0; i < profile.degree_histogram.size(); ++i) {
+		if (profile.degree_histogram[i] == 0) {
+			continue;
+		}
+		size_t low = i == 0 ? 0 : size_t(1) << (i - 1);
+		size_t high = i == 0 ? 0 : (size_t(1) << i) - 1;
+		out << " " << low;
+		if (high > low) {
+			out << "-" << high;
+		}
+		out << ": " << profile.degree_histogram[i];
+	}
+	out << std::endl;
+	if (profile.heuristic_vertices < profile.num_vertices) {
+		out << "Contraction: " << profile.tree_vertices;
+		out << " vertices in trees peeled, " << profile.num_chains;
+		out << " chains of " << profile.chain_vertices;
+		out << " vertices contracted, leaving ";
+		out << profile.heuristic_vertices << " junctions." << std::endl;
+	}
+}
+
+#endif
@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include "queue-trace.hpp"
+#include "queues.hpp"
+
+/* `queue-bench' replays the queue traces recorded by `k-short --record-queue'
+ * against each priority queue implementation, so they can be compared on
+ * exactly the work the real searches give them and nothing else.
+ *
+ * The traces are decoded up front, so that only the queue operations are
+ * timed. Every queue must pop the same priorities in the same order, which is
+ * checked by summing them.
+ */
+
+struct Operation {
+	QueueOp op;
+	uint64_t key;
+	double priority;
+};
+
+struct DecodedTrace {
+	QueueTraceKind kind;
+	size_t num_keys;
+	std::vector<Operation> operations;
+};
+
+/* Decode a trace, checking that it could have come from a real queue, so
+ * that replaying it is safe: every key is in range, a key is only inserted
+ * once and only decreased while queued, a decrease doesn't raise the
+ * priority, and nothing is popped from an empty queue.
+ */
+bool
+decode(QueueTrace const &trace, DecodedTrace &decoded)
+{
+	decoded = DecodedTrace{trace.kind, trace.num_keys, {}};
+	decoded.operations.reserve(std::min<uint64_t>(trace.num_ops,
+		trace.ops.size()));
+	enum KeyState : uint8_t { NEW, QUEUED, POPPED };
+	std::vector<KeyState> state(trace.num_keys, NEW);
+	std::vector<double> priorities(trace.num_keys, INFINITY);
+	size_t queued = 0;
+	QueueTraceReader reader(trace);
+	Operation operation{QUEUE_POP, 0, 0.0};
+	while (reader.next(operation.op, operation.key, operation.priority)) {
+		if (operation.op == QUEUE_POP) {
+			if (queued == 0) {
+				return false;
+			}
+			queued -= 1;
+		} else {
+			size_t key = operation.key;
+			double priority = operation.priority;
+			if (key >= trace.num_keys or std::isnan(priority)) {
+				return false;
+			}
+			if (operation.op == QUEUE_INSERT) {
+				if (state[key] != NEW) {
+					return false;
+				}
+				state[key] = QUEUED;
+				queued += 1;
+			} else if (state[key] != QUEUED or
+			           priority > priorities[key]) {
+				return false;
+			}
+			priorities[key] = priority;
+		}
+		decoded.operations.push_back(operation);
+	}
+	return !reader.malformed and
+		decoded.operations.size() == trace.num_ops;
+}
+
+/* An element of a lazy queue, ordered like QueueElement: the lowest
+ * priority on top.
+ */
+struct LazyElement {
+	double priority;
+	size_t key;
+	bool operator<(LazyElement const &other) const
+	{
+		return priority > other.priority;
+	}
+};
+
+/* Replay a trace against a queue without decrease-key, which pushes a fresh
+ * copy on every decrease and skips the stale copies as it pops them, the
+ * same as the searches themselves do.
+ */
+template <typename Queue>
+double
+replay_lazy(DecodedTrace const &trace)
+{
+	Queue queue;
+	std::vector<double> current(trace.num_keys, INFINITY);
+	std::vector<bool> popped(trace.num_keys, false);
+	double checksum = 0.0;
+	for (auto const &operation : trace.operations) {
+		if (operation.op != QUEUE_POP) {
+			current[operation.key] = operation.priority;
+			queue.push({operation.priority, operation.key});
+			continue;
+		}
+		for (;;) {
+			auto element = queue.top();
+			queue.pop();
+			if (popped[element.key] or
+			    element.priority != current[element.key]) {
+				continue;
+			}
+			popped[element.key] = true;
+			checksum += element.priority;
+			break;
+		}
+	}
+	return checksum;
+}
+
+template <size_t D>
+double
+replay_indexed(DecodedTrace const &trace)
+{
+	IndexedDaryHeap<D> queue(trace.num_keys);
+	double checksum = 0.0;
+	for (auto const &operation : trace.operations) {
+		switch (operation.op) {
+		case QUEUE_INSERT:
+			queue.push(operation.key, operation.priority);
+			break;
+		case QUEUE_DECREASE:
+			queue.decrease(operation.key, operation.priority);
+			break;
+		case QUEUE_POP:
+			checksum += queue.top_priority();
+			queue.pop();
+			break;
+		}
+	}
+	return checksum;
+}
+
+struct Implementation {
+	char const *name;
+	double (*replay)(DecodedTrace const &);
+};
+
+Implementation const implementations[] = {
+	{"std::priority_queue", replay_lazy<std::priority_queue<LazyElement>>},
+	{"binary heap", replay_lazy<DaryHeap<LazyElement, 2>>},
+	{"4-ary heap", replay_lazy<DaryHeap<LazyElement, 4>>},
+	{"8-ary heap", replay_lazy<DaryHeap<LazyElement, 8>>},
+	{"indexed binary heap", replay_indexed<2>},
+	{"indexed 4-ary heap", replay_indexed<4>},
+};
+
+char const *const kind_names[] = {"heuristic", "search"};
+
+int
+main(int argc, char *argv[])
+{
+	size_t repeat = 5;
+	bool bad_usage = false;
+
+	static option const long_options[] = {
+		{"repeat", required_argument, nullptr, 'n'},
+		{nullptr, 0, nullptr, 0},
+	};
+	int option;
+	while ((option = getopt_long(argc, argv, "n:", long_options,
+	                             nullptr)) != -1) {
+		switch (option) {
+		case 'n':
+			repeat = std::max<size_t>(1,
+				std::strtoull(optarg, nullptr, 10));
+			break;
+		default:
+			bad_usage = true;
+			break;
+		}
+	}
+	if (bad_usage or optind + 1 != argc) {
+		std::cerr << "Usage: " << argv[0] << " [--repeat N]";
+		std::cerr << " QUEUETRACEFILE" << std::endl;
+		return 2;
+	}
+
+	std::vector<QueueTrace> traces;
+	if (!read_queue_traces(argv[optind], traces)) {
+		std::cerr << argv[optind] << ": not a queue trace file";
+		std::cerr << std::endl;
+		return 2;
+	}
+	/* The traces of each kind, decoded. */
+	std::vector<DecodedTrace> decoded[2];
+	size_t num_ops[2] = {0, 0};
+	for (size_t i = 0; i < traces.size(); ++i) {
+		auto const &trace = traces[i];
+		DecodedTrace decoded_trace;
+		if (!decode(trace, decoded_trace)) {
+			std::cerr << argv[optind] << ": trace " << i;
+			std::cerr << " is corrupt" << std::endl;
+			return 2;
+		}
+		num_ops[trace.kind] += trace.num_ops;
+		decoded[trace.kind].push_back(std::move(decoded_trace));
+	}
+	traces.clear();
+
+	int status = 0;
+	std::cout << std::fixed << std::setprecision(2);
+	for (size_t kind = 0; kind < 2; ++kind) {
+		if (num_ops[kind] == 0) {
+			continue;
+		}
+		std::cout << "Replaying " << decoded[kind].size() << " ";
+		std::cout << kind_names[kind] << " traces (" << num_ops[kind];
+		std::cout << " operations), best of " << repeat << ":";
+		std::cout << std::endl;
+		double expected = 0.0;
+		bool first = true;
+		for (auto const &implementation : implementations) {
+			double best = INFINITY;
+			double checksum = 0.0;
+			for (size_t run = 0; run < repeat; ++run) {
+				checksum = 0.0;
+				auto start = std::chrono::steady_clock::now();
+				for (auto const &trace : decoded[kind]) {
+					checksum += implementation.replay(
+						trace);
+				}
+				auto end = std::chrono::steady_clock::now();
+				best = std::min(best,
+					std::chrono::duration<double>(
+						end - start).count());
+			}
+			std::cout << "  " << std::left << std::setw(22);
+			std::cout << implementation.name << std::right;
+			std::cout << std::setw(10) << best * 1000 << " ms";
+			std::cout << std::setw(10);
+			std::cout << best * 1e9 / num_ops[kind] << " ns/op";
+			if (first) {
+				expected = checksum;
+				first = false;
+			} else if (checksum != expected) {
+				std::cout << "  (popped different priorities!)";
+				status = 1;
+			}
+			std::cout << std::endl;
+		}
+	}
+	return status;
+}
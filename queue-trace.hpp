@@ -0,0 +1,201 @@
+#ifndef QUEUE_TRACE_HPP
+#define QUEUE_TRACE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/* A queue trace is the exact sequence of operations an algorithm performed
+ * on its priority queue, so that the queue's cost can be measured apart from
+ * the rest of the algorithm by replaying the operations against each queue
+ * implementation (see `queue-bench').
+ *
+ * Operations are recorded as an indexed priority queue would see them, with
+ * every element identified by a key: an insert of a new key, a decrease of
+ * the priority of a key already queued, and a pop of the minimum. A lazy
+ * queue like std::priority_queue implements a decrease as another insert and
+ * then has to skip the stale copies as they are popped; those skipped pops
+ * are not recorded, as they are an artifact of that kind of queue.
+ *
+ * In a file each trace is a byte saying which algorithm it came from, then
+ * the number of distinct keys, the number of operations and their size in
+ * bytes (all 64-bit), and then the operations. A pop is just its opcode; an
+ * insert or a decrease is the opcode, the key as a LEB128 variable length
+ * integer, and the priority as a double. The file starts with the magic
+ * "KSQTRC1\0" and everything is in native byte order.
+ */
+
+enum QueueOp : uint8_t {
+	QUEUE_INSERT,
+	QUEUE_DECREASE,
+	QUEUE_POP,
+};
+
+enum QueueTraceKind : uint8_t {
+	QUEUE_TRACE_HEURISTIC,
+	QUEUE_TRACE_SEARCH,
+};
+
+struct QueueTrace {
+	QueueTraceKind kind;
+	uint64_t num_keys = 0;
+	uint64_t num_ops = 0;
+	std::vector<uint8_t> ops;
+
+	void insert(uint64_t key, double priority)
+	{
+		record(QUEUE_INSERT, key, priority);
+	}
+	void decrease(uint64_t key, double priority)
+	{
+		record(QUEUE_DECREASE, key, priority);
+	}
+	void pop()
+	{
+		ops.push_back(QUEUE_POP);
+		num_ops += 1;
+	}
+private:
+	void record(QueueOp op, uint64_t key, double priority)
+	{
+		ops.push_back(op);
+		do {
+			uint8_t byte = key & 0x7f;
+			key >>= 7;
+			ops.push_back(byte | (key ? 0x80 : 0));
+		} while (key);
+		uint8_t bytes[sizeof(priority)];
+		std::memcpy(bytes, &priority, sizeof(priority));
+		ops.insert(ops.end(), bytes, bytes + sizeof(priority));
+		num_ops += 1;
+	}
+};
+
+/* Walks through the operations of a trace, one at a time. An operation cut
+ * short, or with an opcode or key that can't be right, ends the walk early
+ * with `malformed' set.
+ */
+struct QueueTraceReader {
+	QueueTraceReader(QueueTrace const &trace) :
+		position{trace.ops.data()},
+		end{trace.ops.data() + trace.ops.size()}
+	{}
+
+	bool next(QueueOp &op, uint64_t &key, double &priority)
+	{
+		if (position == end) {
+			return false;
+		}
+		op = QueueOp(*position++);
+		if (op == QUEUE_POP) {
+			return true;
+		}
+		if (op != QUEUE_INSERT and op != QUEUE_DECREASE) {
+			return fail();
+		}
+		key = 0;
+		for (int shift = 0; ; shift += 7) {
+			if (position == end or shift >= 64) {
+				return fail();
+			}
+			uint8_t byte = *position++;
+			key |= uint64_t(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) {
+				break;
+			}
+		}
+		if (size_t(end - position) < sizeof(priority)) {
+			return fail();
+		}
+		std::memcpy(&priority, position, sizeof(priority));
+		position += sizeof(priority);
+		return true;
+	}
+
+	bool malformed = false;
+private:
+	bool fail()
+	{
+		malformed = true;
+		position = end;
+		return false;
+	}
+
+	uint8_t const *position;
+	uint8_t const *end;
+};
+
+char const queue_trace_magic[8] = {'K', 'S', 'Q', 'T', 'R', 'C', '1', '\0'};
+
+/* Traces are appended to an open file as each query finishes. */
+struct QueueTraceWriter {
+	bool open(std::string const &filename)
+	{
+		file.open(filename, std::ios::binary);
+		file.write(queue_trace_magic, sizeof(queue_trace_magic));
+		return bool(file);
+	}
+
+	void write(QueueTrace const &trace)
+	{
+		file.put(trace.kind);
+		file.write((char const *) &trace.num_keys,
+			sizeof(trace.num_keys));
+		file.write((char const *) &trace.num_ops,
+			sizeof(trace.num_ops));
+		uint64_t size = trace.ops.size();
+		file.write((char const *) &size, sizeof(size));
+		file.write((char const *) trace.ops.data(), size);
+	}
+private:
+	std::ofstream file;
+};
+
+uint64_t const max_queue_keys = uint64_t(1) << 40;
+
+inline bool
+read_queue_traces(std::string const &filename,
+	std::vector<QueueTrace> &traces)
+{
+	std::ifstream file(filename, std::ios::binary | std::ios::ate);
+	uint64_t file_size = file.tellg();
+	file.seekg(0);
+	char magic[sizeof(queue_trace_magic)];
+	file.read(magic, sizeof(magic));
+	if (!file or std::memcmp(magic, queue_trace_magic,
+	                         sizeof(magic)) != 0) {
+		return false;
+	}
+	int kind;
+	while ((kind = file.get()) != EOF) {
+		QueueTrace trace;
+		uint64_t size;
+		if (kind > QUEUE_TRACE_SEARCH) {
+			return false;
+		}
+		trace.kind = QueueTraceKind(kind);
+		file.read((char *) &trace.num_keys, sizeof(trace.num_keys));
+		file.read((char *) &trace.num_ops, sizeof(trace.num_ops));
+		file.read((char *) &size, sizeof(size));
+		/* Every operation takes at least a byte, and the operations
+		 * can't be more than the rest of the file. Queues are indexed
+		 * by key, so far more keys than any graph could have vertices
+		 * is taken to be corruption too.
+		 */
+		if (!file or size > file_size - uint64_t(file.tellg()) or
+		    trace.num_ops > size or trace.num_keys > max_queue_keys) {
+			return false;
+		}
+		trace.ops.resize(size);
+		file.read((char *) trace.ops.data(), size);
+		if (!file) {
+			return false;
+		}
+		traces.push_back(std::move(trace));
+	}
+	return true;
+}
+
+#endif
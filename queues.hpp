@@ -0,0 +1,201 @@
+#ifndef QUEUES_HPP
+#define QUEUES_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/* Priority queues which can stand in for std::priority_queue.
+ *
+ * `DaryHeap' is an implicit heap in a vector where every node has `D'
+ * children rather than two. A wider node makes the heap shallower, so a push
+ * does fewer comparisons and swaps on its way up, at the price of comparing
+ * more children on the way down; with `D' = 4 the children of a node also
+ * share a cache line. It has the same interface, and the same ordering (the
+ * "largest" element by `operator<' is on top), as std::priority_queue.
+ */
+template <typename T, size_t D>
+struct DaryHeap {
+	void push(T const &element)
+	{
+		heap.push_back(element);
+		sift_up(heap.size() - 1);
+	}
+	T const &top() const
+	{
+		return heap.front();
+	}
+	void pop()
+	{
+		heap.front() = heap.back();
+		heap.pop_back();
+		if (!heap.empty()) {
+			sift_down(0);
+		}
+	}
+	bool empty() const
+	{
+		return heap.empty();
+	}
+	size_t size() const
+	{
+		return heap.size();
+	}
+	void clear()
+	{
+		heap.clear();
+	}
+	/* The elements in heap order, so they can be saved and restored. */
+	std::vector<T> &elements()
+	{
+		return heap;
+	}
+private:
+	std::vector<T> heap;
+
+	/* Rather than swapping at every level, the element being moved is
+	 * held on to and the others are shifted past it.
+	 */
+	void sift_up(size_t index)
+	{
+		T element = heap[index];
+		while (index > 0) {
+			size_t parent = (index - 1) / D;
+			if (!(heap[parent] < element)) {
+				break;
+			}
+			heap[index] = heap[parent];
+			index = parent;
+		}
+		heap[index] = element;
+	}
+	void sift_down(size_t index)
+	{
+		T element = heap[index];
+		size_t const size = heap.size();
+		for (;;) {
+			size_t first = index * D + 1;
+			if (first >= size) {
+				break;
+			}
+			size_t last = std::min(first + D, size);
+			size_t best = first;
+			for (size_t child = first + 1; child < last; ++child) {
+				if (heap[best] < heap[child]) {
+					best = child;
+				}
+			}
+			if (!(element < heap[best])) {
+				break;
+			}
+			heap[index] = heap[best];
+			index = best;
+		}
+		heap[index] = element;
+	}
+};
+
+/* An indexed min-heap of keys 0 to `num_keys' - 1, each with a priority,
+ * which supports decreasing the priority of a key already in the heap. It is
+ * the `Queue' from custom-queue.cpp, generalised to `D' children per node,
+ * with the position of every key kept in an array of its own rather than in
+ * the graph's vertices.
+ */
+template <size_t D>
+struct IndexedDaryHeap {
+	static constexpr size_t absent = SIZE_MAX;
+
+	IndexedDaryHeap(size_t num_keys) :
+		positions(num_keys, absent)
+	{}
+
+	bool contains(size_t key) const
+	{
+		return positions[key] != absent;
+	}
+	void push(size_t key, double priority)
+	{
+		heap.push_back({priority, key});
+		positions[key] = heap.size() - 1;
+		sift_up(heap.size() - 1);
+	}
+	void decrease(size_t key, double priority)
+	{
+		size_t index = positions[key];
+		heap[index].first = priority;
+		sift_up(index);
+	}
+	double top_priority() const
+	{
+		return heap.front().first;
+	}
+	size_t pop()
+	{
+		size_t key = heap.front().second;
+		positions[key] = absent;
+		heap.front() = heap.back();
+		heap.pop_back();
+		if (!heap.empty()) {
+			positions[heap.front().second] = 0;
+			sift_down(0);
+		}
+		return key;
+	}
+	bool empty() const
+	{
+		return heap.empty();
+	}
+	size_t size() const
+	{
+		return heap.size();
+	}
+private:
+	std::vector<std::pair<double, size_t>> heap;
+	std::vector<size_t> positions;
+
+	void place(size_t index, std::pair<double, size_t> const &entry)
+	{
+		heap[index] = entry;
+		positions[entry.second] = index;
+	}
+	void sift_up(size_t index)
+	{
+		auto entry = heap[index];
+		while (index > 0) {
+			size_t parent = (index - 1) / D;
+			if (!(entry.first < heap[parent].first)) {
+				break;
+			}
+			place(index, heap[parent]);
+			index = parent;
+		}
+		place(index, entry);
+	}
+	void sift_down(size_t index)
+	{
+		auto entry = heap[index];
+		size_t const size = heap.size();
+		for (;;) {
+			size_t first = index * D + 1;
+			if (first >= size) {
+				break;
+			}
+			size_t last = std::min(first + D, size);
+			size_t best = first;
+			for (size_t child = first + 1; child < last; ++child) {
+				if (heap[child].first < heap[best].first) {
+					best = child;
+				}
+			}
+			if (!(heap[best].first < entry.first)) {
+				break;
+			}
+			place(index, heap[best]);
+			index = best;
+		}
+		place(index, entry);
+	}
+};
+
+#endif
@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <numeric>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "graph.hpp"
+#include "heatmap.hpp"
+#include "search.hpp"
+#include "snapshot.hpp"
+
+/* `k-reorder' renumbers the vertices of a graph so that the ones the
+ * searches spend their time in are close together in memory, and writes the
+ * result as a snapshot which `k-short' loads as it would the original: the
+ * original ids are kept in the snapshot, and queries and answers still use
+ * them.
+ *
+ * How hot each vertex is comes either from a heat-map recorded by `k-short
+ * --heatmap' on the same graph file, or from a log of queries, which are
+ * answered here with the heat-map on. Every vertex the searches touched is
+ * laid out in breadth-first order from the hottest one not yet laid out, so
+ * each hot region and the neighbours its searches push end up on the same
+ * pages, hottest region first. The untouched vertices follow in their
+ * original order. Edges are sorted by their new `from' vertex, so those
+ * expanded together are stored together too.
+ */
+
+/* How many pages of the vertex array the vertices which account for
+ * `fraction' of the expansions are spread over, with each vertex placed at
+ * `position[vertex]'.
+ */
+size_t
+pages_for_expansions(std::vector<uint64_t> const &pops,
+	std::vector<size_t> const &position, double fraction)
+{
+	size_t const page_size = 4096;
+	std::vector<size_t> order(pops.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return pops[a] > pops[b];
+	});
+	uint64_t total = std::accumulate(pops.begin(), pops.end(),
+		uint64_t(0));
+	uint64_t covered = 0;
+	std::set<size_t> pages;
+	for (auto vertex : order) {
+		if (covered >= fraction * total or pops[vertex] == 0) {
+			break;
+		}
+		covered += pops[vertex];
+		pages.insert(position[vertex] * sizeof(Vertex) / page_size);
+	}
+	return pages.size();
+}
+
+/* Answer each query in the log (one "SOURCE DESTINATION K" per line, with
+ * anything after that, such as a timestamp, ignored) counting expansions
+ * into the heat-map.
+ */
+bool
+heatmap_from_queries(Graph const &graph, std::istream &log, Heatmap &heatmap)
+{
+	Workspace workspace;
+	workspace.heatmap.pops.assign(graph.vertices.size(), 0);
+	workspace.heatmap.pushes.assign(graph.vertices.size(), 0);
+	std::string line;
+	while (std::getline(log, line)) {
+		if (line.empty() or line[0] == '#') {
+			continue;
+		}
+		std::istringstream fields(line);
+		Query query;
+		if (!(fields >> query.source >> query.destination >> query.k)) {
+			return false;
+		}
+		if (!translate_query(graph, query) or
+		    !query_is_valid(graph, query)) {
+			continue;
+		}
+		if (workspace.destination != query.destination) {
+			calculate_heuristic(graph, workspace,
+				query.destination);
+		}
+		search(graph, workspace, query.source, query.destination,
+			query.k);
+	}
+	heatmap = std::move(workspace.heatmap);
+	return true;
+}
+
+/* The new order of the vertices: `order[i]' is the vertex which goes i-th. */
+std::vector<size_t>
+hot_region_order(Graph const &graph, Heatmap const &heatmap, size_t &touched,
+	size_t &regions)
+{
+	size_t const num_vertices = graph.vertices.size();
+	auto const &pops = heatmap.pops;
+	auto const &pushes = heatmap.pushes;
+	auto is_touched = [&](size_t vertex) {
+		return pops[vertex] > 0 or pushes[vertex] > 0;
+	};
+	std::vector<size_t> seeds;
+	for (size_t i = 0; i < num_vertices; ++i) {
+		if (is_touched(i)) {
+			seeds.push_back(i);
+		}
+	}
+	std::stable_sort(seeds.begin(), seeds.end(), [&](size_t a, size_t b) {
+		return pops[a] != pops[b] ? pops[a] > pops[b]
+			: pushes[a] > pushes[b];
+	});
+	touched = seeds.size();
+	regions = 0;
+
+	std::vector<size_t> order;
+	order.reserve(num_vertices);
+	std::vector<bool> placed(num_vertices, false);
+	std::deque<size_t> frontier;
+	auto place = [&](size_t vertex) {
+		placed[vertex] = true;
+		order.push_back(vertex);
+		frontier.push_back(vertex);
+	};
+	for (auto seed : seeds) {
+		if (placed[seed]) {
+			continue;
+		}
+		regions += 1;
+		place(seed);
+		while (!frontier.empty()) {
+			size_t vertex = frontier.front();
+			frontier.pop_front();
+			auto const &edges = graph.edges;
+			for (auto edge_index : graph.vertices[vertex].outgoing) {
+				size_t to = edges[edge_index].to;
+				if (!placed[to] and is_touched(to)) {
+					place(to);
+				}
+			}
+			for (auto edge_index : graph.vertices[vertex].incoming) {
+				size_t from = edges[edge_index].from;
+				if (!placed[from] and is_touched(from)) {
+					place(from);
+				}
+			}
+		}
+	}
+	for (size_t i = 0; i < num_vertices; ++i) {
+		if (!placed[i]) {
+			order.push_back(i);
+		}
+	}
+	return order;
+}
+
+int
+main(int argc, char *argv[])
+{
+	std::string heatmap_filename;
+	std::string queries_filename;
+	bool bad_usage = false;
+
+	static option const long_options[] = {
+		{"heatmap", required_argument, nullptr, 'H'},
+		{"queries", required_argument, nullptr, 'q'},
+		{nullptr, 0, nullptr, 0},
+	};
+	int option;
+	while ((option = getopt_long(argc, argv, "H:q:", long_options,
+	                             nullptr)) != -1) {
+		switch (option) {
+		case 'H':
+			heatmap_filename = optarg;
+			break;
+		case 'q':
+			queries_filename = optarg;
+			break;
+		default:
+			bad_usage = true;
+			break;
+		}
+	}
+	if (bad_usage or optind + 2 != argc or
+	    heatmap_filename.empty() == queries_filename.empty()) {
+		std::cerr << "Usage: " << argv[0] << " (--heatmap HEATMAPFILE";
+		std::cerr << " | --queries QUERYLOG) GRAPHFILE SNAPSHOTFILE";
+		std::cerr << std::endl;
+		return 2;
+	}
+
+	std::ifstream graph_file(argv[optind], std::ios::binary);
+	Graph graph;
+	if (!graph_file or !read_graph(graph_file, graph)) {
+		std::cerr << argv[optind] << ": could not read graph";
+		std::cerr << std::endl;
+		return 2;
+	}
+	Heatmap heatmap;
+	if (!heatmap_filename.empty()) {
+		if (!read_heatmap(heatmap_filename, heatmap) or
+		    heatmap.pops.size() != graph.vertices.size()) {
+			std::cerr << heatmap_filename << ": not a heat-map";
+			std::cerr << " of this graph" << std::endl;
+			return 2;
+		}
+	} else {
+		std::ifstream log(queries_filename);
+		if (!log or !heatmap_from_queries(graph, log, heatmap)) {
+			std::cerr << queries_filename << ": could not read";
+			std::cerr << " queries" << std::endl;
+			return 2;
+		}
+	}
+
+	size_t touched, regions;
+	auto order = hot_region_order(graph, heatmap, touched, regions);
+	Graph reordered = renumber(graph, order);
+	if (!write_snapshot(argv[optind + 1], reordered)) {
+		std::cerr << argv[optind + 1] << ": could not write snapshot";
+		std::cerr << std::endl;
+		return 2;
+	}
+
+	std::vector<size_t> before(order.size());
+	std::vector<size_t> after(order.size());
+	for (size_t i = 0; i < order.size(); ++i) {
+		before[i] = i;
+		after[order[i]] = i;
+	}
+	std::cout << "Reordered " << order.size() << " vertices: ";
+	std::cout << touched << " touched by the searches, in " << regions;
+	std::cout << " regions." << std::endl;
+	std::cout << "90% of expansions were on ";
+	std::cout << pages_for_expansions(heatmap.pops, before, 0.9);
+	std::cout << " pages of vertices, now on ";
+	std::cout << pages_for_expansions(heatmap.pops, after, 0.9);
+	std::cout << "." << std::endl;
+	return 0;
+}
@@ -0,0 +1,560 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fcntl.h>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "chains.hpp"
+#include "engines.hpp"
+#include "graph.hpp"
+#include "latency-histogram.hpp"
+#include "planner.hpp"
+#include "profile.hpp"
+#include "search.hpp"
+#include "snapshot.hpp"
+
+/* `k-replay' is a load tester. It replays a log of queries, each with the
+ * time it was made, at the recorded rate or a multiple of it, and reports
+ * the throughput achieved and the latency of the queries.
+ *
+ * The load is open-loop: every query is sent at its scheduled time whether
+ * or not the earlier ones have been answered, and its latency is measured
+ * from that scheduled time. A system which falls behind is charged for the
+ * time the queries spend waiting, as it would be by real users.
+ *
+ * In batch mode (the default) the queries are answered in this process by
+ * `--concurrency' threads, each with a workspace of its own, the same way
+ * `k-short' answers a batch. In server mode `--concurrency' copies of
+ * `k-short --server' are started, and each query is sent to whichever has
+ * the fewest queries outstanding.
+ *
+ * With `--schedule' the servers are run with their scheduler (see
+ * scheduler.hpp), and answer the queries in whatever order it chooses,
+ * each answer numbered with its query's line. The latency of the short
+ * queries, those with `k' no more than `--short-k', is reported separately
+ * as well, since keeping that flat is what the scheduler is for.
+ *
+ * A query which takes more than `--timeout' seconds is counted as timed out
+ * rather than completed; in server mode any still unanswered that long
+ * after the last one was sent are abandoned.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+/* A query log has one query per line: "SOURCE DESTINATION K TIMESTAMP", with
+ * the timestamp in seconds from any origin. Blank lines and lines starting
+ * with `#' are skipped.
+ */
+struct LoggedQuery {
+	Query query;
+	double time;
+};
+
+bool
+read_query_log(std::istream &in, std::vector<LoggedQuery> &log)
+{
+	std::string line;
+	size_t line_number = 0;
+	while (std::getline(in, line)) {
+		line_number += 1;
+		if (line.empty() or line[0] == '#') {
+			continue;
+		}
+		std::istringstream fields(line);
+		LoggedQuery logged;
+		if (!(fields >> logged.query.source >>
+		      logged.query.destination >> logged.query.k >>
+		      logged.time)) {
+			std::cerr << "line " << line_number << ": expected";
+			std::cerr << " SOURCE DESTINATION K TIMESTAMP";
+			std::cerr << std::endl;
+			return false;
+		}
+		log.push_back(logged);
+	}
+	/* Replay them in the order they were made, from time 0. */
+	std::stable_sort(log.begin(), log.end(),
+		[](LoggedQuery const &a, LoggedQuery const &b) {
+			return a.time < b.time;
+		});
+	if (!log.empty()) {
+		double origin = log.front().time;
+		for (auto &logged : log) {
+			logged.time -= origin;
+		}
+	}
+	return true;
+}
+
+/* What a worker (a thread in batch mode, a server in server mode) saw. Each
+ * is only written by one thread, and they are merged at the end.
+ */
+struct ReplayStats {
+	LatencyHistogram latency;
+	LatencyHistogram short_latency;
+	size_t completed = 0;
+	size_t timeouts = 0;
+	size_t errors = 0;
+};
+
+struct ReplaySettings {
+	size_t concurrency = 1;
+	/* Zero sends every query at once. */
+	double rate = 1.0;
+	double timeout = 10.0;
+	bool schedule = false;
+	size_t short_k = 1;
+};
+
+/* When a query should be sent: its logged time scaled by the rate. */
+Clock::time_point
+scheduled_time(Clock::time_point start, ReplaySettings const &settings,
+	LoggedQuery const &logged)
+{
+	if (settings.rate <= 0.0) {
+		return start;
+	}
+	return start + std::chrono::duration_cast<Clock::duration>(
+		std::chrono::duration<double>(logged.time / settings.rate));
+}
+
+void
+record_answer(ReplayStats &stats, ReplaySettings const &settings,
+	Query const &query, Clock::time_point scheduled,
+	Clock::time_point answered)
+{
+	auto latency = answered - scheduled;
+	auto nanoseconds = std::chrono::duration_cast<
+		std::chrono::nanoseconds>(latency).count();
+	stats.latency.record(nanoseconds);
+	if (query.k <= settings.short_k) {
+		stats.short_latency.record(nanoseconds);
+	}
+	if (std::chrono::duration<double>(latency).count() >
+	    settings.timeout) {
+		stats.timeouts += 1;
+	} else {
+		stats.completed += 1;
+	}
+}
+
+/* Batch mode: the scheduler hands queries to the threads through a queue. */
+void
+replay_batch(Graph const &graph, std::vector<LoggedQuery> const &log,
+	ReplaySettings const &settings, std::vector<ReplayStats> &stats)
+{
+	GraphProfile profile = profile_graph(graph);
+	std::mutex mutex;
+	std::condition_variable ready;
+	std::deque<std::pair<size_t, Clock::time_point>> pending;
+	bool finished = false;
+
+	auto work = [&](ReplayStats &stats) {
+		Workspace workspace;
+		for (;;) {
+			std::unique_lock<std::mutex> lock(mutex);
+			ready.wait(lock, [&] {
+				return finished or !pending.empty();
+			});
+			if (pending.empty()) {
+				return;
+			}
+			auto [index, scheduled] = pending.front();
+			pending.pop_front();
+			lock.unlock();
+			Query query = log[index].query;
+			if (!translate_query(graph, query) or
+			    !query_is_valid(graph, query)) {
+				stats.errors += 1;
+				continue;
+			}
+			bool heuristic_ready =
+				workspace.destination == query.destination;
+			auto plan = plan_query(profile, heuristic_ready, query,
+				1);
+			run_engine(*plan.engine, graph, workspace, query);
+			record_answer(stats, settings, query, scheduled,
+				Clock::now());
+		}
+	};
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < settings.concurrency; ++i) {
+		threads.emplace_back(work, std::ref(stats[i]));
+	}
+	auto start = Clock::now();
+	for (size_t i = 0; i < log.size(); ++i) {
+		auto scheduled = scheduled_time(start, settings, log[i]);
+		std::this_thread::sleep_until(scheduled);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pending.emplace_back(i, scheduled);
+		}
+		ready.notify_one();
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		finished = true;
+	}
+	ready.notify_all();
+	for (auto &thread : threads) {
+		thread.join();
+	}
+}
+
+/* A running `k-short --server', with its unanswered queries by the number
+ * of the line they were sent on, and the times they were scheduled for.
+ * Without the scheduler it answers them in order, so the first is the one
+ * answered next.
+ */
+struct OutstandingQuery {
+	Query query;
+	Clock::time_point scheduled;
+};
+
+struct ServerProcess {
+	pid_t pid = -1;
+	int to_server = -1;
+	FILE *from_server = nullptr;
+	std::mutex mutex;
+	std::condition_variable answered;
+	std::map<uint64_t, OutstandingQuery> outstanding;
+	uint64_t lines_sent = 0;
+};
+
+bool
+start_server(ServerProcess &server, std::string const &program,
+	std::string const &graph_filename, bool schedule)
+{
+	int to_child[2];
+	int from_child[2];
+	if (pipe(to_child) != 0) {
+		return false;
+	}
+	if (pipe(from_child) != 0) {
+		close(to_child[0]);
+		close(to_child[1]);
+		return false;
+	}
+	server.pid = fork();
+	if (server.pid == 0) {
+		/* The server's statistics go to standard error, which
+		 * isn't wanted here.
+		 */
+		int null = open("/dev/null", O_WRONLY);
+		dup2(to_child[0], STDIN_FILENO);
+		dup2(from_child[1], STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		close(to_child[0]);
+		close(to_child[1]);
+		close(from_child[0]);
+		close(from_child[1]);
+		if (schedule) {
+			execl(program.c_str(), program.c_str(), "--server",
+				"--schedule", "--report-interval", "1e9",
+				graph_filename.c_str(), (char *) nullptr);
+		} else {
+			execl(program.c_str(), program.c_str(), "--server",
+				"--report-interval", "1e9",
+				graph_filename.c_str(), (char *) nullptr);
+		}
+		_exit(127);
+	}
+	close(to_child[0]);
+	close(from_child[1]);
+	if (server.pid < 0) {
+		close(to_child[1]);
+		close(from_child[0]);
+		return false;
+	}
+	server.to_server = to_child[1];
+	server.from_server = fdopen(from_child[0], "r");
+	return true;
+}
+
+bool
+send_line(int fd, std::string const &line)
+{
+	size_t written = 0;
+	while (written < line.size()) {
+		ssize_t n = write(fd, line.data() + written,
+			line.size() - written);
+		if (n <= 0) {
+			return false;
+		}
+		written += n;
+	}
+	return true;
+}
+
+bool
+read_line(FILE *file, std::string &line)
+{
+	line.clear();
+	int c;
+	while ((c = std::fgetc(file)) != EOF and c != '\n') {
+		line.push_back(char(c));
+	}
+	return c != EOF or !line.empty();
+}
+
+/* Server mode. Before the clock starts each server is sent a blank line, and
+ * its answer (an error) shows that it has loaded the graph.
+ */
+bool
+replay_server(std::string const &program, std::string const &graph_filename,
+	std::vector<LoggedQuery> const &log, ReplaySettings const &settings,
+	std::vector<ReplayStats> &stats)
+{
+	std::signal(SIGPIPE, SIG_IGN);
+	std::vector<std::unique_ptr<ServerProcess>> servers;
+	std::string line;
+	for (size_t i = 0; i < settings.concurrency; ++i) {
+		servers.push_back(std::make_unique<ServerProcess>());
+		auto &server = *servers.back();
+		if (!start_server(server, program, graph_filename,
+		                  settings.schedule) or
+		    !send_line(server.to_server, "\n") or
+		    !read_line(server.from_server, line)) {
+			std::cerr << "could not start " << program;
+			std::cerr << std::endl;
+			return false;
+		}
+		server.lines_sent = 1;
+	}
+
+	auto receive = [&](ServerProcess &server, ReplayStats &stats) {
+		std::string line;
+		while (read_line(server.from_server, line)) {
+			auto now = Clock::now();
+			std::lock_guard<std::mutex> lock(server.mutex);
+			auto found = server.outstanding.begin();
+			if (settings.schedule) {
+				char *end;
+				uint64_t number = std::strtoull(line.c_str(),
+					&end, 10);
+				found = server.outstanding.find(number);
+				line.erase(0, std::min(line.size(),
+					size_t(end - line.c_str()) + 2));
+			}
+			if (found == server.outstanding.end()) {
+				continue;
+			}
+			auto answered = found->second;
+			server.outstanding.erase(found);
+			if (line.compare(0, 6, "error:") == 0) {
+				stats.errors += 1;
+			} else {
+				record_answer(stats, settings, answered.query,
+					answered.scheduled, now);
+			}
+			server.answered.notify_all();
+		}
+	};
+	std::vector<std::thread> readers;
+	for (size_t i = 0; i < servers.size(); ++i) {
+		readers.emplace_back(receive, std::ref(*servers[i]),
+			std::ref(stats[i]));
+	}
+
+	auto start = Clock::now();
+	auto last_scheduled = start;
+	for (auto const &logged : log) {
+		auto scheduled = scheduled_time(start, settings, logged);
+		std::this_thread::sleep_until(scheduled);
+		last_scheduled = scheduled;
+		ServerProcess *least_busy = nullptr;
+		size_t fewest = SIZE_MAX;
+		for (auto &server : servers) {
+			std::lock_guard<std::mutex> lock(server->mutex);
+			if (server->outstanding.size() < fewest) {
+				fewest = server->outstanding.size();
+				least_busy = server.get();
+			}
+		}
+		std::ostringstream request;
+		request << logged.query.source << " ";
+		request << logged.query.destination << " ";
+		request << logged.query.k << "\n";
+		{
+			std::lock_guard<std::mutex> lock(least_busy->mutex);
+			least_busy->lines_sent += 1;
+			least_busy->outstanding.emplace(least_busy->lines_sent,
+				OutstandingQuery{logged.query, scheduled});
+		}
+		/* Not under the lock: the write blocks while the server's
+		 * input is full, and the server only reads more once its
+		 * answers have been read, which takes the lock.
+		 */
+		send_line(least_busy->to_server, request.str());
+	}
+
+	/* Wait for the stragglers, then shut the servers down: closing their
+	 * input makes them exit, and any still busy are killed.
+	 */
+	auto deadline = last_scheduled +
+		std::chrono::duration_cast<Clock::duration>(
+			std::chrono::duration<double>(settings.timeout));
+	for (size_t i = 0; i < servers.size(); ++i) {
+		auto &server = *servers[i];
+		std::unique_lock<std::mutex> lock(server.mutex);
+		server.answered.wait_until(lock, deadline, [&] {
+			return server.outstanding.empty();
+		});
+		stats[i].timeouts += server.outstanding.size();
+		server.outstanding.clear();
+		close(server.to_server);
+		if (Clock::now() >= deadline) {
+			kill(server.pid, SIGKILL);
+		}
+	}
+	for (size_t i = 0; i < servers.size(); ++i) {
+		readers[i].join();
+		std::fclose(servers[i]->from_server);
+		waitpid(servers[i]->pid, nullptr, 0);
+	}
+	return true;
+}
+
+int
+main(int argc, char *argv[])
+{
+	ReplaySettings settings;
+	std::string server_program;
+	bool bad_usage = false;
+
+	static option const long_options[] = {
+		{"server", required_argument, nullptr, 's'},
+		{"concurrency", required_argument, nullptr, 'c'},
+		{"rate", required_argument, nullptr, 'r'},
+		{"timeout", required_argument, nullptr, 't'},
+		{"schedule", no_argument, nullptr, 'S'},
+		{"short-k", required_argument, nullptr, 'k'},
+		{nullptr, 0, nullptr, 0},
+	};
+	int option;
+	while ((option = getopt_long(argc, argv, "s:c:r:t:Sk:", long_options,
+	                             nullptr)) != -1) {
+		switch (option) {
+		case 's':
+			server_program = optarg;
+			break;
+		case 'c':
+			settings.concurrency = std::max<size_t>(1,
+				std::strtoull(optarg, nullptr, 10));
+			break;
+		case 'r':
+			settings.rate = std::atof(optarg);
+			break;
+		case 't':
+			settings.timeout = std::atof(optarg);
+			break;
+		case 'S':
+			settings.schedule = true;
+			break;
+		case 'k':
+			settings.short_k = std::strtoull(optarg, nullptr, 10);
+			break;
+		default:
+			bad_usage = true;
+			break;
+		}
+	}
+	if (bad_usage or optind + 2 != argc or
+	    (settings.schedule and server_program.empty())) {
+		std::cerr << "Usage: " << argv[0] << " [--server K_SHORT";
+		std::cerr << " [--schedule]] [--concurrency N]";
+		std::cerr << " [--rate MULTIPLIER] [--timeout SECONDS]";
+		std::cerr << " [--short-k K] GRAPHFILE QUERYLOG";
+		std::cerr << std::endl;
+		return 2;
+	}
+	std::string graph_filename = argv[optind];
+	std::ifstream log_file(argv[optind + 1]);
+	if (!log_file) {
+		std::cerr << "could not open query log" << std::endl;
+		return 2;
+	}
+	std::vector<LoggedQuery> log;
+	if (!read_query_log(log_file, log)) {
+		return 2;
+	}
+
+	std::vector<ReplayStats> stats(settings.concurrency);
+	auto start = Clock::now();
+	if (server_program.empty()) {
+		std::ifstream graph_file(graph_filename, std::ios::binary);
+		if (!graph_file) {
+			std::cerr << "could not open input file" << std::endl;
+			return 2;
+		}
+		Graph graph;
+		if (!read_graph(graph_file, graph)) {
+			std::cerr << "could not read graph" << std::endl;
+			return 2;
+		}
+		/* Loaded as `k-short' loads it, contracted. */
+		graph.chains = contract_chains(graph);
+		start = Clock::now();
+		replay_batch(graph, log, settings, stats);
+	} else if (!replay_server(server_program, graph_filename, log,
+	                          settings, stats)) {
+		return 2;
+	}
+	std::chrono::duration<double> elapsed = Clock::now() - start;
+
+	ReplayStats total;
+	for (auto const &worker : stats) {
+		total.latency.merge(worker.latency);
+		total.short_latency.merge(worker.short_latency);
+		total.completed += worker.completed;
+		total.timeouts += worker.timeouts;
+		total.errors += worker.errors;
+	}
+	double span = log.empty() ? 0.0 : log.back().time;
+	std::cout << "Replayed " << log.size() << " queries in ";
+	std::cout << elapsed.count() << " s with " << settings.concurrency;
+	std::cout << (server_program.empty() ? " thread" : " server");
+	std::cout << (settings.concurrency == 1 ? "" : "s");
+	if (settings.rate > 0.0 and span > 0.0) {
+		std::cout << ", offered " << log.size() * settings.rate / span;
+		std::cout << " queries/s";
+	}
+	std::cout << ", achieved " << total.completed / elapsed.count();
+	std::cout << " queries/s." << std::endl;
+	auto print_latency = [](LatencyHistogram const &latency) {
+		std::cout << latency.count() << " answers, p50 ";
+		std::cout << latency.value_at_percentile(50) / 1e6;
+		std::cout << " ms, p90 ";
+		std::cout << latency.value_at_percentile(90) / 1e6;
+		std::cout << " ms, p99 ";
+		std::cout << latency.value_at_percentile(99) / 1e6;
+		std::cout << " ms, p99.9 ";
+		std::cout << latency.value_at_percentile(99.9) / 1e6;
+		std::cout << " ms, max " << latency.maximum() / 1e6;
+		std::cout << " ms." << std::endl;
+	};
+	std::cout << "Latency: ";
+	print_latency(total.latency);
+	std::cout << "Short query (k <= " << settings.short_k;
+	std::cout << ") latency: ";
+	print_latency(total.short_latency);
+	std::cout << "Timeouts (over " << settings.timeout << " s): ";
+	std::cout << total.timeouts << ". Errors: " << total.errors << ".";
+	std::cout << std::endl;
+	return total.timeouts > 0 or total.errors > 0 ? 1 : 0;
+}
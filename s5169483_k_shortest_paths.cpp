@@ -1,196 +1,870 @@
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
 #include <fstream>
+#include <getopt.h>
+#include <iomanip>
 #include <iostream>
-#include <queue>
-#include <set>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 
-struct Vertex;
+#include "chains.hpp"
+#include "checkpoint.hpp"
+#include "engines.hpp"
+#include "graph-formats.hpp"
+#include "graph-store.hpp"
+#include "graph.hpp"
+#include "heatmap.hpp"
+#include "latency-histogram.hpp"
+#include "memory-usage.hpp"
+#include "perf-counters.hpp"
+#include "pipeline.hpp"
+#include "planner.hpp"
+#include "profile.hpp"
+#include "queue-trace.hpp"
+#include "search.hpp"
+#include "snapshot.hpp"
+#include "scheduler.hpp"
+#include "sparse-ids.hpp"
+#include "trace.hpp"
 
-/* Edges keep a record of both from which vertex they are emanating
- * and to which vertex they are going. This allows us to easily follow
- * edges backwards.
+/* Print the path lengths as a comma separated list on one line. */
+void
+write_path_lengths(std::ostream &out, std::vector<double> const &path_lengths)
+{
+	TraceScope trace("output");
+	for (size_t i = 0; i < path_lengths.size(); ++i) {
+		if (i > 0) {
+			out << ", ";
+		}
+		out << path_lengths[i];
+	}
+	out << std::endl;
+}
+
+/* Print each path on its own line: its length, to full precision, followed
+ * by the (original ids of the) vertices along it. This is the format
+ * `k-check' validates.
+ */
+void
+write_paths(std::ostream &out, Graph const &graph,
+	std::vector<double> const &path_lengths,
+	std::vector<std::vector<size_t>> const &paths)
+{
+	TraceScope trace("output");
+	auto precision = out.precision(17);
+	for (size_t i = 0; i < paths.size(); ++i) {
+		out << path_lengths[i];
+		for (auto vertex : paths[i]) {
+			out << " " << original_id(graph, vertex);
+		}
+		out << "\n";
+	}
+	out.precision(precision);
+}
+
+/* Read in which vertices to use as source and destination, and `k'. Returns
+ * false once there are no more queries to read.
  */
-struct Edge {
-	double weight;
-	size_t from;
-	size_t to;
+bool
+read_query(std::istream &in, Query &query)
+{
+	in >> query.source;
+	in >> query.destination;
+	in >> query.k;
+	return bool(in);
+}
+
+/* The time spent in each phase, and the hardware counters if they are being
+ * collected, summed over every query answered so far, and how many queries
+ * each engine answered.
+ */
+struct PhaseTotals {
+	std::chrono::steady_clock::duration preprocessing{};
+	std::chrono::steady_clock::duration searching{};
+	PerfSample pre_counters = {};
+	PerfSample post_counters = {};
+	size_t queries = 0;
+	size_t engine_queries[num_engines] = {};
 };
 
-/* Similarly, vertices keep a record of both incoming and outgoing edges.
- * In the pre-processing pass we find the absolute shortest path from the
- * destination to every other node. This shortest path length is recorded
- * per vertex and is used as the heuristic in the A* search.
+/* How the engine for each query is chosen: by the planner from the graph's
+ * profile, unless `forced' names one. Only the A*-search can record paths,
+ * queue traces or the heat-map, so if `astar_only' is set the planner only
+ * gets to choose its queue. With `log' set every plan is written to it.
  */
-struct Vertex {
-	std::vector<size_t> outgoing;
-	std::vector<size_t> incoming;
-	double shortest_path;
+struct EngineChoice {
+	Engine const *forced = nullptr;
+	bool astar_only = false;
+	std::ostream *log = nullptr;
 };
 
-/* The graph is stored as a list of vertices and edges, where each vertex also
- * maintains a list of edges, so therefore the graph is essentially an adjacency
- * list.
+Engine const &
+choose_engine(EngineChoice const &choice, GraphProfile const &profile,
+	Workspace const &workspace, Query const &query, size_t reuse)
+{
+	if (choice.forced) {
+		return *choice.forced;
+	}
+	bool heuristic_ready = workspace.destination == query.destination;
+	auto plan = plan_query(profile, heuristic_ready, query, reuse);
+	if (choice.astar_only and plan.engine->algorithm != ENGINE_ASTAR) {
+		plan.engine = find_engine(ENGINE_ASTAR, plan.engine->queue);
+	}
+	if (choice.log) {
+		auto &log = *choice.log;
+		log << "Plan for " << query.source << " -> ";
+		log << query.destination << " (k = " << query.k << "): ";
+		log << plan.engine->name << " (A* cost " << plan.astar_cost;
+		log << ", Dijkstra cost " << plan.counted_cost;
+		log << ", queue ~" << plan.expected_queue << ")" << std::endl;
+	}
+	return *plan.engine;
+}
+
+/* Which engines answered the queries, and who chose them. */
+void
+print_engine_counts(std::ostream &out, PhaseTotals const &totals,
+	EngineChoice const &choice)
+{
+	for (size_t i = 0; i < num_engines; ++i) {
+		size_t count = totals.engine_queries[i];
+		if (count == 0) {
+			continue;
+		}
+		out << "Engine " << engines[i].name << ": " << count;
+		out << (count == 1 ? " query" : " queries");
+		out << (choice.forced ? " (forced by --engine)."
+			: " (chosen by the planner).") << std::endl;
+	}
+}
+
+/* Where the optional extra outputs go, if they have been asked for: the
+ * paths themselves, and the traces of the queue operations.
  */
-struct Graph {
-	std::vector<Vertex> vertices;
-	std::vector<Edge> edges;
+struct ExtraOutputs {
+	std::ostream *paths = nullptr;
+	QueueTraceWriter *queue_traces = nullptr;
 };
 
-/* A custom structure is used to simplify the queue. Each element in the queue
- * keeps track of which vertex we're currently talking about, the priority,
- * and for the A*-search, the path length so far.
+/* With `--checkpoint' the batch's progress is saved to `filename' every
+ * `interval' seconds (see checkpoint.hpp): each search is run `slice_pops'
+ * pops at a time, and between slices, and before each query, the time since
+ * the last checkpoint is looked at. With `--resume' the batch carries on
+ * from `resumed', read from the same file, and `resuming' is set until the
+ * search it holds, if any, has been restored. The answers on standard
+ * output and the paths in `paths', if they are written, are synced before
+ * each checkpoint.
  */
-struct QueueElement {
-	size_t vertex_index;
-	double priority;
-	double path_length;
-	bool operator<(QueueElement const &other) const {
-		return priority > other.priority;
-	}
+struct Checkpointing {
+	std::string filename;
+	double interval = 60.0;
+	uint64_t slice_pops = 1 << 20;
+	uint64_t graph_checksum = 0;
+	bool resuming = false;
+	Checkpoint resumed;
+	size_t query_index = 0;
+	size_t saved = 0;
+	std::chrono::steady_clock::time_point last_saved;
+	std::ostream *paths = nullptr;
+	std::string paths_filename;
 };
 
-Graph
-read_graph_from_file(std::fstream &file)
+/* Save a checkpoint if it is time to, with the search `engine' has paused if
+ * there is one.
+ */
+void
+save_checkpoint_if_due(Graph const &graph, Workspace const &workspace,
+	Query const &query, Engine const *engine,
+	Checkpointing &checkpointing)
 {
-	Graph graph;
-	size_t num_vertices;
-	size_t num_edges;
-	auto &vertices = graph.vertices;
-	auto &edges = graph.edges;
-	file >> num_vertices;
-	file >> num_edges;
-	/* Vertices are initialised with a shortest path length of `INFINITY'
-	 * in preparation of the Dijkstra's algofirthm about to be performed.
-	 * They also have empty `forwards' and `backwards' edges.
+	auto now = std::chrono::steady_clock::now();
+	std::chrono::duration<double> since = now - checkpointing.last_saved;
+	if (since.count() < checkpointing.interval) {
+		return;
+	}
+	Checkpoint checkpoint;
+	checkpoint.graph_checksum = checkpointing.graph_checksum;
+	checkpoint.contracted = graph.chains != nullptr;
+	checkpoint.record_paths = workspace.record_paths;
+	checkpoint.query_index = checkpointing.query_index;
+	checkpoint.query = query;
+	checkpoint.engine = UINT64_MAX;
+	if (engine) {
+		checkpoint.engine = engine - engines;
+		engine->save(workspace, checkpoint);
+	}
+	/* The checkpoint says the queries before this one are answered, so
+	 * their answers must be on the disk first.
 	 */
-	Vertex initial_vertex = {{}, {}, INFINITY};
-	graph.vertices = std::vector<Vertex>(num_vertices, initial_vertex);
-	graph.edges.reserve(num_edges);
-	/* Loop over all the edges in the file. */
-	for (size_t i = 0; i < num_edges; ++i) {
-		size_t from, to;
-		double weight;
-		file >> from;
-		file >> to;
-		file >> weight;
-		edges[i] = {weight, from, to};
-		vertices[from].outgoing.push_back(i);
-		vertices[to].incoming.push_back(i);
-	}
-	return graph;
+	std::cout.flush();
+	bool synced = sync_file(STDOUT_FILENO);
+	if (checkpointing.paths) {
+		checkpointing.paths->flush();
+		synced = synced and sync_file(checkpointing.paths_filename);
+	}
+	if (!synced or !write_checkpoint(checkpointing.filename, checkpoint)) {
+		std::cerr << "could not write checkpoint file" << std::endl;
+	}
+	checkpointing.saved += 1;
+	checkpointing.last_saved = std::chrono::steady_clock::now();
 }
 
-/* This preprocessing stage performs Dijkstra's algorithm backwards -- that is,
- * starting at the destination and moving outwards. After this we will have
- * calculated the length of the absolute shortest path from any vertex in the
- * graph to the destination.
+/* Run a search a slice at a time, saving checkpoints between the slices. */
+std::vector<double> const &
+search_with_checkpoints(Graph const &graph, Workspace &workspace,
+	Query const &query, Engine const &engine,
+	Checkpointing &checkpointing)
+{
+	if (checkpointing.resuming) {
+		if (checkpointing.resumed.engine != UINT64_MAX) {
+			engine.restore(checkpointing.resumed, workspace);
+		}
+		checkpointing.resuming = false;
+		checkpointing.resumed = Checkpoint();
+	}
+	while (!engine.resume(graph, workspace, query,
+	                      checkpointing.slice_pops)) {
+		save_checkpoint_if_due(graph, workspace, query, &engine,
+			checkpointing);
+	}
+	return workspace.path_lengths;
+}
+
+/* Answer a single query with the given engine and write out the answer. Each
+ * phase is timed both into `totals' and into the latency histograms. For the
+ * A*-search the heuristic is only recalculated when the destination is not
+ * the same as the last query's.
  */
 void
-calculate_heuristic(Graph &graph, size_t destination)
+answer_query(Graph const &graph, Workspace &workspace, Query const &query,
+	Engine const &engine, PerfCounters &counters, PhaseTotals &totals,
+	std::ostream &out, ExtraOutputs const &extra,
+	Checkpointing *checkpointing = nullptr)
 {
-	std::set<size_t> visited_vertices;
-	std::priority_queue<QueueElement> queue;
-	auto &vertices = graph.vertices;
-	auto &edges = graph.edges;
-	/* Initially the only element in the priority queue is the destination,
-	 * as we are working backwards.
+	/* Preprocess the graph using backwards Dijkstra's to calculate the
+	 * shortest path length from every vertex to the destination. This
+	 * will be used as a heuristic in the next phase.
 	 */
-	QueueElement initial_element = {destination, 0.0, 0.0};
-	queue.push(initial_element);
-	graph.vertices[destination].shortest_path = 0.0;
-	while (!queue.empty()) {
-		/* Pop the next element off the queue. */
-		auto element = queue.top();
-		auto &vertex = vertices[element.vertex_index];
-		queue.pop();
-		/* Have we already calculated the shortest path for this vertex?
-		 * If so, skip.
-		 */
-		if (visited_vertices.count(element.vertex_index)) {
-			continue;
+	auto start_pre = std::chrono::steady_clock::now();
+	if (engine.prepare and workspace.destination != query.destination) {
+		counters.start();
+		engine.prepare(graph, workspace, query);
+		add_perf_sample(totals.pre_counters, counters.stop());
+		if (extra.queue_traces) {
+			extra.queue_traces->write(workspace.heuristic_trace);
 		}
-		visited_vertices.insert(element.vertex_index);
-		double distance = element.path_length;
-		/* For every incoming edge to the current vertex. */
-		for (auto edge_index : vertex.incoming) {
-			auto const &edge = edges[edge_index];
-			if (!visited_vertices.count(edge.from)) {
-				auto &prev_vertex = vertices[edge.from];
-				double path_length = distance + edge.weight;
-				if (path_length < prev_vertex.shortest_path) {
-					prev_vertex.shortest_path = path_length;
-					QueueElement element = {
-						edge.from,
-						path_length,
-						path_length};
-					queue.push(element);
+	}
+	auto end_pre = std::chrono::steady_clock::now();
+
+	/* Search the graph using an A*-search to find paths to the destination
+	 * using the heuristics previously calculated (or with whichever other
+	 * engine was chosen).
+	 */
+	auto start_post = std::chrono::steady_clock::now();
+	counters.start();
+	auto const &path_lengths = checkpointing
+		? search_with_checkpoints(graph, workspace, query, engine,
+			*checkpointing)
+		: engine.search(graph, workspace, query);
+	add_perf_sample(totals.post_counters, counters.stop());
+	auto end_post = std::chrono::steady_clock::now();
+
+	write_path_lengths(out, path_lengths);
+	if (extra.paths) {
+		write_paths(*extra.paths, graph, workspace.path_lengths,
+			workspace.paths);
+	}
+	if (extra.queue_traces) {
+		extra.queue_traces->write(workspace.search_trace);
+	}
+	auto end_query = std::chrono::steady_clock::now();
+
+	totals.preprocessing += end_pre - start_pre;
+	totals.searching += end_post - start_post;
+	totals.queries += 1;
+	totals.engine_queries[&engine - engines] += 1;
+	record_latency(LATENCY_HEURISTIC, end_pre - start_pre);
+	record_latency(LATENCY_SEARCH, end_post - start_post);
+	record_latency(LATENCY_TOTAL, end_query - start_pre);
+}
+
+/* Answer a batch of queries in order, with the planner told how many in a
+ * row share each destination. When resuming from a checkpoint the queries
+ * before the one it was saved in have been answered already, and the one
+ * it was saved in is carried on with the engine which started it.
+ */
+void
+answer_batch(Graph const &graph, Workspace &workspace,
+	std::vector<Query> const &batch, EngineChoice const &choice,
+	GraphProfile const &profile, PerfCounters &counters,
+	PhaseTotals &totals, ExtraOutputs const &extra,
+	Checkpointing *checkpointing)
+{
+	size_t first = 0;
+	if (checkpointing and checkpointing->resuming) {
+		first = checkpointing->resumed.query_index;
+	}
+	for (size_t i = first; i < batch.size(); ++i) {
+		size_t reuse = 1;
+		while (i + reuse < batch.size() and
+		       batch[i + reuse].destination == batch[i].destination) {
+			reuse += 1;
+		}
+		Engine const *engine = nullptr;
+		if (checkpointing and checkpointing->resuming and
+		    checkpointing->resumed.engine != UINT64_MAX) {
+			engine = &engines[checkpointing->resumed.engine];
+		} else {
+			engine = &choose_engine(choice, profile, workspace,
+				batch[i], reuse);
+		}
+		if (checkpointing) {
+			checkpointing->query_index = i;
+			save_checkpoint_if_due(graph, workspace, batch[i],
+				nullptr, *checkpointing);
+		}
+		answer_query(graph, workspace, batch[i], *engine, counters,
+			totals, std::cout, extra, checkpointing);
+	}
+}
+
+/* Answer a batch of queries with `--pipeline' (see pipeline.hpp), with
+ * `heuristic_threads' and `search_threads' threads in those stages and one
+ * writing the answers. The engines are chosen up front, as they would be
+ * answering the batch in order with one workspace. Each run of queries with
+ * the same destination goes through the heuristic and search stages
+ * together, in a workspace taken from a pool; there are enough of them for
+ * every thread to have one and as many again waiting between the stages.
+ * The times in `totals' are summed over the threads.
+ */
+void
+answer_pipelined(Graph const &graph, std::vector<Query> const &batch,
+	EngineChoice const &choice, GraphProfile const &profile,
+	size_t heuristic_threads, size_t search_threads, bool record_paths,
+	PhaseTotals &totals, std::ostream &out, std::ostream &report,
+	ExtraOutputs const &extra)
+{
+	using Clock = std::chrono::steady_clock;
+	struct Run {
+		size_t first;
+		size_t last;
+	};
+	std::vector<Engine const *> chosen;
+	std::vector<Run> runs;
+	Workspace planning;
+	for (size_t i = 0; i < batch.size(); ++i) {
+		size_t reuse = 1;
+		while (i + reuse < batch.size() and
+		       batch[i + reuse].destination == batch[i].destination) {
+			reuse += 1;
+		}
+		if (runs.empty() or
+		    batch[runs.back().first].destination !=
+		    batch[i].destination) {
+			runs.push_back({i, i + reuse});
+		}
+		auto const &engine = choose_engine(choice, profile, planning,
+			batch[i], reuse);
+		if (engine.prepare) {
+			planning.destination = batch[i].destination;
+		}
+		chosen.push_back(&engine);
+	}
+
+	struct Prepared {
+		size_t run;
+		Workspace *workspace;
+		Clock::duration heuristic_time;
+	};
+	struct Answer {
+		size_t index;
+		std::vector<double> path_lengths;
+		std::vector<std::vector<size_t>> paths;
+	};
+	size_t num_workspaces = 2 * (heuristic_threads + search_threads);
+	std::vector<Workspace> workspaces(num_workspaces);
+	BoundedQueue<Workspace *> free_workspaces(num_workspaces);
+	BoundedQueue<Prepared> prepared(num_workspaces);
+	BoundedQueue<Answer> answers(1024);
+	Clock::duration unused{};
+	for (auto &workspace : workspaces) {
+		workspace.record_paths = record_paths;
+		free_workspaces.push(&workspace, unused);
+	}
+	std::vector<StageTimes> stages = {
+		{"heuristic", std::vector<Clock::duration>(heuristic_threads),
+			std::vector<Clock::duration>(heuristic_threads)},
+		{"search", std::vector<Clock::duration>(search_threads),
+			std::vector<Clock::duration>(search_threads)},
+		{"output", std::vector<Clock::duration>(1),
+			std::vector<Clock::duration>(1)},
+	};
+	std::vector<PhaseTotals> thread_totals(heuristic_threads +
+		search_threads);
+	std::atomic<size_t> next_run{0};
+	std::atomic<size_t> runs_taken{0};
+
+	auto heuristic_stage = [&](size_t thread) {
+		auto start = Clock::now();
+		auto &waited = stages[0].waiting[thread];
+		auto &totals = thread_totals[thread];
+		for (;;) {
+			size_t run = next_run.fetch_add(1);
+			if (run >= runs.size()) {
+				break;
+			}
+			Workspace *workspace = free_workspaces.pop(waited);
+			auto start_pre = Clock::now();
+			for (size_t i = runs[run].first; i < runs[run].last;
+			     ++i) {
+				if (chosen[i]->prepare) {
+					chosen[i]->prepare(graph, *workspace,
+						batch[i]);
+					break;
 				}
 			}
+			auto heuristic_time = Clock::now() - start_pre;
+			totals.preprocessing += heuristic_time;
+			prepared.push({run, workspace, heuristic_time}, waited);
 		}
+		stages[0].running[thread] = Clock::now() - start;
+	};
+
+	auto search_stage = [&](size_t thread) {
+		auto start = Clock::now();
+		auto &waited = stages[1].waiting[thread];
+		auto &totals = thread_totals[heuristic_threads + thread];
+		while (runs_taken.fetch_add(1) < runs.size()) {
+			auto [run, workspace, heuristic_time] =
+				prepared.pop(waited);
+			for (size_t i = runs[run].first; i < runs[run].last;
+			     ++i) {
+				auto const &engine = *chosen[i];
+				auto start_post = Clock::now();
+				run_engine(engine, graph, *workspace, batch[i]);
+				auto search_time = Clock::now() - start_post;
+				totals.searching += search_time;
+				totals.queries += 1;
+				totals.engine_queries[&engine - engines] += 1;
+				if (i > runs[run].first) {
+					heuristic_time = {};
+				}
+				record_latency(LATENCY_HEURISTIC,
+					heuristic_time);
+				record_latency(LATENCY_SEARCH, search_time);
+				record_latency(LATENCY_TOTAL,
+					heuristic_time + search_time);
+				answers.push({i, workspace->path_lengths,
+					workspace->paths}, waited);
+			}
+			free_workspaces.push(workspace, waited);
+		}
+		stages[1].running[thread] = Clock::now() - start;
+	};
+
+	/* Answers come in whatever order the runs finish in, and are held
+	 * until those before them have been written.
+	 */
+	auto output_stage = [&] {
+		auto start = Clock::now();
+		auto &waited = stages[2].waiting[0];
+		std::vector<Answer> held(batch.size());
+		std::vector<bool> arrived(batch.size(), false);
+		size_t next = 0;
+		for (size_t received = 0; received < batch.size();
+		     ++received) {
+			Answer answer = answers.pop(waited);
+			size_t index = answer.index;
+			held[index] = std::move(answer);
+			arrived[index] = true;
+			while (next < batch.size() and arrived[next]) {
+				write_path_lengths(out,
+					held[next].path_lengths);
+				if (extra.paths) {
+					write_paths(*extra.paths, graph,
+						held[next].path_lengths,
+						held[next].paths);
+				}
+				held[next] = Answer();
+				next += 1;
+			}
+		}
+		stages[2].running[0] = Clock::now() - start;
+	};
+
+	auto start = Clock::now();
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < heuristic_threads; ++t) {
+		threads.emplace_back(heuristic_stage, t);
+	}
+	for (size_t t = 0; t < search_threads; ++t) {
+		threads.emplace_back(search_stage, t);
+	}
+	output_stage();
+	for (auto &thread : threads) {
+		thread.join();
 	}
+	auto elapsed = Clock::now() - start;
+	for (auto const &thread : thread_totals) {
+		totals.preprocessing += thread.preprocessing;
+		totals.searching += thread.searching;
+		totals.queries += thread.queries;
+		for (size_t i = 0; i < num_engines; ++i) {
+			totals.engine_queries[i] += thread.engine_queries[i];
+		}
+	}
+	print_stage_utilisation(report, stages, elapsed);
 }
 
-/* The way we calculate the k-shortest paths is by performing an A*-search,
- * using the shortest path to the destination calculated in the previous
- * function as the heuristic. As this heuristic is not an approximation,
- * but is in fact exact, this is very fast.
+/* In server mode the graph stays loaded and queries are read one per line
+ * from standard input, each answered on standard output as soon as it has
+ * been found. A line which isn't a valid query is answered with an error,
+ * so every line in gets exactly one line out. Every `report_interval'
+ * seconds the latency percentiles so far are reported on standard error.
  */
 void
-search(Graph &graph, size_t source, size_t destination, size_t k)
+serve(Graph const &graph, Workspace &workspace, EngineChoice const &choice,
+	GraphProfile const &profile, PerfCounters &counters,
+	PhaseTotals &totals, double report_interval, ExtraOutputs const &extra)
 {
-	std::priority_queue<QueueElement> queue;
-	auto &vertices = graph.vertices;
-	auto &edges = graph.edges;
-	/* This time the first element in the priority queue is the source.
-	 * The heuristic/priority is the shortest path cost we previously
-	 * calculated, and the current path length is 0.
-	 */
-	QueueElement initial_element = {
-		source,
-		vertices[source].shortest_path,
-		0.0};
-	queue.push(initial_element);
-	while (!queue.empty()) {
-		/* Pop the next element off the queue. */
-		auto element = queue.top();
-		auto &vertex = vertices[element.vertex_index];
-		auto path_length = element.path_length;
-		queue.pop();
-		/* Is the current vertex the destination? Great, we've found
-		 * another path.
+	std::string line;
+	auto last_report = std::chrono::steady_clock::now();
+	while (std::getline(std::cin, line)) {
+		std::istringstream in(line);
+		Query query;
+		if (!read_query(in, query) or !translate_query(graph, query) or
+		    !query_is_valid(graph, query)) {
+			std::cout << "error: expected SOURCE DESTINATION K";
+			std::cout << std::endl;
+			continue;
+		}
+		/* Whether the next query will want the same heuristic
+		 * can't be known, so none is assumed.
 		 */
-		if (element.vertex_index == destination) {
-			std::cout << path_length;
-			/* If we still have more paths to find, subtract 1
-			 * from k and keep going. Otherwise quit early.
-			 */
-			if (k > 1) {
-				std::cout << ", ";
-				k = k - 1;
+		auto const &engine = choose_engine(choice, profile, workspace,
+			query, 1);
+		answer_query(graph, workspace, query, engine, counters, totals,
+			std::cout, extra);
+		auto now = std::chrono::steady_clock::now();
+		std::chrono::duration<double> since_report = now - last_report;
+		if (since_report.count() >= report_interval) {
+			report_latency(std::cerr);
+			last_report = now;
+		}
+	}
+}
+
+/* Server mode with `--schedule' (see scheduler.hpp). The queries are read
+ * by a thread of their own, so that new ones are seen between slices while
+ * the others are being answered, and each answer (or error) starts with the
+ * number of its line, counting from 1.
+ */
+void
+serve_scheduled(Graph const &graph, Scheduler &scheduler,
+	EngineChoice const &choice, GraphProfile const &profile,
+	PhaseTotals &totals, double report_interval, ExtraOutputs const &extra)
+{
+	using Clock = std::chrono::steady_clock;
+	std::mutex mutex;
+	std::condition_variable arrived;
+	std::deque<std::pair<std::string, Clock::time_point>> lines;
+	bool input_done = false;
+	std::thread reader([&] {
+		std::string line;
+		while (std::getline(std::cin, line)) {
+			std::lock_guard<std::mutex> lock(mutex);
+			lines.emplace_back(std::move(line), Clock::now());
+			arrived.notify_one();
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		input_done = true;
+		arrived.notify_one();
+	});
+
+	uint64_t line_number = 0;
+	auto last_report = Clock::now();
+	for (;;) {
+		std::deque<std::pair<std::string, Clock::time_point>> taken;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			if (scheduler.queries.empty()) {
+				arrived.wait(lock, [&] {
+					return input_done or !lines.empty();
+				});
+			}
+			taken.swap(lines);
+			if (taken.empty() and input_done and
+			    scheduler.queries.empty()) {
+				break;
+			}
+		}
+		for (auto &[line, time] : taken) {
+			line_number += 1;
+			std::istringstream in(line);
+			Query query;
+			if (!read_query(in, query) or
+			    !translate_query(graph, query) or
+			    !query_is_valid(graph, query)) {
+				std::cout << line_number << ": error: expected";
+				std::cout << " SOURCE DESTINATION K";
+				std::cout << std::endl;
 				continue;
+			}
+			add_query(scheduler, line_number, query, time);
+		}
+		if (scheduler.queries.empty()) {
+			continue;
+		}
+
+		size_t index = pick_query(scheduler, Clock::now());
+		auto &scheduled = scheduler.queries[index];
+		auto &query = scheduled.query;
+		auto start = Clock::now();
+		if (!scheduled.workspace) {
+			start_query(scheduler, scheduled);
+			auto &workspace = *scheduled.workspace;
+			scheduled.started = start;
+			scheduled.engine = &choose_engine(choice, profile,
+				workspace, query, 1);
+			if (scheduled.engine->prepare and
+			    workspace.destination != query.destination) {
+				auto pops = workspace.work.heuristic_pops;
+				scheduled.engine->prepare(graph, workspace,
+					query);
+				scheduled.heuristic_pops =
+					workspace.work.heuristic_pops - pops;
+				scheduled.heuristic_computed = true;
+			}
+			scheduled.done = scheduled.heuristic_pops;
+			scheduled.heuristic_time = Clock::now() - start;
+			start = Clock::now();
+		}
+		auto &workspace = *scheduled.workspace;
+		auto const &engine = *scheduled.engine;
+		auto pops = workspace.work.search_pops;
+		bool finished = true;
+		if (engine.resume) {
+			finished = engine.resume(graph, workspace, query,
+				scheduler.slice_pops);
+		} else {
+			engine.search(graph, workspace, query);
+		}
+		scheduled.done += workspace.work.search_pops - pops;
+		auto now = Clock::now();
+		scheduled.search_time += now - start;
+		if (!finished) {
+			continue;
+		}
+
+		std::cout << scheduled.number << ": ";
+		write_path_lengths(std::cout, workspace.path_lengths);
+		if (extra.paths) {
+			write_paths(*extra.paths, graph,
+				workspace.path_lengths, workspace.paths);
+		}
+		/* The model is of the A*-search, which is what is sliced;
+		 * a Dijkstra search pops far more per path, and would
+		 * throw its estimates off.
+		 */
+		double length = workspace.destination == query.destination
+			? workspace.shortest_path[query.source] : NAN;
+		if (engine.resume) {
+			update_cost_model(scheduler.model, query, length,
+				scheduled.heuristic_computed,
+				scheduled.heuristic_pops,
+				scheduled.done - scheduled.heuristic_pops);
+		}
+		now = Clock::now();
+		totals.preprocessing += scheduled.heuristic_time;
+		totals.searching += scheduled.search_time;
+		totals.queries += 1;
+		totals.engine_queries[&engine - engines] += 1;
+		record_latency(LATENCY_WAITING,
+			scheduled.started - scheduled.arrived);
+		record_latency(LATENCY_HEURISTIC, scheduled.heuristic_time);
+		record_latency(LATENCY_SEARCH, scheduled.search_time);
+		record_latency(LATENCY_TOTAL, now - scheduled.arrived);
+		finish_query(scheduler, index);
+		std::chrono::duration<double> since_report = now - last_report;
+		if (since_report.count() >= report_interval) {
+			report_latency(std::cerr);
+			last_report = now;
+		}
+	}
+	reader.join();
+}
+
+/* With `--graph' the server holds any number of graphs, by name, within a
+ * memory budget (see graph-store.hpp). A query may start with the name of
+ * the graph it is for; without one it goes to the first graph. The line
+ * "stats" is answered with the memory held and queries answered by each
+ * graph, which are also reported on standard error with the latencies.
+ *
+ * The line "reload GRAPH [FILENAME]" starts loading a new version of the
+ * graph in the background and is answered straight away; the server goes
+ * on answering queries with the old version until the new one is ready,
+ * and reports the swap (or why the new version was rejected) on standard
+ * error. The queries are read by a thread of their own, as with
+ * `--schedule', so that the swap is made as soon as the new version is
+ * ready, even while no queries are coming in.
+ */
+void
+serve_graphs(GraphStore &store, EngineChoice const &choice,
+	PerfCounters &counters, PhaseTotals &totals, double report_interval,
+	ExtraOutputs const &extra)
+{
+	std::deque<std::string> lines;
+	bool input_done = false;
+	std::thread reader([&] {
+		std::string line;
+		while (std::getline(std::cin, line)) {
+			std::lock_guard<std::mutex> lock(store.mutex);
+			lines.push_back(std::move(line));
+			store.changed.notify_all();
+		}
+		std::lock_guard<std::mutex> lock(store.mutex);
+		input_done = true;
+		store.changed.notify_all();
+	});
+
+	auto last_report = std::chrono::steady_clock::now();
+	for (;;) {
+		std::string line;
+		bool have_line = false;
+		bool done = false;
+		{
+			std::unique_lock<std::mutex> lock(store.mutex);
+			store.changed.wait(lock, [&] {
+				return input_done or !lines.empty() or
+					reload_finished(store);
+			});
+			if (!lines.empty()) {
+				line = std::move(lines.front());
+				lines.pop_front();
+				have_line = true;
+			}
+			done = input_done;
+		}
+		finish_reloads(store, std::cerr, false);
+		if (!have_line) {
+			if (done) {
+				break;
+			}
+			continue;
+		}
+		if (line.compare(0, 7, "reload ") == 0) {
+			std::istringstream in(line.substr(7));
+			std::string name, filename;
+			in >> name >> filename;
+			StoredGraph *stored = find_stored_graph(store, name);
+			if (!stored) {
+				std::cout << "error: no graph " << name;
+			} else if (char const *problem = start_reload(store,
+			                                   *stored, filename)) {
+				std::cout << "error: graph " << name << " ";
+				std::cout << problem;
 			} else {
-				std::cout << std::endl;
-				return;
+				std::cout << "reloading " << name;
 			}
+			std::cout << std::endl;
+			continue;
+		}
+		if (line == "stats") {
+			std::ostringstream stats;
+			print_graph_store(stats, store, "; ");
+			auto text = stats.str();
+			std::cout << text.substr(0, text.size() - 2);
+			std::cout << std::endl;
+			continue;
+		}
+		std::istringstream in(line);
+		std::vector<std::string> fields;
+		std::string field;
+		while (in >> field) {
+			fields.push_back(field);
+		}
+		std::string name = store.graphs.front()->name;
+		if (fields.size() == 4) {
+			name = fields.front();
+			fields.erase(fields.begin());
+		}
+		std::istringstream query_fields(fields.size() == 3
+			? fields[0] + " " + fields[1] + " " + fields[2] : "");
+		Query query;
+		if (!read_query(query_fields, query)) {
+			std::cout << "error: expected [GRAPH] SOURCE";
+			std::cout << " DESTINATION K" << std::endl;
+			continue;
+		}
+		if (!find_stored_graph(store, name)) {
+			std::cout << "error: no graph " << name << std::endl;
+			continue;
+		}
+		StoredGraph *stored = acquire_stored_graph(store, name);
+		if (!stored) {
+			std::cout << "error: could not load graph " << name;
+			std::cout << std::endl;
+			continue;
+		}
+		/* The query keeps the version it starts with alive, even
+		 * if a new one is swapped in meanwhile.
+		 */
+		auto version = stored->graph;
+		auto const &graph = *version;
+		auto &workspace = *stored->workspace;
+		if (!translate_query(graph, query) or
+		    !query_is_valid(graph, query)) {
+			std::cout << "error: no such vertices in graph ";
+			std::cout << name << std::endl;
+			continue;
 		}
-		/* For every outgoing edge from the current vertex... */
-		for (auto edge_index : vertex.outgoing) {
-			auto const &edge = edges[edge_index];
-			double current_path_length = path_length + edge.weight;
-			double heuristic = vertices[edge.to].shortest_path;
-			/* Add to the priority queue. Recall that in an
-			 * A*-search the priority is the current cost +
-			 * the heuristic for the candidate node.
-			 */
-			QueueElement element = {
-				edge.to,
-				current_path_length + heuristic,
-				current_path_length};
-			queue.push(element);
+		auto const &engine = choose_engine(choice, stored->profile,
+			workspace, query, 1);
+		answer_query(graph, workspace, query, engine, counters, totals,
+			std::cout, extra);
+		stored->queries += 1;
+		update_stored_bytes(*stored);
+		enforce_memory_budget(store, stored);
+		auto now = std::chrono::steady_clock::now();
+		std::chrono::duration<double> since_report = now - last_report;
+		if (since_report.count() >= report_interval) {
+			report_latency(std::cerr);
+			print_graph_store(std::cerr, store, ".\n");
+			last_report = now;
 		}
 	}
+	reader.join();
+	finish_reloads(store, std::cerr, true);
+}
+
+/* Sizes may be given in bytes or with a K, M or G (binary) suffix. */
+size_t
+parse_size(char const *text)
+{
+	char *end;
+	double size = std::strtod(text, &end);
+	switch (*end) {
+	case 'G': case 'g':
+		size *= 1024;
+		/* fall through */
+	case 'M': case 'm':
+		size *= 1024;
+		/* fall through */
+	case 'K': case 'k':
+		size *= 1024;
+		break;
+	}
+	return size_t(size);
 }
 
 int
@@ -198,66 +872,560 @@ main(int argc, char *argv[])
 {
 	std::fstream input_file;
 	std::string filename;
-	size_t source, destination, k;
 	Graph graph;
+	bool use_perf = false;
+	bool bad_usage = false;
+	bool server = false;
+	bool show_memory = false;
+	bool show_profile = false;
+	bool contract = true;
+	bool sparse_ids = false;
+	bool schedule = false;
+	size_t heuristic_threads = 0;
+	size_t search_threads = 0;
+	uint64_t slice_pops = Scheduler().slice_pops;
+	std::string format = "text";
+	std::string coordinates_filename;
+	size_t heatmap_top = 20;
+	double report_interval = 10.0;
+	PerfCounters counters;
+	std::string trace_filename;
+	std::string queries_filename;
+	std::string heatmap_filename;
+	std::string paths_filename;
+	std::string queue_trace_filename;
+	std::string engine_name = "auto";
+	GraphStore store;
+	Checkpointing checkpointing;
+	bool resume = false;
 
-	if (argc != 2) {
+	static option const long_options[] = {
+		{"perf", no_argument, nullptr, 'p'},
+		{"trace", required_argument, nullptr, 't'},
+		{"queries", required_argument, nullptr, 'q'},
+		{"server", no_argument, nullptr, 's'},
+		{"report-interval", required_argument, nullptr, 'r'},
+		{"memory", no_argument, nullptr, 'm'},
+		{"heatmap", required_argument, nullptr, 'H'},
+		{"heatmap-top", required_argument, nullptr, 'N'},
+		{"paths", required_argument, nullptr, 'P'},
+		{"record-queue", required_argument, nullptr, 'Q'},
+		{"engine", required_argument, nullptr, 'e'},
+		{"profile", no_argument, nullptr, 'g'},
+		{"graph", required_argument, nullptr, 'G'},
+		{"memory-budget", required_argument, nullptr, 'B'},
+		{"snapshot-dir", required_argument, nullptr, 'D'},
+		{"no-contract", no_argument, nullptr, 'c'},
+		{"sparse-ids", no_argument, nullptr, 'i'},
+		{"format", required_argument, nullptr, 'f'},
+		{"coordinates", required_argument, nullptr, 'C'},
+		{"schedule", no_argument, nullptr, 'S'},
+		{"time-slice", required_argument, nullptr, 'T'},
+		{"pipeline", required_argument, nullptr, 'l'},
+		{"checkpoint", required_argument, nullptr, 'K'},
+		{"checkpoint-interval", required_argument, nullptr, 'I'},
+		{"resume", no_argument, nullptr, 'R'},
+		{nullptr, 0, nullptr, 0},
+	};
+	char const *short_options =
+		"pt:q:sr:mH:N:P:Q:e:gG:B:D:cif:C:ST:l:K:I:R";
+	int option;
+	while ((option = getopt_long(argc, argv, short_options, long_options,
+	                             nullptr)) != -1) {
+		switch (option) {
+		case 'p':
+			use_perf = true;
+			break;
+		case 't':
+			trace_filename = optarg;
+			trace_enabled = true;
+			break;
+		case 'q':
+			queries_filename = optarg;
+			break;
+		case 's':
+			server = true;
+			break;
+		case 'r':
+			report_interval = std::atof(optarg);
+			break;
+		case 'm':
+			show_memory = true;
+			break;
+		case 'H':
+			heatmap_filename = optarg;
+			break;
+		case 'N':
+			heatmap_top = std::strtoull(optarg, nullptr, 10);
+			break;
+		case 'P':
+			paths_filename = optarg;
+			break;
+		case 'Q':
+			queue_trace_filename = optarg;
+			break;
+		case 'e':
+			engine_name = optarg;
+			break;
+		case 'g':
+			show_profile = true;
+			break;
+		case 'G': {
+			std::string graph_option = optarg;
+			auto equals = graph_option.find('=');
+			if (equals == std::string::npos or equals == 0) {
+				bad_usage = true;
+				break;
+			}
+			add_stored_graph(store, graph_option.substr(0, equals),
+				graph_option.substr(equals + 1));
+			break;
+		}
+		case 'B':
+			store.budget = parse_size(optarg);
+			break;
+		case 'D':
+			store.snapshot_dir = optarg;
+			break;
+		case 'c':
+			contract = false;
+			break;
+		case 'i':
+			sparse_ids = true;
+			break;
+		case 'f':
+			format = optarg;
+			break;
+		case 'C':
+			coordinates_filename = optarg;
+			break;
+		case 'S':
+			schedule = true;
+			break;
+		case 'T':
+			slice_pops = std::max<uint64_t>(1,
+				std::strtoull(optarg, nullptr, 10));
+			break;
+		case 'l': {
+			char *end;
+			heuristic_threads = std::strtoull(optarg, &end, 10);
+			search_threads = *end == ',' ? std::strtoull(end + 1,
+				&end, 10) : 0;
+			if (*end != '\0' or heuristic_threads == 0 or
+			    search_threads == 0) {
+				bad_usage = true;
+			}
+			break;
+		}
+		case 'K':
+			checkpointing.filename = optarg;
+			break;
+		case 'I':
+			checkpointing.interval = std::strtod(optarg, nullptr);
+			break;
+		case 'R':
+			resume = true;
+			break;
+		default:
+			bad_usage = true;
+			break;
+		}
+	}
+	/* A graph in another format has no queries after it, so they have
+	 * to come from a file of their own or standard input.
+	 */
+	bool many_graphs = !store.graphs.empty();
+	bool other_format = format != "text";
+	if (bad_usage or optind != argc - (many_graphs ? 0 : 1) or
+	    (many_graphs and (!server or !heatmap_filename.empty() or
+	                      !queue_trace_filename.empty() or
+	                      other_format)) or
+	    (other_format and !server and queries_filename.empty()) or
+	    (!coordinates_filename.empty() and format != "dimacs") or
+	    (schedule and (!server or many_graphs or
+	                   !heatmap_filename.empty() or
+	                   !queue_trace_filename.empty())) or
+	    (search_threads > 0 and (server or use_perf or
+	                             !heatmap_filename.empty() or
+	                             !queue_trace_filename.empty())) or
+	    (!checkpointing.filename.empty() and (server or many_graphs or
+	                                          search_threads > 0)) or
+	    (resume and checkpointing.filename.empty())) {
 		std::cerr << "Usage: ";
-		std::cerr << argv[0] << " FILENAME" << std::endl;
+		std::cerr << argv[0] << " [--perf] [--memory]";
+		std::cerr << " [--trace TRACEFILE]";
+		std::cerr << " [--heatmap HEATMAPFILE [--heatmap-top N]]";
+		std::cerr << " [--paths PATHFILE]";
+		std::cerr << " [--record-queue QUEUETRACEFILE]";
+		std::cerr << " [--engine auto|ENGINE] [--profile]";
+		std::cerr << " [--no-contract] [--sparse-ids]";
+		std::cerr << " [--format text|dimacs|metis]";
+		std::cerr << " [--coordinates COFILE]";
+		std::cerr << " [--pipeline HEURISTIC_THREADS,SEARCH_THREADS]";
+		std::cerr << " [--checkpoint CHECKPOINTFILE";
+		std::cerr << " [--checkpoint-interval SECONDS] [--resume]]";
+		std::cerr << " [--queries QUERYFILE | --server";
+		std::cerr << " [--report-interval SECONDS]";
+		std::cerr << " [--schedule [--time-slice POPS]]] FILENAME";
+		std::cerr << std::endl;
+		std::cerr << "       " << argv[0] << " --server";
+		std::cerr << " --graph NAME=FILENAME... [--memory-budget SIZE]";
+		std::cerr << " [--snapshot-dir DIRECTORY] [--paths PATHFILE]";
+		std::cerr << " [--engine auto|ENGINE] [--no-contract]";
+		std::cerr << " [--report-interval SECONDS]" << std::endl;
 		return 0;
 	}
-	filename = argv[1];
-	input_file.open(filename);
+
+	/* Unless `--engine' names one, the engine for each query is chosen
+	 * from a profile of the graph taken when it is loaded.
+	 */
+	EngineChoice choice;
+	if (engine_name != "auto") {
+		choice.forced = find_engine(engine_name);
+		if (!choice.forced) {
+			std::cerr << "unknown engine; expected auto";
+			for (auto const &engine : engines) {
+				std::cerr << ", " << engine.name;
+			}
+			std::cerr << std::endl;
+			return 0;
+		}
+	}
+
+	if (many_graphs) {
+		for (auto &stored : store.graphs) {
+			stored->contract = contract;
+		}
+		PhaseTotals totals;
+		ExtraOutputs extra;
+		std::ofstream paths_file;
+		if (!paths_filename.empty()) {
+			paths_file.open(paths_filename);
+			if (!paths_file) {
+				std::cerr << "could not open path file";
+				std::cerr << std::endl;
+				return 0;
+			}
+			extra.paths = &paths_file;
+			choice.astar_only = true;
+		}
+		if (choice.forced and choice.astar_only and
+		    choice.forced->algorithm != ENGINE_ASTAR) {
+			std::cerr << "only the A*-search engines can record";
+			std::cerr << " paths" << std::endl;
+			return 0;
+		}
+		serve_graphs(store, choice, counters, totals, report_interval,
+			extra);
+		std::chrono::duration<double> pre_duration =
+			totals.preprocessing;
+		std::chrono::duration<double> post_duration = totals.searching;
+		std::cerr << "Preprocessing time: ";
+		std::cerr << 1000 * pre_duration.count();
+		std::cerr << " milliseconds." << std::endl;
+		std::cerr << "Searching time: ";
+		std::cerr << 1000 * post_duration.count();
+		std::cerr << " milliseconds." << std::endl;
+		print_engine_counts(std::cerr, totals, choice);
+		report_latency(std::cerr);
+		print_graph_store(std::cerr, store, ".\n");
+		return 0;
+	}
+	filename = argv[optind];
+	input_file.open(filename, std::ios::in | std::ios::binary);
 	if (!input_file) {
 		std::cerr << "could not open input file" << std::endl;
 	}
 
-	/* Read in the graph from the file with `read_graph_from_file'. */
+	/* With `--perf' the hardware counters are collected around each of
+	 * the phases below. Not being allowed to use them is not an error;
+	 * we just say so and carry on with the timings alone.
+	 */
+	if (use_perf and !counters.open()) {
+		std::cerr << "performance counters unavailable: ";
+		std::cerr << counters.error << std::endl;
+		use_perf = false;
+	}
+
+	/* Read in the graph from the file, which is either text (read with
+	 * `read_graph_from_file', or with `--sparse-ids' by
+	 * `read_graph_with_sparse_ids'), a binary snapshot, or with
+	 * `--format' a DIMACS or METIS graph (see graph-formats.hpp).
+	 */
 	auto start_build = std::chrono::steady_clock::now();
-	graph = read_graph_from_file(input_file);
+	counters.start();
+	bool graph_ok;
+	std::string error;
+	if (other_format) {
+		graph_ok = read_graph_in_format(format, filename,
+			coordinates_filename, graph,
+			std::thread::hardware_concurrency(), error);
+	} else if (sparse_ids and input_file.peek() != snapshot_magic[0]) {
+		graph = read_graph_with_sparse_ids(input_file,
+			std::thread::hardware_concurrency());
+		graph_ok = bool(input_file);
+	} else {
+		graph_ok = read_graph(input_file, graph);
+	}
+	auto build_counters = counters.stop();
 	auto end_build = std::chrono::steady_clock::now();
+	if (!graph_ok) {
+		std::cerr << (error.empty() ? "could not read graph" : error);
+		std::cerr << std::endl;
+		return 0;
+	}
 
-	/* Read in which vertices to use as source and destination, and `k'. */
-	input_file >> source;
-	input_file >> destination;
-	input_file >> k;
-
-	/* Preprocess the graph using backwards Dijkstra's to calculate the
-	 * shortest path length from every vertex to the destination. This
-	 * will be used as a heuristic in the next phase.
+	/* Unless `--no-contract' is given, the dead-end trees are peeled off
+	 * and the chains of degree-2 vertices contracted for working out the
+	 * heuristic (see chains.hpp).
 	 */
-	auto start_pre = std::chrono::steady_clock::now();
-	calculate_heuristic(graph, destination);
-	auto end_pre = std::chrono::steady_clock::now();
+	auto start_contract = std::chrono::steady_clock::now();
+	if (contract) {
+		graph.chains = contract_chains(graph);
+	}
+	auto end_contract = std::chrono::steady_clock::now();
 
-	/* Search the graph using an A*-search to find paths to the destination
-	 * using the heuristics previously calculated.
+	GraphProfile profile;
+	auto start_profile = std::chrono::steady_clock::now();
+	if (!choice.forced or show_profile or schedule) {
+		profile = profile_graph(graph);
+	}
+	auto end_profile = std::chrono::steady_clock::now();
+
+	/* The queries follow the graph in the input file, one or more of
+	 * them, unless they are given in a file of their own. In server mode
+	 * they are read from standard input instead, and the statistics are
+	 * written to standard error so as not to mix them up with the
+	 * answers.
 	 */
-	auto start_post = std::chrono::steady_clock::now();
-	search(graph, source, destination, k);
-	auto end_post = std::chrono::steady_clock::now();
+	PhaseTotals totals;
+	Workspace workspace;
+	if (!heatmap_filename.empty()) {
+		workspace.heatmap.pops.assign(graph.vertices.size(), 0);
+		workspace.heatmap.pushes.assign(graph.vertices.size(), 0);
+	}
+	/* With `--paths' every path found is also written out in full. */
+	ExtraOutputs extra;
+	std::ofstream paths_file;
+	if (!paths_filename.empty()) {
+		paths_file.open(paths_filename);
+		if (!paths_file) {
+			std::cerr << "could not open path file" << std::endl;
+			return 0;
+		}
+		workspace.record_paths = true;
+		extra.paths = &paths_file;
+	}
+	/* With `--record-queue' every operation on the queues is recorded,
+	 * for replaying with `queue-bench'.
+	 */
+	QueueTraceWriter queue_traces;
+	if (!queue_trace_filename.empty()) {
+		if (!queue_traces.open(queue_trace_filename)) {
+			std::cerr << "could not open queue trace file";
+			std::cerr << std::endl;
+			return 0;
+		}
+		workspace.record_queues = true;
+		extra.queue_traces = &queue_traces;
+	}
+	choice.astar_only = workspace.record_paths or
+		workspace.record_queues or !workspace.heatmap.pops.empty() or
+		!checkpointing.filename.empty();
+	if (choice.forced and choice.astar_only and
+	    choice.forced->algorithm != ENGINE_ASTAR) {
+		std::cerr << "only the A*-search engines can record paths,";
+		std::cerr << " queue traces or the heat-map, or save";
+		std::cerr << " checkpoints" << std::endl;
+		return 0;
+	}
+	std::ostream &report = server ? std::cerr : std::cout;
+	if (show_profile) {
+		print_graph_profile(report, profile);
+		choice.log = &report;
+	}
+	if (server and schedule) {
+		Scheduler scheduler;
+		scheduler.model = initial_cost_model(profile);
+		scheduler.slice_pops = slice_pops;
+		serve_scheduled(graph, scheduler, choice, profile, totals,
+			report_interval, extra);
+	} else if (server) {
+		serve(graph, workspace, choice, profile, counters, totals,
+			report_interval, extra);
+	} else {
+		std::ifstream queries_file;
+		std::istream *queries = &input_file;
+		if (!queries_filename.empty()) {
+			queries_file.open(queries_filename);
+			if (!queries_file) {
+				std::cerr << "could not open query file";
+				std::cerr << std::endl;
+				return 0;
+			}
+			queries = &queries_file;
+		}
+		/* All the queries are read first so that the planner knows
+		 * how many in a row will share each heuristic.
+		 */
+		std::vector<Query> batch;
+		Query query;
+		while (read_query(*queries, query)) {
+			if (!translate_query(graph, query) or
+			    !query_is_valid(graph, query)) {
+				std::cerr << "invalid query" << std::endl;
+				continue;
+			}
+			batch.push_back(query);
+		}
+		/* A checkpoint is only resumed from if it was saved on
+		 * this graph, part way through this batch, recording paths
+		 * if and only if they are being recorded now.
+		 */
+		Checkpointing *saving = nullptr;
+		if (!checkpointing.filename.empty()) {
+			saving = &checkpointing;
+			checkpointing.paths = extra.paths;
+			checkpointing.paths_filename = paths_filename;
+			checkpointing.graph_checksum = graph_checksum(graph);
+			remove_stale_checkpoint(checkpointing.filename);
+			checkpointing.last_saved =
+				std::chrono::steady_clock::now();
+		}
+		if (resume) {
+			auto &resumed = checkpointing.resumed;
+			if (!read_checkpoint(checkpointing.filename, resumed)) {
+				std::cerr << "could not read checkpoint file";
+				std::cerr << std::endl;
+				return 0;
+			}
+			auto index = resumed.query_index;
+			auto engine = resumed.engine;
+			if (resumed.graph_checksum !=
+			    checkpointing.graph_checksum or
+			    resumed.contracted != (graph.chains != nullptr) or
+			    index >= batch.size() or
+			    batch[index].source != resumed.query.source or
+			    batch[index].destination !=
+			    resumed.query.destination or
+			    batch[index].k != resumed.query.k or
+			    (engine != UINT64_MAX and
+			     (engine >= num_engines or
+			      !engines[engine].restore))) {
+				std::cerr << "the checkpoint is not of this";
+				std::cerr << " graph and batch" << std::endl;
+				return 0;
+			}
+			if (resumed.record_paths != workspace.record_paths) {
+				std::cerr << "the checkpoint was saved ";
+				std::cerr << (resumed.record_paths ? "with" :
+					"without");
+				std::cerr << " --paths" << std::endl;
+				return 0;
+			}
+			checkpointing.resuming = true;
+			std::cerr << "Resuming at query " << index << ": the";
+			std::cerr << " answers follow the first " << index;
+			std::cerr << " of the run which saved the checkpoint.";
+			std::cerr << std::endl;
+		}
+		if (search_threads > 0) {
+			answer_pipelined(graph, batch, choice, profile,
+				heuristic_threads, search_threads,
+				workspace.record_paths, totals, std::cout,
+				report, extra);
+		} else {
+			answer_batch(graph, workspace, batch, choice, profile,
+				counters, totals, extra, saving);
+		}
+		/* A finished batch has nothing to resume. */
+		if (saving) {
+			std::remove(checkpointing.filename.c_str());
+			report << "Checkpoints saved: " << checkpointing.saved;
+			report << "." << std::endl;
+		}
+	}
 
 	/* Output timing information to the terminal. */
 	std::chrono::duration<double> build_duration = end_build - start_build;
-	std::chrono::duration<double> pre_duration = end_pre - start_pre;
-	std::chrono::duration<double> post_duration = end_post - start_post;
-	std::cout << "Building time: ";
-	std::cout << 1000 * build_duration.count();
-	std::cout << " milliseconds."<< std::endl;
-
-	std::cout << "Preprocessing time: ";
-	std::cout << 1000 * pre_duration.count();
-	std::cout << " milliseconds."<< std::endl;
-
-	std::cout << "Searching time: ";
-	std::cout << 1000 * post_duration.count();
-	std::cout << " milliseconds."<< std::endl;
-
-	std::cout << "Total time: ";
-	std::cout << 1000 * (
+	std::chrono::duration<double> contract_duration =
+		end_contract - start_contract;
+	std::chrono::duration<double> profile_duration =
+		end_profile - start_profile;
+	std::chrono::duration<double> pre_duration = totals.preprocessing;
+	std::chrono::duration<double> post_duration = totals.searching;
+	report << "Building time: ";
+	report << 1000 * build_duration.count();
+	report << " milliseconds."<< std::endl;
+
+	if (contract) {
+		report << "Contracting time: ";
+		report << 1000 * contract_duration.count();
+		report << " milliseconds." << std::endl;
+	}
+
+	if (!choice.forced or show_profile) {
+		report << "Profiling time: ";
+		report << 1000 * profile_duration.count();
+		report << " milliseconds." << std::endl;
+	}
+
+	report << "Preprocessing time: ";
+	report << 1000 * pre_duration.count();
+	report << " milliseconds."<< std::endl;
+
+	report << "Searching time: ";
+	report << 1000 * post_duration.count();
+	report << " milliseconds."<< std::endl;
+
+	report << "Total time: ";
+	report << 1000 * (
 		pre_duration.count() + post_duration.count() +
-		build_duration.count());
-	std::cout << " milliseconds."<< std::endl;
+		build_duration.count() + contract_duration.count() +
+		profile_duration.count());
+	report << " milliseconds."<< std::endl;
+	print_engine_counts(report, totals, choice);
+
+	if (use_perf) {
+		print_perf_sample(report, "Building", build_counters);
+		print_perf_sample(report, "Preprocessing", totals.pre_counters);
+		print_perf_sample(report, "Searching", totals.post_counters);
+	}
+
+	/* With `--memory' the memory held by the graph and by the query
+	 * workspace is broken down by component. The workspace figures are
+	 * the largest any single query needed.
+	 */
+	if (show_memory) {
+		print_memory_usage(report, "Graph", graph_memory_usage(graph));
+		print_memory_usage(report, "Query",
+			workspace_memory_usage(workspace));
+		report << "Peak resident set size: ";
+		report << peak_rss_bytes() / 1024.0 << " KiB." << std::endl;
+	}
+
+	/* With `--heatmap' the vertices the searches expanded most often are
+	 * listed, and the counts for every vertex are dumped to the file.
+	 */
+	if (!heatmap_filename.empty()) {
+		print_heatmap_top(report, workspace.heatmap, heatmap_top,
+			graph);
+		if (!write_heatmap(heatmap_filename, workspace.heatmap)) {
+			std::cerr << "could not write heat-map file";
+			std::cerr << std::endl;
+		}
+	}
+
+	/* A single query's latency is just the times above, but for a batch
+	 * (or a server) the spread is what matters.
+	 */
+	if (server or totals.queries > 1) {
+		report_latency(report);
+	}
+
+	/* With `--trace' the timeline of every phase is written out last. */
+	if (!trace_filename.empty() and !trace_write(trace_filename)) {
+		std::cerr << "could not write trace file" << std::endl;
+	}
 	return 0;
 }
-
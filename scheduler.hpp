@@ -0,0 +1,241 @@
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "engines.hpp"
+#include "profile.hpp"
+#include "search.hpp"
+
+/* With `--schedule' the server doesn't answer its queries in the order they
+ * come in, but shortest job first, so that a query for thousands of paths
+ * doesn't hold up the quick ones arriving behind it. Each answer then
+ * starts with the number of the line it answers.
+ *
+ * A query's cost is estimated in pops of the algorithms' queues:
+ *
+ * - The heuristic's Dijkstra pops each vertex it visits once, unless a
+ *   workspace already has the heuristic for the destination.
+ * - The search pops about the same number of elements for each of the k
+ *   paths. When the heuristic is to hand its value at the source is the
+ *   length of the shortest path, and a longer path takes more pops, so the
+ *   estimate is k times the length times the pops per path per unit of
+ *   length; otherwise it is k times the pops per path.
+ *
+ * The rates start out as the planner's guesses from the graph's profile
+ * (see planner.hpp), and are then exponentially weighted averages over the
+ * queries answered so far.
+ *
+ * The query with the least work left by its estimate is run for a slice of
+ * `slice_pops' pops, and then the choice is made again with whatever has
+ * come in meanwhile, so a long search is stopped at a checkpoint as soon as
+ * something cheaper arrives (see `resume' in engines.hpp). Only the search
+ * is sliced; the heuristic is worked out in one go when a query starts. The
+ * estimate is divided by one more than the seconds the query has waited
+ * over `aging', so that a long query still gets its turn under a steady
+ * stream of short ones.
+ *
+ * Each query started has a workspace of its own, since its heuristic and
+ * the queue of its search have to be kept while it is stopped. No more than
+ * `max_started' are started at once, which bounds the memory they take;
+ * while that many are, only they are run. The workspaces of finished queries
+ * are kept for reuse, by a query for the same destination if there is one.
+ */
+struct CostModel {
+	double heuristic_pops;
+	double pops_per_path;
+	double pops_per_path_length;
+};
+
+inline CostModel
+initial_cost_model(GraphProfile const &profile)
+{
+	double vertices = std::max<double>(profile.num_vertices, 2);
+	double degree = std::max(profile.mean_degree, 1.0);
+	double hops = profile.symmetric ? std::sqrt(vertices)
+		: std::log2(vertices) / std::log2(std::max(degree, 2.0));
+	CostModel model;
+	model.heuristic_pops = std::max<double>(profile.heuristic_vertices,
+		1);
+	model.pops_per_path = hops * degree;
+	/* Nothing is known about the weights yet, so this is only a guess
+	 * until the first query with a known length has been answered.
+	 */
+	model.pops_per_path_length = model.pops_per_path;
+	return model;
+}
+
+/* How much each new observation counts in the averages. */
+inline double const cost_model_weight = 0.1;
+
+/* `length' is the shortest path's length, or NaN if it isn't known. */
+inline double
+estimate_cost(CostModel const &model, Query const &query,
+	bool heuristic_ready, double length)
+{
+	double k = double(query.k);
+	double cost = heuristic_ready ? 0.0 : model.heuristic_pops;
+	if (heuristic_ready and length > 0.0 and length < INFINITY) {
+		cost += k * length * model.pops_per_path_length;
+	} else {
+		cost += k * model.pops_per_path;
+	}
+	return std::max(cost, 1.0);
+}
+
+inline void
+update_cost_model(CostModel &model, Query const &query, double length,
+	bool heuristic_computed, uint64_t heuristic_pops,
+	uint64_t search_pops)
+{
+	auto blend = [](double &average, double observed) {
+		average += cost_model_weight * (observed - average);
+	};
+	if (heuristic_computed) {
+		blend(model.heuristic_pops, double(heuristic_pops));
+	}
+	double per_path = double(search_pops) / double(query.k);
+	blend(model.pops_per_path, per_path);
+	if (length > 0.0 and length < INFINITY) {
+		blend(model.pops_per_path_length, per_path / length);
+	}
+}
+
+struct ScheduledQuery {
+	/* The line of input it came from, for the answer. */
+	uint64_t number;
+	Query query;
+	std::chrono::steady_clock::time_point arrived;
+	double estimate;
+	/* Pops done so far, and the part of them that were the heuristic's. */
+	uint64_t done = 0;
+	uint64_t heuristic_pops = 0;
+	bool heuristic_computed = false;
+	/* Set once it has been started. */
+	std::unique_ptr<Workspace> workspace;
+	Engine const *engine = nullptr;
+	std::chrono::steady_clock::time_point started;
+	std::chrono::steady_clock::duration heuristic_time{};
+	std::chrono::steady_clock::duration search_time{};
+};
+
+struct Scheduler {
+	CostModel model;
+	uint64_t slice_pops = 20000;
+	double aging = 1.0;
+	size_t max_started = 8;
+	std::vector<ScheduledQuery> queries;
+	size_t num_started = 0;
+	/* The workspaces of finished queries, most recently used last. */
+	std::vector<std::unique_ptr<Workspace>> idle;
+};
+
+/* The workspace, started or idle, holding the heuristic for a destination,
+ * if there is one.
+ */
+inline Workspace const *
+find_heuristic(Scheduler const &scheduler, size_t destination)
+{
+	for (auto const &workspace : scheduler.idle) {
+		if (workspace->destination == destination) {
+			return workspace.get();
+		}
+	}
+	for (auto const &query : scheduler.queries) {
+		if (query.workspace and
+		    query.workspace->destination == destination) {
+			return query.workspace.get();
+		}
+	}
+	return nullptr;
+}
+
+inline void
+add_query(Scheduler &scheduler, uint64_t number, Query const &query,
+	std::chrono::steady_clock::time_point now)
+{
+	auto heuristic = find_heuristic(scheduler, query.destination);
+	double length = heuristic ? heuristic->shortest_path[query.source]
+		: NAN;
+	ScheduledQuery scheduled;
+	scheduled.number = number;
+	scheduled.query = query;
+	scheduled.arrived = now;
+	scheduled.estimate = estimate_cost(scheduler.model, query,
+		heuristic != nullptr, length);
+	scheduler.queries.push_back(std::move(scheduled));
+}
+
+/* The index of the query to run next. There must be at least one. */
+inline size_t
+pick_query(Scheduler const &scheduler,
+	std::chrono::steady_clock::time_point now)
+{
+	bool only_started = scheduler.num_started >= scheduler.max_started;
+	size_t best = SIZE_MAX;
+	double best_priority = INFINITY;
+	for (size_t i = 0; i < scheduler.queries.size(); ++i) {
+		auto const &query = scheduler.queries[i];
+		if (only_started and !query.workspace) {
+			continue;
+		}
+		/* A query which has overrun its estimate still has at least
+		 * a slice to go.
+		 */
+		double left = std::max(query.estimate - double(query.done),
+			double(scheduler.slice_pops));
+		std::chrono::duration<double> waited = now - query.arrived;
+		double priority = left / (1.0 + waited.count() /
+			scheduler.aging);
+		if (priority < best_priority) {
+			best_priority = priority;
+			best = i;
+		}
+	}
+	return best;
+}
+
+/* Give a query that is starting a workspace: preferably an idle one with
+ * the heuristic for its destination, then the least recently used idle one,
+ * then a new one.
+ */
+inline void
+start_query(Scheduler &scheduler, ScheduledQuery &query)
+{
+	auto &idle = scheduler.idle;
+	auto found = std::find_if(idle.rbegin(), idle.rend(),
+		[&](std::unique_ptr<Workspace> const &workspace) {
+			return workspace->destination ==
+				query.query.destination;
+		});
+	if (found != idle.rend()) {
+		query.workspace = std::move(*found);
+		idle.erase(std::next(found).base());
+	} else if (!idle.empty()) {
+		query.workspace = std::move(idle.front());
+		idle.erase(idle.begin());
+	} else {
+		query.workspace = std::make_unique<Workspace>();
+	}
+	scheduler.num_started += 1;
+}
+
+/* Take a finished query off the list, keeping its workspace for reuse. */
+inline void
+finish_query(Scheduler &scheduler, size_t index)
+{
+	auto &query = scheduler.queries[index];
+	scheduler.idle.push_back(std::move(query.workspace));
+	if (scheduler.idle.size() > scheduler.max_started) {
+		scheduler.idle.erase(scheduler.idle.begin());
+	}
+	scheduler.num_started -= 1;
+	scheduler.queries.erase(scheduler.queries.begin() + index);
+}
+
+#endif
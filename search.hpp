@@ -0,0 +1,468 @@
+#ifndef SEARCH_HPP
+#define SEARCH_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <queue>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "graph.hpp"
+#include "heatmap.hpp"
+#include "memory-usage.hpp"
+#include "queue-trace.hpp"
+#include "trace.hpp"
+
+/* In the pre-processing pass we find the absolute shortest path from the
+ * destination to every other node. This shortest path length is recorded
+ * per vertex and is used as the heuristic in the A* search. It is kept
+ * apart from the graph so that the graph is never modified by a query, and
+ * so that the heuristic can be reused by the next query if it has the same
+ * destination.
+ *
+ * The workspace also holds the path lengths found by the search, and keeps
+ * track of how large the queues and the visited set grew, so that the memory
+ * a query needs can be accounted for.
+ *
+ * If the heat-map's counters have been sized to the graph then the search
+ * counts every push and pop of each vertex into them, summed over every
+ * query which uses this workspace. They are left empty otherwise.
+ *
+ * If `record_paths' is set the search also finds the vertices along each
+ * path, not just its length. Every queue element then refers to an entry in
+ * the `trail', which records the element's vertex and the entry of the
+ * element it was reached from; following those back from the destination
+ * gives the path.
+ *
+ * If `record_queues' is set then each of the algorithms records every
+ * operation on its queue into its trace, which is overwritten by every query.
+ *
+ * The work the algorithms do is always counted, summed over every query.
+ * Unlike timings these counts are the same on every run, so `k-bench' can
+ * check them against its baseline on however noisy a machine.
+ *
+ * A search which has been stopped part way, to be carried on later, keeps
+ * its state in `paused_search' (see `resume_astar' in engines.hpp).
+ */
+struct TrailEntry {
+	size_t vertex;
+	size_t previous;
+};
+
+struct WorkCounts {
+	uint64_t heuristic_pushes = 0;
+	uint64_t heuristic_pops = 0;
+	uint64_t search_pushes = 0;
+	uint64_t search_pops = 0;
+	/* Edges looked at by either algorithm. */
+	uint64_t relaxations = 0;
+};
+
+struct Workspace {
+	std::vector<double> shortest_path;
+	size_t destination = SIZE_MAX;
+	std::vector<double> path_lengths;
+	size_t queue_peak = 0;
+	size_t visited_peak = 0;
+	Heatmap heatmap;
+	bool record_paths = false;
+	std::vector<TrailEntry> trail;
+	std::vector<std::vector<size_t>> paths;
+	bool record_queues = false;
+	QueueTrace heuristic_trace = {QUEUE_TRACE_HEURISTIC, 0, 0, {}};
+	QueueTrace search_trace = {QUEUE_TRACE_SEARCH, 0, 0, {}};
+	WorkCounts work;
+	std::shared_ptr<void> paused_search;
+};
+
+/* A query asks for the `k' shortest paths from `source' to `destination'. */
+struct Query {
+	size_t source;
+	size_t destination;
+	size_t k;
+};
+
+inline bool
+query_is_valid(Graph const &graph, Query const &query)
+{
+	return query.source < graph.vertices.size() and
+		query.destination < graph.vertices.size() and
+		query.k > 0;
+}
+
+/* Queries as they are read name vertices by their original ids; this turns
+ * them into the graph's own numbering. It fails if either doesn't exist.
+ */
+inline bool
+translate_query(Graph const &graph, Query &query)
+{
+	return find_vertex(graph, query.source, query.source) and
+		find_vertex(graph, query.destination, query.destination);
+}
+
+/* A custom structure is used to simplify the queue. Each element in the queue
+ * keeps track of which vertex we're currently talking about, the priority,
+ * and for the A*-search, the path length so far and where it is in the trail
+ * (if paths are being recorded).
+ *
+ * The A*-search numbers its elements in the order they are pushed whether
+ * or not there is a trail, and elements with the same priority come off the
+ * queue in that order. Otherwise a cycle of zero-weight edges next to the
+ * destination could keep the search going round it forever: every walk
+ * round it has the same priority, and a queue which happened to keep
+ * preferring them would never get to the destination.
+ *
+ * The algorithms take the type of their queue as a template parameter: it is
+ * std::priority_queue unless the planner picks one of the heaps from
+ * queues.hpp, which have the same interface.
+ */
+struct QueueElement {
+	size_t vertex_index;
+	double priority;
+	double path_length;
+	size_t trail_index;
+	bool operator<(QueueElement const &other) const {
+		if (priority != other.priority) {
+			return priority > other.priority;
+		}
+		if (path_length != other.path_length) {
+			return path_length < other.path_length;
+		}
+		return trail_index > other.trail_index;
+	}
+};
+
+/* A std::set node holds three pointers and a colour besides the value. */
+inline size_t const set_node_bytes = 4 * sizeof(void *) + sizeof(size_t);
+
+inline MemoryUsage
+workspace_memory_usage(Workspace const &workspace)
+{
+	size_t paths = 0;
+	for (auto const &path : workspace.paths) {
+		paths += vector_bytes(path);
+	}
+	return {
+		{"heuristic", vector_bytes(workspace.shortest_path)},
+		{"visited set peak", workspace.visited_peak * set_node_bytes},
+		{"queue peak", workspace.queue_peak * sizeof(QueueElement)},
+		{"path storage", vector_bytes(workspace.path_lengths) +
+			vector_bytes(workspace.trail) +
+			vector_bytes(workspace.paths) + paths},
+		{"heat-map", vector_bytes(workspace.heatmap.pops) +
+			vector_bytes(workspace.heatmap.pushes)},
+	};
+}
+
+/* This preprocessing stage performs Dijkstra's algorithm backwards -- that is,
+ * starting at the destination and moving outwards. After this we will have
+ * calculated the length of the absolute shortest path from any vertex in the
+ * graph to the destination.
+ *
+ * It can start from several vertices at once, each already some way from the
+ * destination, rather than from the destination itself: that is how a
+ * destination in the middle of a contracted chain is reached (see
+ * chains.hpp). The caller says which destination the heuristic is for.
+ */
+using HeuristicSeeds = std::vector<std::pair<size_t, double>>;
+
+template <typename Queue = std::priority_queue<QueueElement>>
+void
+calculate_heuristic(Graph const &graph, Workspace &workspace,
+	HeuristicSeeds const &seeds)
+{
+	TraceScope trace("heuristic");
+	std::set<size_t> visited_vertices;
+	Queue queue;
+	auto &work = workspace.work;
+	auto const &vertices = graph.vertices;
+	auto const &edges = graph.edges;
+	auto &shortest_path = workspace.shortest_path;
+	/* Every shortest path length starts out as `INFINITY' in preparation
+	 * of the Dijkstra's algorithm about to be performed.
+	 */
+	shortest_path.assign(vertices.size(), INFINITY);
+	/* The queue is keyed by vertex. A vertex which already has a finite
+	 * path length but hasn't been visited is in the queue, so pushing it
+	 * again is really decreasing its priority.
+	 */
+	QueueTrace *queue_trace = nullptr;
+	if (workspace.record_queues) {
+		queue_trace = &workspace.heuristic_trace;
+		*queue_trace = {QUEUE_TRACE_HEURISTIC, vertices.size(), 0, {}};
+	}
+	/* Initially the only elements in the priority queue are the seeds:
+	 * usually just the destination, as we are working backwards.
+	 */
+	for (auto const &seed : seeds) {
+		if (!(seed.second < shortest_path[seed.first])) {
+			continue;
+		}
+		if (queue_trace and shortest_path[seed.first] == INFINITY) {
+			queue_trace->insert(seed.first, seed.second);
+		} else if (queue_trace) {
+			queue_trace->decrease(seed.first, seed.second);
+		}
+		shortest_path[seed.first] = seed.second;
+		queue.push({seed.first, seed.second, seed.second, SIZE_MAX});
+		work.heuristic_pushes += 1;
+	}
+	while (!queue.empty()) {
+		/* Pop the next element off the queue. */
+		auto element = queue.top();
+		auto &vertex = vertices[element.vertex_index];
+		queue.pop();
+		work.heuristic_pops += 1;
+		/* Have we already calculated the shortest path for this vertex?
+		 * If so, skip.
+		 */
+		if (visited_vertices.count(element.vertex_index)) {
+			continue;
+		}
+		if (queue_trace) {
+			queue_trace->pop();
+		}
+		visited_vertices.insert(element.vertex_index);
+		double distance = element.path_length;
+		work.relaxations += vertex.incoming.size();
+		/* For every incoming edge to the current vertex. */
+		for (auto edge_index : vertex.incoming) {
+			auto const &edge = edges[edge_index];
+			if (!visited_vertices.count(edge.from)) {
+				double path_length = distance + edge.weight;
+				if (path_length < shortest_path[edge.from]) {
+					double previous = shortest_path[
+						edge.from];
+					if (queue_trace and
+					    previous == INFINITY) {
+						queue_trace->insert(edge.from,
+							path_length);
+					} else if (queue_trace) {
+						queue_trace->decrease(edge.from,
+							path_length);
+					}
+					shortest_path[edge.from] = path_length;
+					QueueElement element = {
+						edge.from,
+						path_length,
+						path_length,
+						SIZE_MAX};
+					queue.push(element);
+					work.heuristic_pushes += 1;
+					workspace.queue_peak = std::max(
+						workspace.queue_peak,
+						queue.size());
+				}
+			}
+		}
+	}
+	workspace.visited_peak = std::max(workspace.visited_peak,
+		visited_vertices.size());
+}
+
+template <typename Queue = std::priority_queue<QueueElement>>
+void
+calculate_heuristic(Graph const &graph, Workspace &workspace,
+	size_t destination)
+{
+	calculate_heuristic<Queue>(graph, workspace, {{destination, 0.0}});
+	workspace.destination = destination;
+}
+
+/* The way we calculate the k-shortest paths is by performing an A*-search,
+ * using the shortest path to the destination calculated in the previous
+ * function as the heuristic. As this heuristic is not an approximation,
+ * but is in fact exact, this is very fast.
+ *
+ * The lengths of the paths found are returned in order, in the workspace;
+ * there may be fewer than `k' of them if the destination can't be reached
+ * that many ways. The paths themselves are put in the workspace too, if it
+ * is recording them.
+ *
+ * The search can be stopped after any number of pops and carried on later
+ * from where it left off, which is how the server's scheduler shares its
+ * time between queries (see scheduler.hpp). Everything it keeps from one
+ * pop to the next is in a `SearchState' for that: `start_search' pushes the
+ * source, and `continue_search' pops up to `max_pops' elements and returns
+ * whether the search has finished.
+ */
+template <typename Queue>
+struct SearchState {
+	Queue queue;
+	size_t destination;
+	/* The number of paths still to find; 0 once the search is over. */
+	size_t k;
+	size_t num_pushed;
+};
+
+template <typename Queue>
+void
+start_search(Workspace &workspace, SearchState<Queue> &state,
+	size_t source, size_t destination, size_t k)
+{
+	workspace.path_lengths.clear();
+	workspace.trail.clear();
+	workspace.paths.clear();
+	if (workspace.record_queues) {
+		workspace.search_trace = {QUEUE_TRACE_SEARCH, 0, 0, {}};
+	}
+	state.queue = Queue();
+	state.destination = destination;
+	state.k = k;
+	/* This time the first element in the priority queue is the source.
+	 * The heuristic/priority is the shortest path cost we previously
+	 * calculated, and the current path length is 0.
+	 */
+	QueueElement initial_element = {
+		source,
+		workspace.shortest_path[source],
+		0.0,
+		0};
+	state.num_pushed = 1;
+	if (workspace.record_paths) {
+		workspace.trail.push_back({source, SIZE_MAX});
+	}
+	state.queue.push(initial_element);
+	workspace.work.search_pushes += 1;
+	if (!workspace.heatmap.pushes.empty()) {
+		workspace.heatmap.pushes[source] += 1;
+	}
+	if (workspace.record_queues) {
+		auto &queue_trace = workspace.search_trace;
+		queue_trace.insert(queue_trace.num_keys++,
+			initial_element.priority);
+	}
+}
+
+template <typename Queue>
+bool
+continue_search(Graph const &graph, Workspace &workspace,
+	SearchState<Queue> &state, uint64_t max_pops)
+{
+	TraceScope trace("search");
+	auto &path_lengths = workspace.path_lengths;
+	auto &trail = workspace.trail;
+	auto &queue = state.queue;
+	auto const destination = state.destination;
+	auto const &vertices = graph.vertices;
+	auto const &edges = graph.edges;
+	auto const &shortest_path = workspace.shortest_path;
+	auto &work = workspace.work;
+	/* When the heat-map is off these are null, and counting costs a
+	 * predictable branch per push and pop.
+	 */
+	uint64_t *pops = nullptr;
+	uint64_t *pushes = nullptr;
+	if (!workspace.heatmap.pops.empty()) {
+		pops = workspace.heatmap.pops.data();
+		pushes = workspace.heatmap.pushes.data();
+	}
+	/* Nothing is ever decreased in this queue, so every push inserts a
+	 * new key, numbered in order.
+	 */
+	QueueTrace *queue_trace = nullptr;
+	if (workspace.record_queues) {
+		queue_trace = &workspace.search_trace;
+	}
+	if (state.k == 0) {
+		return true;
+	}
+	for (uint64_t popped = 0; !queue.empty(); ++popped) {
+		if (popped == max_pops) {
+			return false;
+		}
+		/* Pop the next element off the queue. */
+		auto element = queue.top();
+		auto &vertex = vertices[element.vertex_index];
+		auto path_length = element.path_length;
+		queue.pop();
+		work.search_pops += 1;
+		if (pops) {
+			pops[element.vertex_index] += 1;
+		}
+		if (queue_trace) {
+			queue_trace->pop();
+		}
+		/* Is the current vertex the destination? Great, we've found
+		 * another path.
+		 */
+		if (element.vertex_index == destination) {
+			path_lengths.push_back(path_length);
+			if (workspace.record_paths) {
+				std::vector<size_t> path;
+				size_t index = element.trail_index;
+				while (index != SIZE_MAX) {
+					path.push_back(trail[index].vertex);
+					index = trail[index].previous;
+				}
+				std::reverse(path.begin(), path.end());
+				workspace.paths.push_back(std::move(path));
+			}
+			/* If we still have more paths to find, subtract 1
+			 * from k and keep going. Otherwise quit early.
+			 */
+			state.k -= 1;
+			if (state.k > 0) {
+				continue;
+			} else {
+				return true;
+			}
+		}
+		work.relaxations += vertex.outgoing.size();
+		/* For every outgoing edge from the current vertex... */
+		for (auto edge_index : vertex.outgoing) {
+			auto const &edge = edges[edge_index];
+			double current_path_length = path_length + edge.weight;
+			double heuristic = shortest_path[edge.to];
+			/* If the destination can't be reached from here then
+			 * no path can go this way, and queueing it would
+			 * only let the search wander forever once the real
+			 * paths run out.
+			 */
+			if (heuristic == INFINITY) {
+				continue;
+			}
+			/* Add to the priority queue. Recall that in an
+			 * A*-search the priority is the current cost +
+			 * the heuristic for the candidate node.
+			 */
+			QueueElement next_element = {
+				edge.to,
+				current_path_length + heuristic,
+				current_path_length,
+				state.num_pushed++};
+			if (workspace.record_paths) {
+				trail.push_back({edge.to, element.trail_index});
+			}
+			queue.push(next_element);
+			work.search_pushes += 1;
+			if (pushes) {
+				pushes[edge.to] += 1;
+			}
+			if (queue_trace) {
+				queue_trace->insert(queue_trace->num_keys++,
+					next_element.priority);
+			}
+		}
+		workspace.queue_peak = std::max(workspace.queue_peak,
+			queue.size());
+	}
+	state.k = 0;
+	return true;
+}
+
+template <typename Queue = std::priority_queue<QueueElement>>
+std::vector<double> const &
+search(Graph const &graph, Workspace &workspace, size_t source,
+	size_t destination, size_t k)
+{
+	SearchState<Queue> state;
+	start_search(workspace, state, source, destination, k);
+	continue_search(graph, workspace, state, UINT64_MAX);
+	return workspace.path_lengths;
+}
+
+#endif
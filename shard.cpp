@@ -0,0 +1,438 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <poll.h>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "chains.hpp"
+#include "engines.hpp"
+#include "graph-formats.hpp"
+#include "graph.hpp"
+#include "planner.hpp"
+#include "profile.hpp"
+#include "search.hpp"
+#include "snapshot.hpp"
+
+/* `k-shard' answers a file of queries with worker processes rather than
+ * threads, so that a query which crashes its worker (by running out of
+ * memory, say) takes nothing else down with it.
+ *
+ * The graph file, usually a snapshot, is mapped into memory and loaded
+ * once, and contracted and profiled, before any worker is forked; the
+ * workers never write to the graph, so they all share its pages with the
+ * driver copy-on-write, and starting one costs a fork rather than a load.
+ *
+ * The queries are split between the workers by destination, so that each
+ * heuristic is worked out by one worker only, and each worker answers its
+ * share grouped by destination. Answers come back over a pipe, each tagged
+ * with its query's number, and are written out in the order the queries
+ * were asked, as `k-short' would write them.
+ *
+ * A worker which dies before it has answered all its queries is started
+ * again on the ones left. The first of those is the one it was working on,
+ * so if the same query has been being answered each time a worker died
+ * `--retries' times over, it is answered with an error instead and
+ * skipped. `--memory-limit' caps each worker's address space, so that a
+ * query which would take all the memory only takes down its worker.
+ */
+
+/* A stream reading from memory which is already mapped. */
+struct MemoryBuffer : std::streambuf {
+	MemoryBuffer(char const *data, size_t size)
+	{
+		char *begin = const_cast<char *>(data);
+		setg(begin, begin, begin + size);
+	}
+};
+
+struct Shard {
+	/* The queries it answers, in the order it answers them. */
+	std::vector<size_t> queries;
+	/* The first not yet answered. */
+	size_t next = 0;
+	pid_t pid = -1;
+	int from_worker = -1;
+	std::string partial_line;
+	size_t restarts = 0;
+};
+
+struct Answers {
+	std::vector<std::string> lines;
+	std::vector<bool> answered;
+	/* How many times a worker has died working on each query. */
+	std::vector<size_t> crashes;
+	size_t next_to_write = 0;
+};
+
+/* Sizes may be given in bytes or with a K, M or G (binary) suffix. */
+size_t
+parse_size(char const *text)
+{
+	char *end;
+	double size = std::strtod(text, &end);
+	switch (*end) {
+	case 'G': case 'g':
+		size *= 1024;
+		/* fall through */
+	case 'M': case 'm':
+		size *= 1024;
+		/* fall through */
+	case 'K': case 'k':
+		size *= 1024;
+		break;
+	}
+	return size_t(size);
+}
+
+std::string
+format_path_lengths(std::vector<double> const &path_lengths)
+{
+	std::ostringstream out;
+	for (size_t i = 0; i < path_lengths.size(); ++i) {
+		if (i > 0) {
+			out << ", ";
+		}
+		out << path_lengths[i];
+	}
+	return out.str();
+}
+
+bool
+write_all(int fd, std::string const &text)
+{
+	size_t written = 0;
+	while (written < text.size()) {
+		ssize_t n = write(fd, text.data() + written,
+			text.size() - written);
+		if (n < 0 and errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		written += n;
+	}
+	return true;
+}
+
+/* The worker: answer the shard's queries from `shard.next' on, skipping any
+ * which have already been given up on, writing "NUMBER ANSWER" for each.
+ */
+[[noreturn]] void
+run_worker(Graph const &graph, GraphProfile const &profile,
+	std::vector<Query> const &queries, Shard const &shard,
+	Answers const &answers, int to_driver, size_t memory_limit)
+{
+	if (memory_limit > 0) {
+		rlimit limit = {memory_limit, memory_limit};
+		setrlimit(RLIMIT_AS, &limit);
+	}
+	Workspace workspace;
+	auto const &order = shard.queries;
+	for (size_t i = shard.next; i < order.size(); ++i) {
+		size_t index = order[i];
+		if (answers.answered[index]) {
+			continue;
+		}
+		auto const &query = queries[index];
+		size_t reuse = 1;
+		while (i + reuse < order.size() and
+		       queries[order[i + reuse]].destination ==
+		       query.destination) {
+			reuse += 1;
+		}
+		bool heuristic_ready =
+			workspace.destination == query.destination;
+		auto plan = plan_query(profile, heuristic_ready, query, reuse);
+		auto const &engine = *plan.engine;
+		if (engine.prepare and !heuristic_ready) {
+			engine.prepare(graph, workspace, query);
+		}
+		auto const &path_lengths = engine.search(graph, workspace,
+			query);
+		if (!write_all(to_driver, std::to_string(index) + " " +
+		               format_path_lengths(path_lengths) + "\n")) {
+			_exit(1);
+		}
+	}
+	_exit(0);
+}
+
+void
+start_worker(Graph const &graph, GraphProfile const &profile,
+	std::vector<Query> const &queries, Shard &shard,
+	Answers const &answers, size_t memory_limit)
+{
+	int pipe_fds[2];
+	if (pipe(pipe_fds) != 0) {
+		std::perror("pipe");
+		std::exit(2);
+	}
+	std::cout.flush();
+	shard.pid = fork();
+	if (shard.pid < 0) {
+		std::perror("fork");
+		std::exit(2);
+	}
+	if (shard.pid == 0) {
+		close(pipe_fds[0]);
+		run_worker(graph, profile, queries, shard, answers,
+			pipe_fds[1], memory_limit);
+	}
+	close(pipe_fds[1]);
+	shard.from_worker = pipe_fds[0];
+	shard.partial_line.clear();
+}
+
+/* Take in the answers in a chunk of a worker's output, and write out any
+ * which are now next in order.
+ */
+void
+take_answers(Shard &shard, Answers &answers, char const *data, size_t size)
+{
+	shard.partial_line.append(data, size);
+	size_t start = 0;
+	for (;;) {
+		size_t end = shard.partial_line.find('\n', start);
+		if (end == std::string::npos) {
+			break;
+		}
+		std::string line = shard.partial_line.substr(start,
+			end - start);
+		start = end + 1;
+		size_t space = line.find(' ');
+		size_t index = std::strtoull(line.c_str(), nullptr, 10);
+		if (space == std::string::npos or
+		    index >= answers.lines.size()) {
+			continue;
+		}
+		answers.lines[index] = line.substr(space + 1);
+		answers.answered[index] = true;
+	}
+	shard.partial_line.erase(0, start);
+	while (shard.next < shard.queries.size() and
+	       answers.answered[shard.queries[shard.next]]) {
+		shard.next += 1;
+	}
+	auto &next = answers.next_to_write;
+	while (next < answers.lines.size() and answers.answered[next]) {
+		std::cout << answers.lines[next] << "\n";
+		answers.lines[next].clear();
+		answers.lines[next].shrink_to_fit();
+		next += 1;
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t num_workers = 4;
+	size_t retries = 2;
+	size_t memory_limit = 0;
+	bool contract = true;
+	bool bad_usage = false;
+
+	static option const long_options[] = {
+		{"workers", required_argument, nullptr, 'w'},
+		{"retries", required_argument, nullptr, 'r'},
+		{"memory-limit", required_argument, nullptr, 'm'},
+		{"no-contract", no_argument, nullptr, 'c'},
+		{nullptr, 0, nullptr, 0},
+	};
+	int option;
+	while ((option = getopt_long(argc, argv, "w:r:m:c", long_options,
+	                             nullptr)) != -1) {
+		switch (option) {
+		case 'w':
+			num_workers = std::max<size_t>(1,
+				std::strtoull(optarg, nullptr, 10));
+			break;
+		case 'r':
+			retries = std::strtoull(optarg, nullptr, 10);
+			break;
+		case 'm':
+			memory_limit = parse_size(optarg);
+			break;
+		case 'c':
+			contract = false;
+			break;
+		default:
+			bad_usage = true;
+			break;
+		}
+	}
+	if (bad_usage or optind + 2 != argc) {
+		std::cerr << "Usage: " << argv[0] << " [--workers N]";
+		std::cerr << " [--retries N] [--memory-limit SIZE]";
+		std::cerr << " [--no-contract] GRAPHFILE QUERYFILE";
+		std::cerr << std::endl;
+		return 2;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	MappedFile mapped;
+	Graph graph;
+	{
+		if (!mapped.open(argv[optind])) {
+			std::cerr << argv[optind] << ": could not open";
+			std::cerr << std::endl;
+			return 2;
+		}
+		MemoryBuffer buffer(mapped.data, mapped.size);
+		std::istream in(&buffer);
+		if (!read_graph(in, graph)) {
+			std::cerr << argv[optind] << ": could not read graph";
+			std::cerr << std::endl;
+			return 2;
+		}
+	}
+	if (contract) {
+		graph.chains = contract_chains(graph);
+	}
+	GraphProfile profile = profile_graph(graph);
+	auto loaded = std::chrono::steady_clock::now();
+
+	std::ifstream query_file(argv[optind + 1]);
+	if (!query_file) {
+		std::cerr << argv[optind + 1] << ": could not open";
+		std::cerr << std::endl;
+		return 2;
+	}
+	std::vector<Query> queries;
+	Query query;
+	while (query_file >> query.source >> query.destination >> query.k) {
+		if (!translate_query(graph, query) or
+		    !query_is_valid(graph, query)) {
+			std::cerr << "invalid query" << std::endl;
+			continue;
+		}
+		queries.push_back(query);
+	}
+
+	/* Each destination goes to one worker, and each worker answers its
+	 * queries grouped by destination, in the order they were asked
+	 * otherwise.
+	 */
+	std::vector<Shard> shards(num_workers);
+	for (size_t i = 0; i < queries.size(); ++i) {
+		size_t destination = queries[i].destination;
+		size_t worker = (destination * 0x9e3779b97f4a7c15 >> 32) %
+			num_workers;
+		shards[worker].queries.push_back(i);
+	}
+	for (auto &shard : shards) {
+		std::stable_sort(shard.queries.begin(), shard.queries.end(),
+			[&](size_t a, size_t b) {
+				return queries[a].destination <
+					queries[b].destination;
+			});
+	}
+	Answers answers;
+	answers.lines.resize(queries.size());
+	answers.answered.assign(queries.size(), false);
+	answers.crashes.assign(queries.size(), 0);
+
+	std::signal(SIGPIPE, SIG_IGN);
+	for (auto &shard : shards) {
+		if (!shard.queries.empty()) {
+			start_worker(graph, profile, queries, shard, answers,
+				memory_limit);
+		}
+	}
+
+	size_t restarts = 0;
+	size_t failed = 0;
+	for (;;) {
+		std::vector<pollfd> fds;
+		std::vector<Shard *> polled;
+		for (auto &shard : shards) {
+			if (shard.from_worker >= 0) {
+				fds.push_back({shard.from_worker, POLLIN, 0});
+				polled.push_back(&shard);
+			}
+		}
+		if (fds.empty()) {
+			break;
+		}
+		if (poll(fds.data(), fds.size(), -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			std::perror("poll");
+			return 2;
+		}
+		for (size_t i = 0; i < fds.size(); ++i) {
+			if (fds[i].revents == 0) {
+				continue;
+			}
+			auto &shard = *polled[i];
+			char buffer[1 << 16];
+			ssize_t n = read(shard.from_worker, buffer,
+				sizeof(buffer));
+			if (n < 0 and errno == EINTR) {
+				continue;
+			}
+			if (n > 0) {
+				take_answers(shard, answers, buffer, n);
+				continue;
+			}
+			/* The worker has finished, or died. */
+			close(shard.from_worker);
+			shard.from_worker = -1;
+			int status = 0;
+			waitpid(shard.pid, &status, 0);
+			if (shard.next == shard.queries.size()) {
+				continue;
+			}
+			size_t suspect = shard.queries[shard.next];
+			std::cerr << "worker " << shard.pid;
+			if (WIFSIGNALED(status)) {
+				std::cerr << " killed by signal ";
+				std::cerr << WTERMSIG(status);
+			} else {
+				std::cerr << " exited with status ";
+				std::cerr << WEXITSTATUS(status);
+			}
+			std::cerr << " on query " << suspect + 1 << std::endl;
+			answers.crashes[suspect] += 1;
+			if (answers.crashes[suspect] > retries) {
+				std::string line = std::to_string(suspect) +
+					" error: worker crashed\n";
+				take_answers(shard, answers, line.data(),
+					line.size());
+				failed += 1;
+			}
+			if (shard.next < shard.queries.size()) {
+				shard.restarts += 1;
+				restarts += 1;
+				start_worker(graph, profile, queries, shard,
+					answers, memory_limit);
+			}
+		}
+	}
+	std::cout.flush();
+	auto finished = std::chrono::steady_clock::now();
+
+	std::chrono::duration<double, std::milli> load_time = loaded - start;
+	std::chrono::duration<double, std::milli> answer_time =
+		finished - loaded;
+	std::cerr << "Loading time: " << load_time.count();
+	std::cerr << " milliseconds." << std::endl;
+	std::cerr << "Answered " << queries.size() << " queries with ";
+	std::cerr << num_workers << " workers in " << answer_time.count();
+	std::cerr << " milliseconds, " << restarts << " restarts, ";
+	std::cerr << failed << " failed." << std::endl;
+	return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,303 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "graph.hpp"
+#include "trace.hpp"
+
+/* A graph snapshot is the graph in binary, which loads far faster than the
+ * text format as nothing has to be parsed.
+ *
+ * It starts with the magic "KSGRPH1\0" and is followed by sections, each an
+ * 8 byte name padded with zeroes, the size of its contents in bytes as a
+ * 64-bit integer, and then the contents:
+ *
+ * - "EDGES": the number of vertices and the number of edges, as 64-bit
+ *   integers, then the edges as they are in memory (each a double weight
+ *   then the 64-bit `from' and `to' vertices);
+ * - "IDS": the original id of every vertex, as 64-bit integers, if the
+ *   vertices have been renumbered;
+ * - "IDBASE": the original id of vertex 0 (the graph's id offset), as a
+ *   64-bit integer, if the ids aren't in "IDS" and don't start from 0;
+ * - "COORDS": the x and y coordinates of every vertex, as doubles, if the
+ *   graph has them.
+ *
+ * Sections which aren't understood are skipped, so new ones can be added
+ * without breaking older readers. Everything is in native byte order.
+ */
+
+char const snapshot_magic[8] = {'K', 'S', 'G', 'R', 'P', 'H', '1', '\0'};
+
+/* Far more vertices than any graph could have: a count past this is taken
+ * to be corruption, since the vertices take no room in the file to check
+ * their count against.
+ */
+uint64_t const max_snapshot_vertices = uint64_t(1) << 40;
+
+inline void
+write_snapshot_section(std::ostream &file, char const *name, void const *data,
+	uint64_t size)
+{
+	char padded[8] = {};
+	std::strncpy(padded, name, sizeof(padded));
+	file.write(padded, sizeof(padded));
+	file.write((char const *) &size, sizeof(size));
+	file.write((char const *) data, size);
+}
+
+inline bool
+write_snapshot(std::ostream &file, Graph const &graph)
+{
+	TraceScope trace("write snapshot");
+	file.write(snapshot_magic, sizeof(snapshot_magic));
+	uint64_t counts[2] = {graph.vertices.size(), graph.edges.size()};
+	uint64_t edge_bytes = graph.edges.size() * sizeof(Edge);
+	char name[8] = {'E', 'D', 'G', 'E', 'S'};
+	uint64_t size = sizeof(counts) + edge_bytes;
+	file.write(name, sizeof(name));
+	file.write((char const *) &size, sizeof(size));
+	file.write((char const *) counts, sizeof(counts));
+	file.write((char const *) graph.edges.data(), edge_bytes);
+	if (!graph.original_ids.empty()) {
+		write_snapshot_section(file, "IDS", graph.original_ids.data(),
+			graph.original_ids.size() * sizeof(uint64_t));
+	} else if (graph.id_offset != 0) {
+		write_snapshot_section(file, "IDBASE", &graph.id_offset,
+			sizeof(graph.id_offset));
+	}
+	if (!graph.coordinates.empty()) {
+		write_snapshot_section(file, "COORDS", graph.coordinates.data(),
+			graph.coordinates.size() * sizeof(Point));
+	}
+	return bool(file);
+}
+
+inline bool
+write_snapshot(std::string const &filename, Graph const &graph)
+{
+	std::ofstream file(filename, std::ios::binary);
+	return file and write_snapshot(file, graph);
+}
+
+/* Whether an edge of a graph with `num_vertices' vertices could be real:
+ * both ends exist and the weight is finite and not negative.
+ */
+inline bool
+snapshot_edge_is_valid(Edge const &edge, uint64_t num_vertices)
+{
+	return edge.from < num_vertices and edge.to < num_vertices and
+		edge.weight >= 0.0 and edge.weight < INFINITY;
+}
+
+/* Read `count' elements, a chunk at a time, so that a count which is more
+ * than the file holds fails when the file runs out rather than allocating
+ * it all first. Where the stream can say how much is left, that much is
+ * allocated up front.
+ */
+template <typename T>
+bool
+read_snapshot_array(std::istream &file, uint64_t count,
+	std::vector<T> &values)
+{
+	size_t const chunk_size = (1 << 20) / sizeof(T);
+	values.clear();
+	auto here = file.tellg();
+	if (here != std::istream::pos_type(-1) and
+	    file.seekg(0, std::ios::end)) {
+		uint64_t left = uint64_t(file.tellg() - here);
+		file.seekg(here);
+		values.reserve(std::min<uint64_t>(count, left / sizeof(T)));
+	}
+	file.clear(file.rdstate() & ~std::ios::failbit);
+	while (values.size() < count) {
+		size_t done = values.size();
+		size_t chunk = std::min<uint64_t>(count - done, chunk_size);
+		values.resize(done + chunk);
+		file.read((char *) (values.data() + done), chunk * sizeof(T));
+		if (!file) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Read a snapshot whose magic has already been read. The stream is left
+ * after the last section, which is found by peeking for another name: the
+ * text format's queries may follow, as they may follow a text graph.
+ *
+ * Nothing in the file is trusted: the sections' sizes have to agree with
+ * what they hold, the arrays are read a chunk at a time, and the edges are
+ * checked as `scan_snapshot_edges' checks them, all before the vertices are
+ * allocated.
+ */
+inline bool
+read_snapshot_sections(std::istream &file, Graph &graph)
+{
+	TraceScope trace("read snapshot");
+	bool have_edges = false;
+	uint64_t num_vertices = 0;
+	std::vector<Edge> edges;
+	std::vector<uint64_t> original_ids;
+	uint64_t id_offset = 0;
+	std::vector<Point> coordinates;
+	for (;;) {
+		int next = file.peek();
+		if (next == EOF or !std::isupper(next)) {
+			break;
+		}
+		char name[8];
+		uint64_t size;
+		file.read(name, sizeof(name));
+		file.read((char *) &size, sizeof(size));
+		if (!file) {
+			return false;
+		}
+		bool ok = true;
+		if (std::strncmp(name, "EDGES", sizeof(name)) == 0) {
+			uint64_t counts[2];
+			file.read((char *) counts, sizeof(counts));
+			ok = file and size >= sizeof(counts) and
+				(size - sizeof(counts)) % sizeof(Edge) == 0 and
+				counts[1] == (size - sizeof(counts)) /
+					sizeof(Edge) and
+				counts[0] <= max_snapshot_vertices and
+				read_snapshot_array(file, counts[1], edges);
+			num_vertices = counts[0];
+			have_edges = true;
+		} else if (std::strncmp(name, "IDS", sizeof(name)) == 0) {
+			ok = size % sizeof(uint64_t) == 0 and
+				read_snapshot_array(file,
+					size / sizeof(uint64_t),
+					original_ids);
+		} else if (std::strncmp(name, "IDBASE", sizeof(name)) == 0) {
+			ok = size == sizeof(id_offset) and file.read(
+				(char *) &id_offset, sizeof(id_offset));
+		} else if (std::strncmp(name, "COORDS", sizeof(name)) == 0) {
+			ok = size % sizeof(Point) == 0 and
+				read_snapshot_array(file,
+					size / sizeof(Point), coordinates);
+		} else {
+			file.ignore(size);
+			ok = bool(file);
+		}
+		if (!ok) {
+			return false;
+		}
+	}
+	if (!have_edges or (!original_ids.empty() and
+	                    original_ids.size() != num_vertices) or
+	    (!coordinates.empty() and coordinates.size() != num_vertices)) {
+		return false;
+	}
+	for (auto const &edge : edges) {
+		if (!snapshot_edge_is_valid(edge, num_vertices)) {
+			return false;
+		}
+	}
+	graph.vertices.assign(num_vertices, Vertex{});
+	graph.edges = std::move(edges);
+	if (!original_ids.empty()) {
+		set_original_ids(graph, std::move(original_ids));
+	} else {
+		graph.id_offset = id_offset;
+	}
+	graph.coordinates = std::move(coordinates);
+	build_adjacency(graph);
+	return true;
+}
+
+/* Read just the edges of a snapshot, a chunk at a time, without keeping
+ * the graph: for a process which only wants a few of the edges of a graph
+ * too large to hold whole. `begin' is called with the numbers of vertices
+ * and edges, then `visit' with each chunk of edges in order. Returns false
+ * if the file isn't a snapshot, is cut short, or has an edge which is out of
+ * range or has a negative or infinite weight.
+ */
+template <typename Begin, typename Visit>
+bool
+scan_snapshot_edges(std::istream &file, Begin begin, Visit visit)
+{
+	TraceScope trace("scan snapshot");
+	char magic[sizeof(snapshot_magic)];
+	file.read(magic, sizeof(magic));
+	if (!file or std::memcmp(magic, snapshot_magic, sizeof(magic)) != 0) {
+		return false;
+	}
+	bool have_edges = false;
+	std::vector<Edge> chunk;
+	for (;;) {
+		int next = file.peek();
+		if (next == EOF or !std::isupper(next)) {
+			break;
+		}
+		char name[8];
+		uint64_t size;
+		file.read(name, sizeof(name));
+		file.read((char *) &size, sizeof(size));
+		if (!file) {
+			return false;
+		}
+		if (std::strncmp(name, "EDGES", sizeof(name)) != 0) {
+			file.ignore(size);
+			if (!file) {
+				return false;
+			}
+			continue;
+		}
+		uint64_t counts[2];
+		file.read((char *) counts, sizeof(counts));
+		if (!file or size < sizeof(counts) or
+		    (size - sizeof(counts)) % sizeof(Edge) != 0 or
+		    counts[1] != (size - sizeof(counts)) / sizeof(Edge) or
+		    counts[0] > max_snapshot_vertices) {
+			return false;
+		}
+		begin(counts[0], counts[1]);
+		for (uint64_t left = counts[1]; left > 0; ) {
+			chunk.resize(std::min<uint64_t>(left, 1 << 16));
+			file.read((char *) chunk.data(),
+				chunk.size() * sizeof(Edge));
+			if (!file) {
+				return false;
+			}
+			for (auto const &edge : chunk) {
+				if (!snapshot_edge_is_valid(edge, counts[0])) {
+					return false;
+				}
+			}
+			visit(chunk);
+			left -= chunk.size();
+		}
+		have_edges = true;
+	}
+	return have_edges;
+}
+
+/* Read a graph in either format, telling them apart by the magic: a text
+ * graph starts with a digit. Returns false if the graph is corrupt or cut
+ * short.
+ */
+inline bool
+read_graph(std::istream &file, Graph &graph)
+{
+	if (file.peek() != snapshot_magic[0]) {
+		graph = read_graph_from_file(file);
+		return bool(file);
+	}
+	char magic[sizeof(snapshot_magic)];
+	file.read(magic, sizeof(magic));
+	return file and std::memcmp(magic, snapshot_magic,
+		sizeof(magic)) == 0 and read_snapshot_sections(file, graph);
+}
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef SPARSE_IDS_HPP
+#define SPARSE_IDS_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <istream>
+#include <vector>
+
+#include "graph.hpp"
+#include "parallel.hpp"
+#include "trace.hpp"
+
+/* Graphs exported from map data name their vertices by the map's own ids
+ * (OpenStreetMap node ids, say), which are 64-bit and nowhere near dense.
+ * With sparse ids the text format is the same, but the vertices are just
+ * the ids the edges use, and the count in the header is only an upper
+ * bound on how many there are. They are numbered from 0 in order of id, and
+ * the ids are kept as the graph's original ids, so queries and answers go
+ * on using them (and a snapshot of the graph stores them).
+ *
+ * The numbering is a sort of every id an edge names, shared out between
+ * `num_threads' threads: each sorts a block, and then neighbouring blocks
+ * are merged in pairs, also in parallel, until there is one. Looking up the
+ * new number of each edge's ends is a binary search, shared out likewise.
+ */
+
+inline void
+parallel_sort(std::vector<uint64_t> &values, size_t num_threads)
+{
+	TraceScope trace("sort ids");
+	size_t const size = values.size();
+	num_threads = std::max<size_t>(1, std::min(num_threads, size));
+	std::vector<size_t> bounds;
+	for (size_t t = 0; t <= num_threads; ++t) {
+		bounds.push_back(size * t / num_threads);
+	}
+	run_in_blocks(num_threads, num_threads, [&](size_t first,
+	                                            size_t last) {
+		for (size_t t = first; t < last; ++t) {
+			std::sort(values.begin() + bounds[t],
+				values.begin() + bounds[t + 1]);
+		}
+	});
+	for (size_t width = 1; width < num_threads; width *= 2) {
+		size_t num_merges = (num_threads + 2 * width - 1) /
+			(2 * width);
+		run_in_blocks(num_merges, num_merges, [&](size_t first,
+		                                          size_t last) {
+			for (size_t m = first; m < last; ++m) {
+				size_t low = 2 * width * m;
+				size_t middle = std::min(low + width,
+					num_threads);
+				size_t high = std::min(low + 2 * width,
+					num_threads);
+				auto begin = values.begin();
+				std::inplace_merge(begin + bounds[low],
+					begin + bounds[middle],
+					begin + bounds[high]);
+			}
+		});
+	}
+}
+
+/* Read a graph in the text format with sparse ids. Like a graph with dense
+ * ids, the stream fails if an edge can't be parsed, or if the edges name
+ * more vertices than the header says there are.
+ */
+inline Graph
+read_graph_with_sparse_ids(std::istream &file, size_t num_threads)
+{
+	size_t max_vertices = 0;
+	size_t num_edges = 0;
+	file >> max_vertices;
+	file >> num_edges;
+	if (!file) {
+		return Graph();
+	}
+	std::vector<uint64_t> ends;
+	std::vector<double> weights;
+	ends.reserve(2 * num_edges);
+	weights.reserve(num_edges);
+	size_t const chunk_size = 1 << 16;
+	for (size_t chunk = 0; chunk < num_edges and file;
+	     chunk += chunk_size) {
+		TraceScope trace("parse chunk");
+		size_t end = std::min(chunk + chunk_size, num_edges);
+		for (size_t i = chunk; i < end; ++i) {
+			uint64_t from, to;
+			double weight;
+			file >> from;
+			file >> to;
+			file >> weight;
+			if (!file) {
+				break;
+			}
+			ends.push_back(from);
+			ends.push_back(to);
+			weights.push_back(weight);
+		}
+	}
+
+	std::vector<uint64_t> ids = ends;
+	parallel_sort(ids, num_threads);
+	ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+	if (ids.size() > max_vertices) {
+		file.setstate(std::ios::failbit);
+	}
+
+	TraceScope trace("renumber");
+	std::vector<Edge> edges(weights.size());
+	run_in_blocks(edges.size(), num_threads, [&](size_t first,
+	                                             size_t last) {
+		auto number = [&](uint64_t id) {
+			return size_t(std::lower_bound(ids.begin(), ids.end(),
+				id) - ids.begin());
+		};
+		for (size_t i = first; i < last; ++i) {
+			edges[i] = {weights[i], number(ends[2 * i]),
+				number(ends[2 * i + 1])};
+		}
+	});
+	Graph graph = build_graph(ids.size(), std::move(edges));
+	set_original_ids(graph, std::move(ids));
+	return graph;
+}
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* A small tracing layer which records when each phase of the program begins
+ * and ends, on every thread, and writes them out in the Chrome trace event
+ * format so they can be viewed in chrome://tracing or Perfetto.
+ *
+ * Each thread records into its own fixed-size ring buffer, so recording an
+ * event never takes a lock; only the first event on a thread does, to
+ * register the buffer. When tracing is disabled every trace point is a single
+ * relaxed load and a branch.
+ */
+
+struct TraceEvent {
+	char const *name;
+	uint64_t timestamp;
+	char phase;
+};
+
+struct TraceBuffer {
+	static size_t const capacity = 1 << 16;
+	std::vector<TraceEvent> events;
+	size_t next;
+	size_t thread_id;
+};
+
+inline std::atomic<bool> trace_enabled{false};
+inline std::mutex trace_mutex;
+inline std::vector<std::unique_ptr<TraceBuffer>> trace_buffers;
+inline auto const trace_epoch = std::chrono::steady_clock::now();
+
+/* Buffers are owned by `trace_buffers' rather than by the thread, so that
+ * the events of threads which have already finished are still written out.
+ */
+inline TraceBuffer &
+trace_buffer()
+{
+	thread_local TraceBuffer *buffer = nullptr;
+	if (buffer == nullptr) {
+		std::lock_guard<std::mutex> lock(trace_mutex);
+		trace_buffers.push_back(std::make_unique<TraceBuffer>());
+		buffer = trace_buffers.back().get();
+		buffer->events.resize(TraceBuffer::capacity);
+		buffer->next = 0;
+		buffer->thread_id = trace_buffers.size();
+	}
+	return *buffer;
+}
+
+inline void
+trace_event(char const *name, char phase)
+{
+	auto &buffer = trace_buffer();
+	auto now = std::chrono::steady_clock::now() - trace_epoch;
+	auto &event = buffer.events[buffer.next % TraceBuffer::capacity];
+	event.name = name;
+	event.timestamp = std::chrono::duration_cast<
+		std::chrono::nanoseconds>(now).count();
+	event.phase = phase;
+	buffer.next += 1;
+}
+
+/* Marks the lifetime of a scope as a slice named `name'. The name must be a
+ * string literal (or otherwise outlive the trace), as only the pointer is
+ * kept.
+ */
+struct TraceScope {
+	TraceScope(char const *name) :
+		name{name},
+		active{trace_enabled.load(std::memory_order_relaxed)}
+	{
+		if (active) {
+			trace_event(name, 'B');
+		}
+	}
+	~TraceScope()
+	{
+		if (active) {
+			trace_event(name, 'E');
+		}
+	}
+	TraceScope(TraceScope const &) = delete;
+	TraceScope &operator=(TraceScope const &) = delete;
+private:
+	char const *name;
+	bool active;
+};
+
+/* Write every buffer out as a Chrome trace JSON file. This should only be
+ * called once the traced threads have stopped recording. If a buffer has
+ * wrapped around, the `E' events whose `B' was overwritten are dropped so
+ * that the remaining slices still nest properly.
+ */
+inline bool
+trace_write(std::string const &filename)
+{
+	std::ofstream file(filename);
+	if (!file) {
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(trace_mutex);
+	bool first = true;
+	file << "{\"traceEvents\":[";
+	for (auto const &buffer : trace_buffers) {
+		size_t begin = 0;
+		if (buffer->next > TraceBuffer::capacity) {
+			begin = buffer->next - TraceBuffer::capacity;
+		}
+		size_t depth = 0;
+		for (size_t i = begin; i < buffer->next; ++i) {
+			auto const &event = buffer->events[
+				i % TraceBuffer::capacity];
+			if (event.phase == 'E') {
+				if (depth == 0) {
+					continue;
+				}
+				depth -= 1;
+			} else {
+				depth += 1;
+			}
+			if (!first) {
+				file << ",";
+			}
+			first = false;
+			file << "\n{\"name\":\"" << event.name << "\",";
+			file << "\"ph\":\"" << event.phase << "\",";
+			file << "\"ts\":" << event.timestamp / 1000;
+			file << "." << event.timestamp / 100 % 10;
+			file << event.timestamp / 10 % 10;
+			file << event.timestamp % 10 << ",";
+			file << "\"pid\":1,";
+			file << "\"tid\":" << buffer->thread_id << "}";
+		}
+	}
+	file << "\n]}" << std::endl;
+	return bool(file);
+}
+
+#endif